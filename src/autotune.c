@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/autotune.c
+ *
+ * Import worker count controller
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file autotune.c
+ * @date 18 October 2026
+ * @brief Feedback controller for the number of active import workers.
+ *
+ * Every LDB_AUTOTUNE_INTERVAL_MS the import throughput (bytes read and written by the
+ * process, from /proc/self/io) and the system I/O wait (from /proc/stat) are measured.
+ * The controller climbs towards the best throughput one worker at a time: it keeps
+ * going in the same direction while the throughput improves, turns around when it
+ * gets worse and removes workers when it stays flat, since they add nothing. When the
+ * system spends more than LDB_AUTOTUNE_IOWAIT % of its time waiting for I/O, the disks
+ * are the bottleneck and workers are removed. The number of workers always stays
+ * between the bounds of the table being imported.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "autotune.h"
+#include "logger.h"
+
+/* Bytes read and written by this process, including the ones served by the page cache */
+static uint64_t autotune_bytes(void)
+{
+	FILE *fp = fopen("/proc/self/io", "r");
+	if (!fp)
+		return 0;
+
+	char line[128];
+	unsigned long long v = 0, bytes = 0;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "rchar: %llu", &v) == 1 || sscanf(line, "wchar: %llu", &v) == 1)
+			bytes += v;
+	fclose(fp);
+	return bytes;
+}
+
+/* Total and I/O wait CPU time of the system */
+static void autotune_cpu(uint64_t *total, uint64_t *iowait)
+{
+	*total = *iowait = 0;
+	FILE *fp = fopen("/proc/stat", "r");
+	if (!fp)
+		return;
+
+	unsigned long long v[8] = {0};
+	if (fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) == 8)
+	{
+		for (int i = 0; i < 8; i++)
+			*total += v[i];
+		*iowait = v[4];
+	}
+	fclose(fp);
+}
+
+static void autotune_measure(ldb_autotune_t *tune)
+{
+	tune->bytes = autotune_bytes();
+	autotune_cpu(&tune->cpu_total, &tune->cpu_iowait);
+	clock_gettime(CLOCK_MONOTONIC, &tune->time);
+}
+
+/**
+ * @brief Start controlling the workers of a table
+ *
+ * @param tune controller
+ * @param min minimum number of active workers (at least one)
+ * @param max maximum number of active workers
+ */
+void ldb_autotune_start(ldb_autotune_t *tune, int min, int max)
+{
+	memset(tune, 0, sizeof(*tune));
+	tune->min = min > 0 ? min : 1;
+	tune->max = max > tune->min ? max : tune->min;
+	tune->direction = 1;
+	autotune_measure(tune);
+}
+
+/**
+ * @brief Bring a number of workers within the bounds of the controller
+ */
+int ldb_autotune_clamp(ldb_autotune_t *tune, int workers)
+{
+	if (workers < tune->min)
+		return tune->min;
+	if (workers > tune->max)
+		return tune->max;
+	return workers;
+}
+
+/**
+ * @brief Measure the throughput since the last step and choose the number of active workers
+ *
+ * @param tune controller
+ * @param active workers active since the last step
+ * @param backlog true if there are jobs waiting for a worker
+ * @return number of workers to keep active
+ */
+int ldb_autotune_step(ldb_autotune_t *tune, int active, bool backlog)
+{
+	ldb_autotune_t last = *tune;
+	autotune_measure(tune);
+
+	double elapsed = (tune->time.tv_sec - last.time.tv_sec) + (tune->time.tv_nsec - last.time.tv_nsec) / 1e9;
+	if (elapsed <= 0)
+		return active;
+
+	double rate = (tune->bytes - last.bytes) / elapsed;
+	uint64_t cpu = tune->cpu_total - last.cpu_total;
+	int iowait = cpu ? (tune->cpu_iowait - last.cpu_iowait) * 100 / cpu : 0;
+
+	if (iowait > LDB_AUTOTUNE_IOWAIT)
+		tune->direction = -1;
+	else if (last.rate > 0 && rate < last.rate * (100 - LDB_AUTOTUNE_TOLERANCE) / 100)
+		tune->direction = -tune->direction;
+	else if (last.rate > 0 && rate <= last.rate * (100 + LDB_AUTOTUNE_TOLERANCE) / 100)
+		tune->direction = -1;
+
+	/* More workers are useless without jobs waiting for them */
+	int next = active;
+	if (tune->direction < 0 || backlog)
+		next = ldb_autotune_clamp(tune, active + tune->direction);
+	tune->rate = rate;
+
+	log_debug("Import workers: %d active, %.1f MB/s (%.1f MB/s per worker), I/O wait %d%% -> %d\n",
+		active, rate / 1e6, rate / 1e6 / (active ? active : 1), iowait, next);
+	return next;
+}
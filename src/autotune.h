@@ -0,0 +1,26 @@
+#ifndef __AUTOTUNE_H
+#define __AUTOTUNE_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define LDB_AUTOTUNE_INTERVAL_MS 2000 // Time between two adjustments
+#define LDB_AUTOTUNE_IOWAIT 25        // % of CPU time waiting for I/O above which workers are removed
+#define LDB_AUTOTUNE_TOLERANCE 5      // Throughput changes below this % are considered noise
+
+typedef struct ldb_autotune_t
+{
+	int min;              // Bounds of the active workers
+	int max;
+	int direction;        // +1 adding workers, -1 removing them
+	double rate;          // Throughput measured at the last step, bytes per second
+	uint64_t bytes;       // Counters at the last step
+	uint64_t cpu_total;
+	uint64_t cpu_iowait;
+	struct timespec time;
+} ldb_autotune_t;
+
+void ldb_autotune_start(ldb_autotune_t *tune, int min, int max);
+int ldb_autotune_clamp(ldb_autotune_t *tune, int workers);
+int ldb_autotune_step(ldb_autotune_t *tune, int active, bool backlog);
+#endif
@@ -56,6 +56,14 @@ void radixify(unsigned char *buffer,
 		const long stack_size,
 		const long cut_off) 
 {
+	/* Short lists (most collate lists) are not worth the counting passes */
+	if (count <= SWITCH_TO_SHELL)
+	{
+		if (count > 1)
+			shellsort(buffer, count, record_size, key_size);
+		return;
+	}
+
 	long counts[char_stop+1];
 	long offsets[char_stop+1];
 	long starts[char_stop+1];
@@ -2,5 +2,7 @@
     #define __BSORT_H
 
 int bsort(char *file_path);
+void radixify(unsigned char *buffer, const long count, const long digit, const long char_start, const long char_stop,
+		const long record_size, const long key_size, const long stack_size, const long cut_off);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,354 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/bulk.c
+ *
+ * In-memory bulk load API
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file bulk.c
+ * @date 18 October 2026
+ * @brief Bulk writer: loads records held in memory without going through a CSV file.
+ *
+ * Records are appended to a buffer per sector. A sector buffer is written when the
+ * writer is committed, or earlier when the writer holds more than LDB_BULK_BUFFER bytes
+ * (the largest sector is written first). A buffer receiving its keys out of order is
+ * sorted before it is written, so records may come sorted or not; records with the
+ * same key keep their order.
+ *
+ * Nodes have the layout of the CSV importer: for variable length tables, one node per
+ * 32-bit key holding record groups (subkey, group size, then size and data of each
+ * record); for fixed length tables, nodes of records sharing the key. Duplicated
+ * records are written as they come, collating the table removes them.
+ *
+ * A writer must be used by a single thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ldb.h"
+#include "ldb_error.h"
+#include "logger.h"
+
+#define BULK_REC_SIZE_LN 2
+#define BULK_NODE_LIMIT 65536
+
+typedef struct bulk_sector_t
+{
+	uint8_t *data;     // records: key, size (16-bit) and data
+	size_t ln;
+	size_t size;
+	size_t last;       // offset of the last record added
+	bool unsorted;     // keys were added out of order
+	bool written;      // records were written to the sector
+} bulk_sector_t;
+
+struct ldb_bulk_writer_t
+{
+	struct ldb_table table;
+	int key_ln;
+	int subkey_ln;
+	size_t buffered;
+	bulk_sector_t sector[256];
+	int error;
+};
+
+/**
+ * @brief Open a bulk writer on a table
+ *
+ * @param table table, as read with ldb_read_cfg
+ * @return writer, NULL if the table is not valid
+ */
+ldb_bulk_writer_t *ldb_bulk_writer_open(struct ldb_table table)
+{
+	if (table.key_ln < LDB_KEY_LN || table.key_ln > LDB_KEY_LN + 255 || !ldb_table_exists(table.db, table.table))
+	{
+		log_info("Bulk writer: %s/%s is not a valid table\n", table.db, table.table);
+		return NULL;
+	}
+
+	ldb_bulk_writer_t *writer = calloc(1, sizeof(ldb_bulk_writer_t));
+	writer->table = table;
+	writer->key_ln = table.key_ln;
+	writer->subkey_ln = table.key_ln - LDB_KEY_LN;
+
+	/* Variable length records are written under the 32-bit key, with their subkeys in the node */
+	if (!table.rec_ln)
+		writer->table.key_ln = LDB_KEY_LN;
+	return writer;
+}
+
+/* Order of the records of a sector buffer: key, then position */
+static int bulk_record_cmp(const void *a, const void *b, void *arg)
+{
+	const uint8_t *x = *(uint8_t * const *) a, *y = *(uint8_t * const *) b;
+	int r = memcmp(x, y, *(int *) arg);
+	return r ? r : (x > y) - (x < y);
+}
+
+/**
+ * @brief Write the records of a sector with the layout of the CSV importer (variable length records)
+ */
+static int bulk_write_variable(ldb_bulk_writer_t *writer, FILE *sector, uint8_t **records, size_t n)
+{
+	uint8_t *node = malloc(BULK_NODE_LIMIT);
+	uint8_t *last_key = NULL;
+	uint32_t node_ptr = 0;
+	uint32_t group_start = 0;
+	uint16_t group_size = 0;
+	int error = LDB_ERROR_NOERROR;
+
+	for (size_t i = 0; i < n && error == LDB_ERROR_NOERROR; i++)
+	{
+		uint8_t *key = records[i];
+		uint16_t rec_ln = uint16_read(key + writer->key_ln);
+		uint8_t *data = key + writer->key_ln + BULK_REC_SIZE_LN;
+
+		bool new_key = !last_key || memcmp(key, last_key, LDB_KEY_LN);
+		bool new_subkey = new_key || memcmp(key, last_key, writer->key_ln);
+
+		/* A new 32-bit key, or a full node, writes the node */
+		if (new_key || node_ptr + 5 * LDB_PTR_LN + writer->key_ln + 2 * BULK_REC_SIZE_LN + rec_ln >= BULK_NODE_LIMIT)
+		{
+			if (group_size)
+				uint16_write(node + group_start + writer->subkey_ln, group_size);
+			if (node_ptr)
+				error = ldb_node_write(writer->table, sector, last_key, node, node_ptr, 0);
+			node_ptr = 0;
+			group_size = 0;
+			new_subkey = true;
+		}
+
+		/* A new subkey starts a record group */
+		if (new_subkey)
+		{
+			if (group_size)
+				uint16_write(node + group_start + writer->subkey_ln, group_size);
+			group_start = node_ptr;
+			memcpy(node + node_ptr, key + LDB_KEY_LN, writer->subkey_ln);
+			node_ptr += writer->subkey_ln;
+			uint16_write(node + node_ptr, 0);
+			node_ptr += BULK_REC_SIZE_LN;
+			group_size = 0;
+			last_key = key;
+		}
+
+		uint16_write(node + node_ptr, rec_ln);
+		node_ptr += BULK_REC_SIZE_LN;
+		memcpy(node + node_ptr, data, rec_ln);
+		node_ptr += rec_ln;
+		group_size += BULK_REC_SIZE_LN + rec_ln;
+	}
+
+	if (error == LDB_ERROR_NOERROR && node_ptr)
+	{
+		if (group_size)
+			uint16_write(node + group_start + writer->subkey_ln, group_size);
+		error = ldb_node_write(writer->table, sector, last_key, node, node_ptr, 0);
+	}
+	free(node);
+	return error;
+}
+
+/**
+ * @brief Write the records of a sector in nodes of records sharing the key (fixed length records)
+ */
+static int bulk_write_fixed(ldb_bulk_writer_t *writer, FILE *sector, uint8_t **records, size_t n)
+{
+	int rec_ln = writer->table.rec_ln;
+	int max_per_node = (LDB_MAX_REC_LN - rec_ln) / rec_ln;
+	uint8_t *node = malloc((size_t) max_per_node * rec_ln);
+	uint8_t *last_key = NULL;
+	int node_records = 0;
+	int error = LDB_ERROR_NOERROR;
+
+	for (size_t i = 0; i < n && error == LDB_ERROR_NOERROR; i++)
+	{
+		uint8_t *key = records[i];
+		if (node_records && (node_records == max_per_node || memcmp(key, last_key, writer->key_ln)))
+		{
+			error = ldb_node_write(writer->table, sector, last_key, node, node_records * rec_ln, node_records);
+			node_records = 0;
+		}
+		memcpy(node + node_records++ * rec_ln, key + writer->key_ln + BULK_REC_SIZE_LN, rec_ln);
+		last_key = key;
+	}
+
+	if (error == LDB_ERROR_NOERROR && node_records)
+		error = ldb_node_write(writer->table, sector, last_key, node, node_records * rec_ln, node_records);
+	free(node);
+	return error;
+}
+
+/**
+ * @brief Write the buffered records of a sector and empty its buffer
+ *
+ * @param writer writer
+ * @param s sector number
+ * @return LDB_ERROR_NOERROR on success
+ */
+static int bulk_flush_sector(ldb_bulk_writer_t *writer, int s)
+{
+	bulk_sector_t *buffer = &writer->sector[s];
+	if (!buffer->ln)
+		return LDB_ERROR_NOERROR;
+
+	/* Index the records, sorting them if needed */
+	size_t n = 0, capacity = 1024;
+	uint8_t **records = malloc(capacity * sizeof(uint8_t *));
+	if (!records)
+		return LDB_ERROR_MEM_NOMEM;
+	for (size_t ptr = 0; ptr < buffer->ln; n++)
+	{
+		if (n == capacity)
+		{
+			uint8_t **grown = realloc(records, capacity * 2 * sizeof(uint8_t *));
+			if (!grown)
+			{
+				free(records);
+				return LDB_ERROR_MEM_NOMEM;
+			}
+			records = grown;
+			capacity *= 2;
+		}
+		records[n] = buffer->data + ptr;
+		ptr += writer->key_ln + BULK_REC_SIZE_LN + uint16_read(buffer->data + ptr + writer->key_ln);
+	}
+
+	if (buffer->unsorted)
+		qsort_r(records, n, sizeof(uint8_t *), bulk_record_cmp, &writer->key_ln);
+
+	int error = LDB_ERROR_NODE_WRITE_FAILS;
+	uint8_t key[LDB_KEY_LN] = {s, 0, 0, 0};
+	FILE *sector = ldb_open(writer->table, key, "r+");
+	if (sector)
+	{
+		if (writer->table.rec_ln)
+			error = bulk_write_fixed(writer, sector, records, n);
+		else
+			error = bulk_write_variable(writer, sector, records, n);
+		ldb_close_unlock(sector);
+	}
+	free(records);
+
+	buffer->written = true;
+	writer->buffered -= buffer->ln;
+	buffer->ln = 0;
+	buffer->unsorted = false;
+	return error;
+}
+
+/**
+ * @brief Add a record
+ *
+ * @param writer writer
+ * @param key key, of the table key length
+ * @param data record
+ * @param len record length, the table record length for fixed length tables
+ * @return LDB_ERROR_NOERROR on success
+ */
+int ldb_bulk_put(ldb_bulk_writer_t *writer, uint8_t *key, uint8_t *data, uint16_t len)
+{
+	if (writer->error)
+		return writer->error;
+
+	if (writer->table.rec_ln && len != writer->table.rec_ln)
+		return LDB_ERROR_RECORD_LENGHT_INVAID;
+
+	if (len + writer->key_ln + 2 * BULK_REC_SIZE_LN + 5 * LDB_PTR_LN >= BULK_NODE_LIMIT)
+		return LDB_ERROR_DATA_RECORD_SIZE_EXCEED;
+
+	bulk_sector_t *buffer = &writer->sector[*key];
+	size_t rec_size = writer->key_ln + BULK_REC_SIZE_LN + len;
+	if (buffer->ln + rec_size > buffer->size)
+	{
+		size_t size = buffer->size ? buffer->size * 2 : 64 * 1024;
+		if (size < buffer->ln + rec_size)
+			size = buffer->ln + rec_size;
+		uint8_t *grown = realloc(buffer->data, size);
+		if (!grown)
+			return (writer->error = LDB_ERROR_MEM_NOMEM);
+		buffer->data = grown;
+		buffer->size = size;
+	}
+
+	if (buffer->ln && memcmp(key, buffer->data + buffer->last, writer->key_ln) < 0)
+		buffer->unsorted = true;
+
+	uint8_t *record = buffer->data + buffer->ln;
+	memcpy(record, key, writer->key_ln);
+	uint16_write(record + writer->key_ln, len);
+	memcpy(record + writer->key_ln + BULK_REC_SIZE_LN, data, len);
+	buffer->last = buffer->ln;
+	buffer->ln += rec_size;
+	writer->buffered += rec_size;
+
+	/* Keep the memory bounded: write the largest sector */
+	if (writer->buffered > LDB_BULK_BUFFER)
+	{
+		int largest = 0;
+		for (int s = 1; s < 256; s++)
+			if (writer->sector[s].ln > writer->sector[largest].ln)
+				largest = s;
+		writer->error = bulk_flush_sector(writer, largest);
+	}
+	return writer->error;
+}
+
+static void bulk_free(ldb_bulk_writer_t *writer)
+{
+	for (int s = 0; s < 256; s++)
+		free(writer->sector[s].data);
+	free(writer);
+}
+
+/**
+ * @brief Write the buffered records and release the writer
+ *
+ * @param writer writer
+ * @return LDB_ERROR_NOERROR if every record was written
+ */
+int ldb_bulk_commit(ldb_bulk_writer_t *writer)
+{
+	int error = writer->error;
+	for (int s = 0; s < 256 && error == LDB_ERROR_NOERROR; s++)
+		error = bulk_flush_sector(writer, s);
+
+	/* Publish the sectors written to */
+	bool published[256];
+	bool written = false;
+	for (int s = 0; s < 256; s++)
+		written |= (published[s] = writer->sector[s].written);
+	if (written)
+		ldb_table_publish(writer->table, published);
+
+	if (error != LDB_ERROR_NOERROR)
+		log_info("Bulk writer: failed to write %s/%s (%d)\n", writer->table.db, writer->table.table, error);
+	bulk_free(writer);
+	return error;
+}
+
+/**
+ * @brief Release a writer discarding the records not written yet
+ *
+ * @param writer writer
+ */
+void ldb_bulk_abort(ldb_bulk_writer_t *writer)
+{
+	bulk_free(writer);
+}
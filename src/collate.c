@@ -24,6 +24,16 @@
 #include "collate.h"
 #include "logger.h"
 #include "decode.h"
+#include "pool.h"
+#include "memory.h"
+#include "writeback.h"
+#include "bsort.h"
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define COLLATE_RADIX_STACK 5 // records moved per cycle of the in-place radix passes
+
 /**
   * @file collate.c
   * @date 19 Aug 2020 
@@ -33,28 +43,6 @@
   * @see https://github.com/scanoss/ldb/blob/master/src/collate.c
   */
 
-/**
- * @brief Compare two blocks. Compare each byte until the end of the shorter record.
- * 
- * @param a block a
- * @param b block b
- * @return 1 if a is bigger than b, -1 if b is bigger tha a, or 0 if they are equals.
- */
-int ldb_collate_cmp(const void * a, const void * b)
-{
-	const uint8_t *va = a;
-	const uint8_t *vb = b;
-
-	/* Compare each byte until the end of the shorter record */
-    for (int i = 0; i < ldb_cmp_width; i++)
-    {
-        if (va[i] > vb[i]) return 1;
-        if (va[i] < vb[i]) return -1;
-    }
-
-    return 0;
-}
-
 int ldb_collate_tuple_cmp(const void * a, const void * b)
 {
 	const tuple_t *va = *(tuple_t **) a;
@@ -121,6 +109,14 @@ int ldb_eliminate_duplicates(struct ldb_collate_data *collate, long ptr, int siz
 	return new_size;
 }
 
+/* Write a node of the list being collated, to the output sector or to the list in memory (incremental collate) */
+static int collate_node_write(struct ldb_collate_data *collate, uint8_t *key, uint8_t *data, uint32_t dataln, uint16_t records)
+{
+	if (collate->list)
+		return ldb_collate_list_node(collate->list, collate->out_table, key, data, dataln, records);
+	return ldb_node_write(collate->out_table, collate->out_sector, key, data, dataln, records);
+}
+
 /**
  * @brief import a list, collate and write to a file.
  * 
@@ -129,10 +125,7 @@ int ldb_eliminate_duplicates(struct ldb_collate_data *collate, long ptr, int siz
  */
 bool ldb_import_list_fixed_records(struct ldb_collate_data *collate)
 {
-	FILE * new_sector = collate->out_sector;
 	int max_per_node = (LDB_MAX_REC_LN - collate->rec_width) / collate->rec_width;
-
-	struct ldb_table out_table = collate->out_table;
 	long data_ptr = 0;
 
 	/* Read data in "max_per_node" chunks */
@@ -147,7 +140,7 @@ bool ldb_import_list_fixed_records(struct ldb_collate_data *collate)
 		/* Write node */
 		int new_block_size = ldb_eliminate_duplicates(collate, data_ptr, block_size);
 		uint16_t block_records = new_block_size / collate->table_rec_ln;
-		int error = ldb_node_write(out_table, new_sector, collate->last_key, collate->tmp_data, new_block_size, block_records);
+		int error = collate_node_write(collate, collate->last_key, collate->tmp_data, new_block_size, block_records);
 		//abort in case of error
 		if (error < 0)
 			return false;
@@ -164,7 +157,6 @@ bool ldb_import_list_fixed_records(struct ldb_collate_data *collate)
  */
 bool ldb_import_list_variable_records(struct ldb_collate_data *collate)
 {
-	FILE * new_sector = collate->out_sector;
 	uint8_t *buffer = malloc(LDB_MAX_NODE_LN);
 	uint16_t buffer_ptr = 0;
 	uint8_t *rec_key;
@@ -175,37 +167,24 @@ bool ldb_import_list_variable_records(struct ldb_collate_data *collate)
 	bool new_subkey = true;
 	struct ldb_table out_table = collate->out_table;
 
-	/* Last record checksum to skip duplicates */
-	uint8_t *last_data = calloc(collate->rec_width, 1);
-	uint16_t last_rec_size = 0;
-
-	if (!buffer || !last_key || !last_data)
+	if (!buffer || !last_key)
 	{
 		free(buffer);
 		free(last_key);
-		free(last_data);
 		fprintf(stderr, "Memory allocation failed in ldb_import_list_variable_records\n");
 		return false;
 	}
 
-	for (long data_ptr = 0; data_ptr < collate->data_ptr; data_ptr += collate->rec_width)
+	/* Duplicated records were dropped when they were added */
+	for (long i = 0; i < collate->entries_number; i++)
 	{
-		rec_key = collate->data + data_ptr;
+		rec_key = collate->data + collate->entries[i].offset;
 		uint8_t *data = rec_key + out_table.key_ln + subkey_ln;
-		uint16_t rec_size;
-
-		if (collate->table_rec_ln) rec_size = collate->table_rec_ln;
-		else rec_size = uint32_read(rec_key + collate->rec_width - LDB_KEY_LN);
+		uint16_t rec_size = collate->entries[i].size;
 
-		/* Check if key is different than the last one */
-		new_subkey = (memcmp(rec_key+LDB_KEY_LN, last_key+LDB_KEY_LN, subkey_ln) != 0);
-
-		/* If record is duplicated (same subkey and same data), skip it */
-		if (!new_subkey && rec_size == last_rec_size && !memcmp(data, last_data, rec_size)) continue;
-
-		/* Update last record */
-		memcpy(last_data, data, rec_size);
-		last_rec_size = rec_size;
+		/* Check if key is different than the last one. The first record always opens a group,
+		   even if its subkey is zero (last_key starts zeroed) */
+		new_subkey = !i || (memcmp(rec_key+LDB_KEY_LN, last_key+LDB_KEY_LN, subkey_ln) != 0);
 
 		uint32_t projected_size = buffer_ptr + rec_size  + collate->table_key_ln + (2 * LDB_PTR_LN) + out_table.ts_ln;
 		/* If node size is exceeded, initialize buffer */
@@ -215,7 +194,7 @@ bool ldb_import_list_variable_records(struct ldb_collate_data *collate)
 			if (rec_group_size > 0) uint16_write(buffer + rec_group_start + subkey_ln, rec_group_size);
 			if (buffer_ptr) 
 			{
-				int error =ldb_node_write(out_table, new_sector, last_key, buffer, buffer_ptr, 0);
+				int error = collate_node_write(collate, last_key, buffer, buffer_ptr, 0);
 				//abort in case of error
 				if (error < 0)
 					return false;
@@ -263,7 +242,7 @@ bool ldb_import_list_variable_records(struct ldb_collate_data *collate)
 	if (rec_group_size > 0) uint16_write(buffer + rec_group_start + subkey_ln, rec_group_size);
 	if (buffer_ptr) 
 	{
-		int error= ldb_node_write(out_table, new_sector, last_key, buffer, buffer_ptr, 0);
+		int error = collate_node_write(collate, last_key, buffer, buffer_ptr, 0);
 		//abort in case of error
 		if (error < 0)
 			return false;
@@ -271,7 +250,6 @@ bool ldb_import_list_variable_records(struct ldb_collate_data *collate)
 
 	free(buffer);
 	free(last_key);
-	free(last_data);
 
 	return true;
 }
@@ -328,8 +306,49 @@ bool ldb_collate_add_fixed_records(struct ldb_collate_data *collate, uint8_t *ke
 	return true;
 }
 
+/* Hash of a variable length record (subkey and data) */
+static uint64_t collate_record_hash(const uint8_t *data, size_t ln)
+{
+	uint64_t h = 0x9E3779B97F4A7C15ULL ^ ln;
+	size_t i = 0;
+	for (; i + 8 <= ln; i += 8)
+	{
+		uint64_t w;
+		memcpy(&w, data + i, 8);
+		h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 32;
+	}
+	uint64_t w = 0;
+	memcpy(&w, data + i, ln - i);
+	h = (h ^ w) * 0xC4CEB9FE1A85EC53ULL;
+	return h ^ (h >> 29);
+}
+
+/* Grow the arena to hold bytes more */
+static bool collate_arena_grow(struct ldb_collate_data *collate, size_t bytes)
+{
+	size_t size = collate->data_size;
+	while (collate->data_ptr + bytes > size)
+		size *= 2;
+
+	uint8_t *data = realloc(collate->data, size);
+	if (!data)
+		return false;
+
+	/* Growth beyond the initial arena is taken from the memory budget, without waiting */
+	if (ldb_memory_reserve(size - collate->data_size, false))
+		collate->data_reserved += size - collate->data_size;
+	else
+		log_debug("Collate arena of sector %02x grows to %lu MB over the memory budget\n", collate->last_key[0], size >> 20);
+
+	collate->data = data;
+	collate->data_size = size;
+	return true;
+}
+
 /**
- * @brief Add variable records to a list
+ * @brief Add variable records to a list. Records are appended to the arena without padding
+ * and indexed by an entry; a record already in the list (same subkey and data) is dropped.
  * 
  * @param collate pointer to collate data structure 
  * @param key block key
@@ -344,22 +363,38 @@ bool ldb_collate_add_variable_record(struct ldb_collate_data *collate, uint8_t *
 	/* Add record exceeds limit, skip it */
 	if (size > collate->max_rec_ln) return false;
 
-	/* Copy main key */
-	memcpy(collate->data + collate->data_ptr, key, LDB_KEY_LN);
-	collate->data_ptr += LDB_KEY_LN;
-
-	/* Copy subkey */
-	memcpy(collate->data + collate->data_ptr, subkey, subkey_ln);
-	collate->data_ptr += subkey_ln;
+	size_t rec_ln = LDB_KEY_LN + subkey_ln + size;
+	if (collate->data_ptr + rec_ln > collate->data_size && !collate_arena_grow(collate, rec_ln))
+		return false;
 
-	/* Copy record */
-	memcpy(collate->data + collate->data_ptr, data, size);
-	collate->data_ptr += collate->max_rec_ln;
+	/* Copy main key, subkey and record */
+	uint8_t *record = collate->data + collate->data_ptr;
+	memcpy(record, key, LDB_KEY_LN);
+	memcpy(record + LDB_KEY_LN, subkey, subkey_ln);
+	memcpy(record + LDB_KEY_LN + subkey_ln, data, size);
+
+	/* Skip duplicates */
+	uint64_t hash = collate_record_hash(record + LDB_KEY_LN, subkey_ln + size);
+	uint64_t generation = (uint64_t) collate->hash_generation << 32;
+	uint32_t slot = hash & (LDB_COLLATE_HASH_SLOTS - 1);
+	while ((collate->hash[slot] >> 32) == collate->hash_generation)
+	{
+		ldb_collate_entry_t *entry = &collate->entries[(uint32_t) collate->hash[slot] - 1];
+		if (entry->hash == hash && entry->size == size &&
+			!memcmp(collate->data + entry->offset + LDB_KEY_LN, record + LDB_KEY_LN, subkey_ln + size))
+			return true;
+		slot = (slot + 1) & (LDB_COLLATE_HASH_SLOTS - 1);
+	}
 
-	/* Copy record length */
-	uint32_write(collate->data + collate->data_ptr, size);
-	collate->data_ptr += 4;
+	ldb_collate_entry_t *entry = &collate->entries[collate->entries_number];
+	for (int i = 0; i < 8; i++)
+		entry->prefix[i] = i < subkey_ln + size ? record[LDB_KEY_LN + i] : 0;
+	entry->hash = hash;
+	entry->offset = collate->data_ptr;
+	entry->size = size;
+	collate->hash[slot] = generation | ++collate->entries_number;
 
+	collate->data_ptr += rec_ln;
 	collate->rec_count++;
 	return true;
 }
@@ -384,8 +419,46 @@ bool ldb_collate_add_record(struct ldb_collate_data *collate, uint8_t *key, uint
 	return ldb_collate_add_variable_record(collate, key, subkey, subkey_ln, data, size);
 }
 
+/* Order of variable length records: subkey and data, then size */
+static int collate_entry_cmp(const void *a, const void *b, void *arg)
+{
+	const ldb_collate_entry_t *x = a, *y = b;
+	int r = memcmp(x->prefix, y->prefix, sizeof(x->prefix));
+	if (r)
+		return r;
+
+	struct ldb_collate_data *collate = arg;
+	int subkey_ln = collate->table_key_ln - LDB_KEY_LN;
+	uint32_t ln = (x->size < y->size ? x->size : y->size) + subkey_ln;
+	r = memcmp(collate->data + x->offset + LDB_KEY_LN, collate->data + y->offset + LDB_KEY_LN, ln);
+	if (r)
+		return r;
+	return (x->size > y->size) - (x->size < y->size);
+}
+
+/* Bytes shared by the keys of all the records: a radix pass over them would not split the
+   list, so sorting starts after them (records of one file share their md5, those of one
+   key their subkey) */
+static long collate_common_prefix(uint8_t *records, long number, long record_size, long key_size)
+{
+	long common = key_size;
+	for (long i = 1; i < number && common; i++)
+	{
+		uint8_t *record = records + i * record_size;
+		for (long b = 0; b < common; b++)
+			if (record[b] != records[b])
+			{
+				common = b;
+				break;
+			}
+	}
+	return common;
+}
+
 /**
- * @brief Sort a list
+ * @brief Sort a list. Fixed length records are radix sorted in place; variable length
+ * records have their entries radix sorted by prefix, then the entries sharing a prefix
+ * are ordered comparing the records.
  * 
  * @param collate point to collate data structure
  */
@@ -393,211 +466,224 @@ void ldb_collate_sort(struct ldb_collate_data *collate)
 {
 		if (collate->merge) return;
 
-		/* Sort records */
-		size_t items = 0;
-		size_t size = 0;
 		int subkey_ln = collate->table_key_ln - LDB_KEY_LN;
 
 		if (collate->table_rec_ln)
 		{
-			items = collate->data_ptr / (collate->table_rec_ln + subkey_ln);
-			size = collate->table_rec_ln + subkey_ln;
+			long size = collate->table_rec_ln + subkey_ln;
+			long number = collate->data_ptr / size;
+			long common = collate_common_prefix(collate->data, number, size, size);
+			if (common < size)
+				radixify(collate->data, number, common, 0, 255, size, size, COLLATE_RADIX_STACK, size - 1);
+			return;
 		}
 
-		else if (collate->rec_width)
-		{
-			items = collate->data_ptr / collate->rec_width;
-			size = collate->rec_width;
-		}
-		else
+		ldb_collate_entry_t *entries = collate->entries;
+		long size = sizeof(entries[0].prefix);
+		long common = collate_common_prefix((uint8_t *) entries, collate->entries_number, sizeof(ldb_collate_entry_t), size);
+		if (common < size)
+			radixify((unsigned char *) entries, collate->entries_number, common, 0, 255, sizeof(ldb_collate_entry_t), size, COLLATE_RADIX_STACK, size - 1);
+
+		for (long i = 0, j; i < collate->entries_number; i = j)
 		{
-			fprintf(stderr,"Warning collate rec_width undefined\n");
-			return;
+			for (j = i + 1; j < collate->entries_number && !memcmp(entries[i].prefix, entries[j].prefix, size); j++);
+			if (j - i > 1)
+				qsort_r(entries + i, j - i, sizeof(ldb_collate_entry_t), collate_entry_cmp, collate);
 		}
-		qsort(collate->data, items, size, ldb_collate_cmp);
 }
 
-static bool data_compare(char * a, char * b)
+/**
+ * @brief Compare a CSV record with the data of a delete tuple, field by field from field "first".
+ * Wildcard fields match any value. A pattern or record exhausted before the other matches.
+ *
+ * @param tuple delete tuple
+ * @param first first field of the tuple data to compare
+ * @param b record (not terminated)
+ * @param b_ln record length
+ * @return true if the record matches
+ */
+static bool delete_pattern_match(tuple_t *tuple, int first, const char *b, size_t b_ln)
 {
-	char buffer_a[LDB_MAX_REC_LN] = "\0";
-	char buffer_b[LDB_MAX_REC_LN] = "\0";
-	
-	if (!a || !b)
-		return false;
+	if (first >= tuple->fields_number)
+		return true;
 
-	//printf("a: %s, b: %s\n",a ,b);
-	while (*a && *b)
-	{
-		bool skip_field = false;
-		while (*a && *a != ',')
-		{	
-			buffer_a[strlen(buffer_a)] = *a;
-			a++;
-		}
+	const char *data = tuple->data;
+	size_t a = tuple->fields[first].offset;
+	size_t a_ln = tuple->fields[tuple->fields_number - 1].offset + tuple->fields[tuple->fields_number - 1].ln;
+	size_t bi = 0;
 
-		if (strchr(buffer_a, '*') && strlen(buffer_a) < 4)
-		{
-			skip_field = true;
-			log_debug("skipping");
-		}
-		
-		while (*b && *b != ',')
-		{
-			buffer_b[strlen(buffer_b)] = *b;
-			b++;
-		}
+	for (int f = first; a < a_ln && bi < b_ln; f++)
+	{
+		tuple_field_t *field = &tuple->fields[f];
+		const char *comma = memchr(b + bi, ',', b_ln - bi);
+		size_t field_ln = comma ? (size_t) (comma - (b + bi)) : b_ln - bi;
 
-		int r = strcmp(buffer_a, buffer_b);
-		log_debug("<<<comparing: %s / %s : %d >>\n", buffer_a, buffer_b, r);
-		if (!skip_field && r)
+		if (!field->wildcard && (field->ln != field_ln || memcmp(data + a, b + bi, field_ln)))
 			return false;
-		if (!*a || !*b)
-			return (*a == *b);
+
+		a += field->ln;
+		bi += field_ln;
+		if (a == a_ln || bi == b_ln)
+			return a == a_ln && bi == b_ln;
 		a++;
-		b++;
-		memset(buffer_a, 0, LDB_MAX_REC_LN);
-		memset(buffer_b, 0, LDB_MAX_REC_LN);
+		bi++;
 	}
-
 	return true;
 }
 
+/* Main key as a number, for the delete index */
+static inline uint32_t delete_main_key(const uint8_t *key)
+{
+	return (uint32_t) key[0] << 24 | key[1] << 16 | key[2] << 8 | key[3];
+}
+
+static inline uint32_t delete_index_slot(job_delete_tuples_t *job, uint32_t key)
+{
+	return (key * 2654435761u) & (job->index_size - 1);
+}
+
+/* Find the tuples of a main key */
+static delete_index_t *delete_index_find(job_delete_tuples_t *job, const uint8_t *key)
+{
+	if (!job->index)
+		return NULL;
+	uint32_t main_key = delete_main_key(key);
+	for (uint32_t slot = delete_index_slot(job, main_key); job->index[slot].number; slot = (slot + 1) & (job->index_size - 1))
+		if (job->index[slot].key == main_key)
+			return &job->index[slot];
+	return NULL;
+}
+
 /**
- * @brief Search for key+subkey in the del_keys blob. Search is lineal on a sorted array, with the aid of del_map
- * to speed up the search.
- * 
- * @param collate pointer to collate data structure 
+ * @brief Check if a main key has delete tuples
+ *
+ * @param job delete tuples, indexed
+ * @param key key (the main key is used)
+ * @return true if some tuple deletes records of the key
+ */
+bool ldb_delete_key_listed(job_delete_tuples_t *job, const uint8_t *key)
+{
+	return delete_index_find(job, key) != NULL;
+}
+
+/**
+ * @brief Match a record with the delete tuples of its key, found through the delete index.
+ * Fixed records are matched one by one: the records of the node matching a tuple with data
+ * are zeroed and counted in "deleted".
+ *
+ * @param job delete tuples, indexed
+ * @param table table of the record
  * @param key block key
  * @param subkey block subkey
  * @param subkey_ln block subkey lenght
- * @return true
+ * @param data record (node for fixed records)
+ * @param size data size
+ * @param deleted [out] fixed records zeroed, added to
+ * @return true if the record (node for fixed records) is deleted
  */
-bool key_in_delete_list(struct ldb_collate_data *collate, uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t * data, uint32_t size)
+bool ldb_delete_match(job_delete_tuples_t *job, struct ldb_table table, uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t *data, uint32_t size, long *deleted)
 {
-	/* Position pointer to start of second byte in the sorted del_key array */
-	for (int i = 0; i < collate->del_tuples->tuples_number; i++)
-	{
-		/*The keys are sorted, if I'm in another sector a must out*/
-		if (collate->del_tuples->tuples[i]->key[0] > key[0])
-			return false;
-		else if (collate->del_tuples->tuples[i]->key[0] != key[0])
-			continue;
-
-		/* First byte is always the same, second too inside this loop. Compare bytes  2, 3 and 4 */
-		int mainkey = memcmp(collate->del_tuples->tuples[i]->key + 1, key + 1, LDB_KEY_LN -1);
-		if (mainkey != 0)
-			continue; //return false;
+	delete_index_t *slot = delete_index_find(job, key);
+	if (!slot)
+		return false;
 
-		/*For fixed records there is no subkey, so key hex will be empty*/
-		char key_hex1[collate->in_table.key_ln * 2 + 1];
-		char key_hex2[collate->in_table.key_ln * 2 + 1];
-		ldb_bin_to_hex(subkey, subkey_ln, key_hex1);
-		ldb_bin_to_hex(&collate->del_tuples->tuples[i]->key[LDB_KEY_LN], subkey_ln, key_hex2);
+	for (int i = slot->first; i < slot->first + slot->number; i++)
+	{
+		tuple_t *tuple = job->tuples[i];
 
 		/*Match the rest of the key*/
-		if (!memcmp(subkey, &collate->del_tuples->tuples[i]->key[LDB_KEY_LN], subkey_ln))
+		if (memcmp(subkey, &tuple->key[LDB_KEY_LN], subkey_ln))
+			continue;
+
+		bool result = true;
+		if (tuple->data)
 		{
-			bool result = true;
-			if (collate->del_tuples->tuples[i]->data)
+			/* Compare secondary keys, the first one matching is enough */
+			int field = 0;
+			for (int k = 0; k < tuple->sec_keys_number; k++)
 			{
-				int char_to_skip = 0;
-				char * data_key_hex = collate->del_tuples->tuples[i]->data;
-				//compare secudary keys
-				for (int i =0; i < collate->del_tuples->keys_number-1; i++)
-				{
-					data_key_hex += char_to_skip;
-					char * key_end = strchr(data_key_hex, ',');
-					if (!key_end)
-						break;
-					
-					int len = key_end - data_key_hex;
-					char_to_skip += len + 1;
-					
-					/*skip key from comparation*/
-					if (len < 4 && strchr(data_key_hex,'*'))
-					{
-						continue;
-					}
-					uint8_t sec_key[collate->del_tuples->key_ln];
-					ldb_hex_to_bin(data_key_hex, collate->del_tuples->key_ln * 2, sec_key);
-
-					ldb_bin_to_hex(sec_key, collate->del_tuples->key_ln, key_hex1);
-					ldb_bin_to_hex(data + collate->del_tuples->key_ln * i, collate->del_tuples->key_ln, key_hex2);
-					result = !memcmp(data + collate->del_tuples->key_ln * i, sec_key, collate->del_tuples->key_ln);
-					if (result)
-						break;
-				}
-
+				field = k + 1;
+				if (tuple->sec_keys[k].wildcard)
+					continue;
+				result = !memcmp(data + job->key_ln * k, tuple->sec_keys[k].key, job->key_ln);
 				if (result)
+					break;
+			}
+
+			if (result)
+			{
+				/* Tuple data after the secondary keys compared */
+				char *rest = tuple->data + (field < tuple->fields_number ? tuple->fields[field].offset : strlen(tuple->data));
+				uint32_t data_offset = (job->keys_number - 1) * job->key_ln;
+				if (table.definitions & LDB_TABLE_DEFINITION_ENCRYPTED)
 				{
-					log_debug("Match found: %s / %s\n", key_hex1, key_hex2);
-					if (collate->in_table.definitions & LDB_TABLE_DEFINITION_ENCRYPTED)
+					//if we are ignoring the data the record must be removed.
+					if (strchr(rest, '*'))
+						result = true;
+					else
 					{
-						//if we are ignoring the data the record must be removed.
-						if (strchr(collate->del_tuples->tuples[i]->data + char_to_skip, '*'))
-							result = true;
-						else
+						unsigned char tuple_bin[MAX_CSV_LINE_LEN];
+						if(!decode && !ldb_decoder_lib_load())
+							return false;
+
+						int r_size = decode(DECODE_BASE64, NULL, NULL, rest, strlen(rest), tuple_bin);
+						if (r_size > 0) 
 						{
-							unsigned char tuple_bin[MAX_CSV_LINE_LEN];
-							if(!decode && !ldb_decoder_lib_load())
-								return false;
-
-							int r_size = decode(DECODE_BASE64, NULL, NULL, collate->del_tuples->tuples[i]->data + char_to_skip, strlen(collate->del_tuples->tuples[i]->data) - char_to_skip, tuple_bin);
-							if (r_size > 0) 
-							{
-								result = !memcmp(tuple_bin, data + (collate->del_tuples->keys_number - 1) * collate->del_tuples->key_ln, r_size);
-								log_info("Var record %s was found.\n", collate->del_tuples->tuples[i]->data);
-							}
-							else
-								result = false;
+							result = !memcmp(tuple_bin, data + data_offset, r_size);
+							log_debug("Var record %s was found.\n", tuple->data);
 						}
+						else
+							result = false;
 					}
-					else
-					{
-						if (collate->in_table.rec_ln == 0) //variable record, string comparation
-						{ 
-							char * aux = strndup((char*)data + (collate->del_tuples->keys_number - 1) * collate->del_tuples->key_ln, 
-							size - (collate->del_tuples->keys_number - 1) * collate->del_tuples->key_ln);
-							result = data_compare(collate->del_tuples->tuples[i]->data + char_to_skip, aux);
-							free(aux);
-						}
-						else //fixed record, hex comparation
-						{
-							int data_ln = strlen(collate->del_tuples->tuples[i]->data);
-							if (data_ln < LDB_KEY_LN * 2)
-								continue;
-
-							uint8_t * aux = calloc(1, collate->in_table.rec_ln);
-							ldb_hex_to_bin(collate->del_tuples->tuples[i]->data, data_ln, aux);
-							result = false; //we just want to remove a record inside data
-							for(int ptr = 0; ptr < size; ptr += collate->in_table.rec_ln)
-							{ 
-								char test[33];
-								ldb_bin_to_hex(data + ptr, 16, test);
-								if (memcmp(aux, data + ptr, data_ln/2) == 0)
-								{					
-									log_info("Fixed record %s was found at %d\n", collate->del_tuples->tuples[i]->data, ptr);
-									memset(data + ptr, 0, collate->in_table.rec_ln);
-									collate->del_count++;
-								}
-							}
-							free(aux);
+				}
+				else if (table.rec_ln == 0) //variable record, string comparation
+				{
+					const char *record = (char *) data + data_offset;
+					size_t record_ln = size > data_offset ? strnlen(record, size - data_offset) : 0;
+					result = delete_pattern_match(tuple, field, record, record_ln);
+				}
+				else //fixed record, hex comparation
+				{
+					if (!tuple->bin)
+						continue;
+
+					result = false; //we just want to remove a record inside data
+					for(int ptr = 0; ptr < size; ptr += table.rec_ln)
+					{ 
+						if (memcmp(tuple->bin, data + ptr, tuple->bin_ln) == 0)
+						{					
+							log_debug("Fixed record %s was found at %d\n", tuple->data, ptr);
+							memset(data + ptr, 0, table.rec_ln);
+							(*deleted)++;
 						}
 					}
 				}
 			}
-			/* Increment del_count and return true */
-			if (result)
-			{
-				collate->del_count++;
-				return true;
-			}
 		}
+		if (result)
+			return true;
 	}
 
 	return false;
 }
 
+/**
+ * @brief Search for key+subkey among the delete tuples of the collate (DELETE command)
+ * 
+ * @param collate pointer to collate data structure 
+ * @param key block key
+ * @param subkey block subkey
+ * @param subkey_ln block subkey lenght
+ * @return true if the record is deleted
+ */
+bool key_in_delete_list(struct ldb_collate_data *collate, uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t * data, uint32_t size)
+{
+	long deleted = 0;
+	bool result = ldb_delete_match(collate->del_tuples, collate->in_table, key, subkey, subkey_ln, data, size, &deleted);
+	collate->del_count += deleted + result;
+	return result;
+}
+
 /**
  * @brief LDB collate handler. Will be called for ldb_fetch_recordset in each iteration.
  * Execute the collate job, adding the new registers or deleting the keys from the delete list.
@@ -628,6 +714,8 @@ bool ldb_collate_handler(uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t *
 
 		/* Reset data pointer */
 		collate->data_ptr = 0;
+		collate->entries_number = 0;
+		collate->hash_generation++;
 		collate->key_rec_count = 0;
 	}
 	else
@@ -677,12 +765,113 @@ bool ldb_collate_handler(uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t *
 	return false;
 }
 
-int ldb_collate_load_tuples_to_delete(job_delete_tuples_t * job, char * buffer, char * d, struct ldb_table table)
+/* Split the data of a delete tuple into CSV fields and decode its secondary keys and fixed record */
+static void delete_tuple_compile(job_delete_tuples_t *job, tuple_t *tuple, struct ldb_table table)
+{
+	char *data = tuple->data;
+	if (!data)
+		return;
+
+	size_t data_ln = strlen(data);
+	tuple->fields = malloc((data_ln + 1) * sizeof(tuple_field_t));
+	for (char *field = data; ; field++)
+	{
+		char *comma = strchr(field, ',');
+		tuple_field_t *f = &tuple->fields[tuple->fields_number++];
+		f->offset = field - data;
+		f->ln = comma ? comma - field : strlen(field);
+		f->wildcard = f->ln < 4 && memchr(field, '*', f->ln);
+		if (!comma)
+			break;
+		field = comma;
+	}
+
+	/* Secondary keys, a short key with a '*' in the rest of the data is skipped */
+	tuple->sec_keys_number = job->keys_number - 1 < tuple->fields_number - 1 ? job->keys_number - 1 : tuple->fields_number - 1;
+	if (tuple->sec_keys_number > 0)
+	{
+		tuple->sec_keys = calloc(tuple->sec_keys_number, sizeof(tuple_key_t));
+		for (int k = 0; k < tuple->sec_keys_number; k++)
+		{
+			char *hex = data + tuple->fields[k].offset;
+			char padded[MD5_LEN * 2 + 1] = {0};
+			strncpy(padded, hex, job->key_ln * 2);
+			for (int c = strlen(padded); c < job->key_ln * 2; c++)
+				padded[c] = '0';
+			tuple->sec_keys[k].wildcard = tuple->fields[k].ln < 4 && strchr(hex, '*');
+			ldb_hex_to_bin(padded, job->key_ln * 2, tuple->sec_keys[k].key);
+		}
+	}
+	else
+		tuple->sec_keys_number = 0;
+
+	/* Fixed records are matched by their first bytes */
+	if (table.rec_ln && data_ln >= LDB_KEY_LN * 2)
+	{
+		tuple->bin_ln = data_ln / 2;
+		tuple->bin = calloc(tuple->bin_ln > table.rec_ln ? tuple->bin_ln : table.rec_ln, 1);
+		ldb_hex_to_bin(data, data_ln, tuple->bin);
+	}
+}
+
+/* Index the sorted tuples by main key */
+static void delete_index_build(job_delete_tuples_t *job)
+{
+	job->index_size = 16;
+	while (job->index_size < 2 * (uint32_t) job->tuples_number)
+		job->index_size *= 2;
+	job->index = calloc(job->index_size, sizeof(delete_index_t));
+
+	for (int i = 0, j; i < job->tuples_number; i = j)
+	{
+		for (j = i + 1; j < job->tuples_number && !memcmp(job->tuples[i]->key, job->tuples[j]->key, LDB_KEY_LN); j++);
+
+		uint32_t main_key = delete_main_key(job->tuples[i]->key);
+		uint32_t slot = delete_index_slot(job, main_key);
+		while (job->index[slot].number)
+			slot = (slot + 1) & (job->index_size - 1);
+		job->index[slot] = (delete_index_t) {.key = main_key, .first = i, .number = j - i};
+	}
+}
+
+/**
+ * @brief Free the tuples of a delete job
+ *
+ * @param job delete job
+ */
+void ldb_collate_delete_free(job_delete_tuples_t *job)
+{
+	for (int i = 0; i < job->tuples_number; i++)
+	{
+		free(job->tuples[i]->data);
+		free(job->tuples[i]->fields);
+		free(job->tuples[i]->sec_keys);
+		free(job->tuples[i]->bin);
+		free(job->tuples[i]);
+	}
+	free(job->tuples);
+	free(job->index);
+	job->tuples = NULL;
+	job->index = NULL;
+	job->tuples_number = 0;
+}
+
+/**
+ * @brief Load delete tuples: one per line of "buffer" (hex key and optional CSV data), sorted and indexed by main key
+ *
+ * @param job [out] delete job
+ * @param buffer lines, modified
+ * @param d line delimiters
+ * @param table table of the tuples
+ * @return number of tuples
+ */
+int ldb_delete_tuples_load(job_delete_tuples_t * job, char * buffer, char * d, struct ldb_table table)
 {
 	char *delimiter = d;
 	tuple_t **tuples = NULL;
 	int tuples_index = 0;
-    char * line = strtok(buffer, delimiter);
+	char *save = NULL;
+    char * line = strtok_r(buffer, delimiter, &save);
 	int key_len = table.key_ln;
 
     while (line != NULL) 
@@ -701,14 +890,25 @@ int ldb_collate_load_tuples_to_delete(job_delete_tuples_t * job, char * buffer,
 			}
 			tuples_index++;
 		}
-        line = strtok(NULL, delimiter);
+        line = strtok_r(NULL, delimiter, &save);
     }
 	job->tuples = tuples;
 	job->tuples_number = tuples_index;
 	job->keys_number = table.keys;
 	job->key_ln = key_len;
 	qsort(job->tuples, tuples_index, sizeof(tuple_t *), ldb_collate_tuple_cmp);
-	
+
+	for (int i = 0; i < job->tuples_number; i++)
+		delete_tuple_compile(job, job->tuples[i], table);
+	delete_index_build(job);
+	return tuples_index;
+}
+
+int ldb_collate_load_tuples_to_delete(job_delete_tuples_t * job, char * buffer, char * d, struct ldb_table table)
+{
+	int tuples_index = ldb_delete_tuples_load(job, buffer, d, table);
+	int key_len = table.key_ln;
+
 	log_info("Keys to delete %d:\n", tuples_index);
 	
 	for (int i = 0; i < job->tuples_number; i++)
@@ -725,7 +925,66 @@ int ldb_collate_load_tuples_to_delete(job_delete_tuples_t * job, char * buffer,
 	return tuples_index;
 }
 
-bool ldb_collate_init(struct ldb_collate_data * collate, struct ldb_table table, struct ldb_table out_table, int max_rec_ln, bool merge, uint8_t sector)
+/**
+ * @brief Bytes allocated by ldb_collate_init. For variable length records this is the initial
+ * arena, its growth is reserved when it happens.
+ *
+ * @param table LDB table to be collated
+ * @param max_rec_ln Maximum record lenght
+ * @return buffers size
+ */
+size_t ldb_collate_buffer_size(struct ldb_table table, int max_rec_ln)
+{
+	if (!table.rec_ln)
+		return LDB_COLLATE_ARENA + (LDB_MAX_RECORDS + 1) * sizeof(ldb_collate_entry_t) + LDB_COLLATE_HASH_SLOTS * sizeof(uint64_t);
+	return 2 * (size_t) LDB_MAX_RECORDS * (table.rec_ln + 10);
+}
+
+/* Load a sector in RAM if it fits in the memory budget, "quiet" when it may be loaded again */
+static ldb_sector_t collate_load_sector(struct ldb_table table, uint8_t k0, bool quiet)
+{
+	ldb_sector_t sector = {.data = NULL, .size = 0, .id = k0};
+
+	char *path = ldb_sector_path(table, &k0, "r");
+	if (!path)
+		return sector;
+	uint64_t size = ldb_file_size(path);
+	free(path);
+
+	if (!size)
+		return sector;
+
+	if (ldb_memory_reserve(size, false))
+	{
+		sector = ldb_load_sector_v2(table, &k0);
+		if (sector.data)
+			return sector;
+		ldb_memory_release(size);
+	}
+	else if (!quiet)
+		log_info("Sector %02x (%lu MB) does not fit in the memory budget. Using disk mode.\n", k0, size >> 20);
+
+	sector.data = NULL;
+	sector.size = size;
+	return sector;
+}
+
+/**
+ * @brief Load a sector to be collated. The sector is read into RAM if its size fits in the
+ * memory budget, otherwise it is left on disk (data == NULL) and collated out of core.
+ * The reservation is returned by ldb_collate_sector.
+ *
+ * @param table LDB table
+ * @param k0 sector number
+ * @return sector, size is zero if the sector does not exist
+ */
+ldb_sector_t ldb_collate_load_sector(struct ldb_table table, uint8_t k0)
+{
+	return collate_load_sector(table, k0, false);
+}
+
+/* Initialize the collate data and allocate its buffers */
+static bool collate_buffers_init(struct ldb_collate_data * collate, struct ldb_table table, struct ldb_table out_table, int max_rec_ln, bool merge)
 {
 	collate->data_ptr = 0;
 	collate->table_key_ln = table.key_ln;
@@ -741,6 +1000,7 @@ bool ldb_collate_init(struct ldb_collate_data * collate, struct ldb_table table,
 	collate->merge = merge;
 	collate->handler = NULL;
 	collate->del_tuples = NULL;
+	collate->list = NULL;
 
 	if (collate->table_rec_ln)
 	{
@@ -751,32 +1011,81 @@ bool ldb_collate_init(struct ldb_collate_data * collate, struct ldb_table table,
 		collate->rec_width = table.key_ln + max_rec_ln + 4;
 	}
 
-	/* Reserve space for collate data */
-	collate->data = (char *)calloc(LDB_MAX_RECORDS * (collate->rec_width+10), 1);
-
-	if (!collate->data)
-		return false;
+	collate->out_sector = NULL;
+	collate->data = NULL;
+	collate->tmp_data = NULL;
+	collate->entries = NULL;
+	collate->hash = NULL;
+	collate->entries_number = 0;
+	collate->hash_generation = 1;
+	collate->data_size = 0;
+	collate->data_reserved = 0;
 
-	collate->tmp_data = (char *)calloc(LDB_MAX_RECORDS * (collate->rec_width+10), 1);
+	if (collate->table_rec_ln)
+	{
+		/* Reserve space for collate data, reusing the worker buffers when running in the import pool */
+		collate->data = ldb_pool_buffer(LDB_POOL_BUFFER_COLLATE, LDB_MAX_RECORDS * (collate->rec_width+10));
+		collate->tmp_data = ldb_pool_buffer(LDB_POOL_BUFFER_COLLATE_TMP, LDB_MAX_RECORDS * (collate->rec_width+10));
+	}
+	else
+	{
+		/* Variable records go to a growable arena, indexed by entries */
+		collate->data_size = LDB_COLLATE_ARENA;
+		collate->data = malloc(collate->data_size);
+		collate->entries = ldb_pool_buffer(LDB_POOL_BUFFER_COLLATE_TMP, (LDB_MAX_RECORDS + 1) * sizeof(ldb_collate_entry_t));
+		collate->hash = calloc(LDB_COLLATE_HASH_SLOTS, sizeof(uint64_t));
+	}
 
-	if (!collate->tmp_data)
+	if (!collate->data || (collate->table_rec_ln ? !collate->tmp_data : !collate->entries || !collate->hash))
 	{
-		free(collate->data);
+		ldb_collate_cleanup(collate);
 		return false;
 	}
+	return true;
+}
 
-	/* Set global cmp width (for qsort) */
-	ldb_cmp_width = max_rec_ln;
+bool ldb_collate_init(struct ldb_collate_data * collate, struct ldb_table table, struct ldb_table out_table, int max_rec_ln, bool merge, uint8_t sector)
+{
+	if (!collate_buffers_init(collate, table, out_table, max_rec_ln, merge))
+		return false;
 
 	/* Open (out) sector */
 	collate->out_sector = ldb_open(out_table, &sector, "w+");
 	if (!collate->out_sector)
 	{
-		free(collate->data);
-		free(collate->tmp_data);
+		ldb_collate_cleanup(collate);
 		return false;
 	}
 
+	/* The collated data is not larger than the input sector data */
+	char *in_path = ldb_sector_path(table, &sector, "r");
+	if (in_path)
+	{
+		uint64_t in_size = ldb_file_size(in_path);
+		if (in_size > LDB_MAP_SIZE)
+			ldb_sector_preallocate(collate->out_sector, in_size - LDB_MAP_SIZE);
+		free(in_path);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Initialize the collate of single lists (incremental collate): instead of going to an
+ * output sector, the nodes of each list are written to a list in memory.
+ *
+ * @param collate collate data
+ * @param table table to be collated
+ * @param out_table table giving the format of the nodes written
+ * @param max_rec_ln maximum record length
+ * @param list list in memory
+ * @return false if the buffers cannot be allocated
+ */
+bool ldb_collate_list_init(struct ldb_collate_data * collate, struct ldb_table table, struct ldb_table out_table, int max_rec_ln, ldb_collate_list_t *list)
+{
+	if (!collate_buffers_init(collate, table, out_table, max_rec_ln, false))
+		return false;
+	collate->list = list;
 	return true;
 }
 
@@ -789,62 +1098,377 @@ void ldb_collate_cleanup(struct ldb_collate_data *collate)
 {
 	if (collate->data)
 	{
-		free(collate->data);
+		if (collate->table_rec_ln)
+			ldb_pool_buffer_release(collate->data);
+		else
+			free(collate->data);
 		collate->data = NULL;
 	}
 	if (collate->tmp_data)
 	{
-		free(collate->tmp_data);
+		ldb_pool_buffer_release(collate->tmp_data);
 		collate->tmp_data = NULL;
 	}
+	if (collate->entries)
+	{
+		ldb_pool_buffer_release(collate->entries);
+		collate->entries = NULL;
+	}
+	free(collate->hash);
+	collate->hash = NULL;
+	if (collate->data_reserved)
+	{
+		ldb_memory_release(collate->data_reserved);
+		collate->data_reserved = 0;
+	}
 	if (collate->out_sector)
 	{
+		ldb_sector_trim(collate->out_sector);
+		ldb_writeback_finish(collate->out_sector);
 		fclose(collate->out_sector);
 		collate->out_sector = NULL;
 	}
 }
 
-void ldb_collate_sector(struct ldb_collate_data *collate, ldb_sector_t * sector)
+/**
+ * @brief Collate a sector and replace it with the collated one
+ *
+ * @param collate collate data, initialized with ldb_collate_init
+ * @param sector sector, loaded in memory or not. Its memory is released
+ * @return true if the sector was read in full before being replaced
+ */
+bool ldb_collate_sector(struct ldb_collate_data *collate, ldb_sector_t * sector)
 {
+	bool result = true;
 	log_info("Collating %s/%s - sector %02x - %s\n", collate->in_table.db, collate->in_table.table, sector->id, sector->data == NULL ? "On disk" : "On RAM");
-	/* Read each one of the (256 ^ 3) list pointers from the map */
-	uint8_t k[LDB_KEY_LN];
-	k[0] = sector->id;
-	for (int k1 = 0; k1 < 256; k1++)
-		for (int k2 = 0; k2 < 256; k2++)
-			for (int k3 = 0; k3 < 256; k3++)
-			{
-				k[1] = k1;
-				k[2] = k2;
-				k[3] = k3;
-				/* If there is a pointer, read the list */
-				/* Process records */
+	/* Read the lists of the keys present in the map (on disk, in the order they are stored) */
+	uint8_t k[LDB_KEY_LN] = {sector->id, 0, 0, 0};
+	if (!sector->data && !sector->file)
+		sector->file = ldb_open(collate->in_table, k, "r");
+
+	ldb_sector_iterator_t it;
+	if (ldb_sector_iterator_init(&it, sector->id, sector->data, sector->file))
+	{
+		/* A sector on disk is scanned sequentially, its lists are followed node by node only if that fails */
+		if (!ldb_collate_external(collate, sector, &it))
+			while (ldb_sector_iterator_next(&it, k))
 				ldb_fetch_recordset_v2(sector, collate->in_table, k, true, ldb_collate_handler, collate);
-			}
+		ldb_sector_iterator_free(&it);
+	}
+	else
+	{
+		if (sector->file)
+			log_info("Error reading table %s/%s - sector %02x: cannot read the map\n", collate->in_table.db, collate->in_table.table, sector->id);
+		result = false;
+	}
 
 	/* Process last record/s */
 	if (collate->data_ptr)
 	{
 		ldb_collate_sort(collate);
-		ldb_import_list(collate);
+		result = ldb_import_list(collate) && result;
+	}
+
+	/* Close the sector if it was read from disk */
+	if (sector->file)
+	{
+		fclose(sector->file);
+		sector->file = NULL;
 	}
 
+	/* Cleanup collate data structures, the out sector is complete once closed */
+	ldb_collate_cleanup(collate);
+
 	/* Move or erase sector */
 	if (collate->merge)
+	{
 		ldb_sector_erase(collate->in_table, k);
+		ldb_sector_publish(collate->out_table, k[0]);
+	}
 	else
+	{
 		ldb_sector_update(collate->out_table, k);
 
+		/* The new sector is collated up to its current size */
+		ldb_collate_state_record(collate->out_table, sector->id, collate->max_rec_ln);
+	}
+
 	if (collate->del_count)
 		log_info("%s - sector %02X: %'ld records deleted\n", collate->in_table.table, sector->id, collate->del_count);
 
 	log_info("Table %s - sector %2x: collate completed with %'ld records\n", collate->in_table.table , sector->id, collate->rec_count);
 
-	/* Cleanup collate data structures */
-	ldb_collate_cleanup(collate);
+	if (sector->data)
+	{
+		free(sector->data);
+		sector->data = NULL;
+		ldb_memory_release(sector->size);
+	}
+	return result;
+}
 
-	free(sector->data);
-	sector->data = NULL;
+/* Sectors of a table collated by a set of workers */
+typedef struct collate_job_t
+{
+	struct ldb_table table;
+	struct ldb_table out_table;
+	int max_rec_ln;
+	bool merge;
+	collate_handler handler;
+	job_delete_tuples_t *delete; // records to delete (DELETE command only)
+	uint8_t order[256];    // sectors to collate, largest first
+	int number;
+	atomic_int next;       // next sector to be taken
+	uint8_t incremental[256]; // sectors collated before, tried incrementally first
+	int incremental_number;
+	atomic_int incremental_next;
+	atomic_int full;       // sectors added to "order" by the incremental workers
+	ldb_collate_state_t *state;
+	uint64_t *size;
+	ldb_tombstones_t *tombstones;
+	bool promoted[256];    // sectors replaced (or found clean) after being read in full
+	atomic_long deleted;   // records deleted
+	bool reserve;          // each worker reserves its collate buffers
+	bool pace_writes;      // paced writeback of the new sectors, as set in the calling thread
+	int ram_percent;       // MAX_RAM_PERCENT of the calling thread
+	char tmp_path[LDB_MAX_PATH]; // collate tmp path of the calling thread
+} collate_job_t;
+
+/* Sector loaded by a helper thread while the previous one is collated. It is left on disk
+   if it does not fit in the budget next to the current one, and loaded again afterwards */
+typedef struct collate_prefetch_t
+{
+	pthread_t thread;
+	struct ldb_table table;
+	uint8_t k0;
+	int ram_percent;
+	ldb_sector_t sector;
+} collate_prefetch_t;
+
+static void *collate_prefetch(void *arg)
+{
+	collate_prefetch_t *prefetch = arg;
+	ldb_memory_init(prefetch->ram_percent);
+	prefetch->sector = collate_load_sector(prefetch->table, prefetch->k0, true);
+	return NULL;
+}
+
+static int collate_sector_size_cmp(const void *a, const void *b, void *arg)
+{
+	uint64_t *size = arg;
+	uint64_t x = size[*(const uint8_t *) a], y = size[*(const uint8_t *) b];
+	return (x < y) - (x > y);
+}
+
+/* Collate a loaded sector */
+static void collate_job_sector(collate_job_t *job, uint8_t k0, ldb_sector_t *sector)
+{
+	log_info("Collating Table %s - Reading sector %02x\n", job->table.table, k0);
+	struct ldb_collate_data collate;
+	if (ldb_collate_init(&collate, job->table, job->out_table, job->max_rec_ln, job->merge, k0))
+	{
+		collate.handler = job->handler;
+		collate.del_tuples = job->delete;
+		job->promoted[k0] = ldb_collate_sector(&collate, sector);
+		atomic_fetch_add(&job->deleted, collate.del_count);
+		return;
+	}
+
+	log_info("ERROR: failed to allocate memory to collate sector %02x\n", k0);
+	if (sector->data)
+	{
+		free(sector->data);
+		ldb_memory_release(sector->size);
+	}
+}
+
+/* Apply the settings of the thread that started the job */
+static void collate_worker_thread(collate_job_t *job)
+{
+	ldb_writeback_enable(job->pace_writes);
+	ldb_memory_init(job->ram_percent);
+	ldb_collate_tmp_path(job->tmp_path);
+}
+
+/**
+ * @brief Incremental collate worker: takes the next sector collated before until none is
+ * left, and queues the sectors that cannot be collated incrementally for a full collate.
+ *
+ * @param arg collate job
+ */
+static void collate_incremental_worker(void *arg)
+{
+	collate_job_t *job = arg;
+	collate_worker_thread(job);
+
+	uint64_t buffers = job->reserve ? ldb_collate_buffer_size(job->table, job->max_rec_ln) : 0;
+	if (buffers)
+		ldb_memory_reserve(buffers, true);
+
+	int i;
+	while ((i = atomic_fetch_add(&job->incremental_next, 1)) < job->incremental_number)
+	{
+		uint8_t k0 = job->incremental[i];
+		if (ldb_collate_incremental(job->table, job->out_table, job->max_rec_ln, k0, &job->state[k0], job->size[k0], job->tombstones))
+			job->promoted[k0] = true;
+		else
+			job->order[atomic_fetch_add(&job->full, 1)] = k0;
+	}
+
+	if (buffers)
+		ldb_memory_release(buffers);
+}
+
+/**
+ * @brief Collate worker: takes the next sector of the job until none is left. The next
+ * sector is loaded by a helper thread while the current one is sorted and written.
+ *
+ * @param arg collate job
+ */
+static void collate_worker(void *arg)
+{
+	collate_job_t *job = arg;
+	collate_worker_thread(job);
+
+	/* Buffers are reserved for the whole run, so a worker never waits holding a sector */
+	uint64_t buffers = job->reserve ? ldb_collate_buffer_size(job->table, job->max_rec_ln) : 0;
+	if (buffers)
+		ldb_memory_reserve(buffers, true);
+
+	int i = atomic_fetch_add(&job->next, 1);
+	ldb_sector_t sector = {.data = NULL, .size = 0};
+	if (i < job->number)
+		sector = ldb_collate_load_sector(job->table, job->order[i]);
+
+	while (i < job->number)
+	{
+		int next = atomic_fetch_add(&job->next, 1);
+		collate_prefetch_t prefetch = {.table = job->table, .ram_percent = job->ram_percent};
+		bool prefetching = false;
+		if (next < job->number)
+		{
+			prefetch.k0 = job->order[next];
+			prefetching = !pthread_create(&prefetch.thread, NULL, collate_prefetch, &prefetch);
+		}
+
+		collate_job_sector(job, job->order[i], &sector);
+
+		if (next >= job->number)
+			break;
+
+		/* The current sector is released: a sector the prefetch left on disk may fit now */
+		if (prefetching)
+			pthread_join(prefetch.thread, NULL);
+		if (!prefetching || (!prefetch.sector.data && prefetch.sector.size))
+			prefetch.sector = ldb_collate_load_sector(job->table, prefetch.k0);
+		sector = prefetch.sector;
+		i = next;
+	}
+
+	if (buffers)
+		ldb_memory_release(buffers);
+}
+
+/* Run a worker function on a number of workers of the pool, or in the calling thread without a pool */
+static void collate_run(ldb_pool_t *pool, int workers, void (*worker)(void *), collate_job_t *job)
+{
+	if (workers <= 0)
+		return;
+	if (!pool)
+	{
+		worker(job);
+		return;
+	}
+	for (int w = 0; w < workers; w++)
+		if (!ldb_pool_submit(pool, worker, job))
+			worker(job);
+	ldb_pool_wait(pool);
+}
+
+/* Collate a set of sectors with a pool of workers, returns the number of records deleted */
+static long collate_sectors(struct ldb_table table, struct ldb_table out_table, int max_rec_ln, bool merge, bool *sectors, int workers,
+	collate_handler handler, job_delete_tuples_t *delete)
+{
+	collate_job_t job = {.table = table, .out_table = out_table, .max_rec_ln = max_rec_ln, .merge = merge, .handler = handler, .delete = delete,
+		.pace_writes = ldb_writeback_enabled(), .ram_percent = ldb_memory_percent()};
+	strcpy(job.tmp_path, ldb_collate_tmp_path_get());
+	atomic_init(&job.next, 0);
+	atomic_init(&job.deleted, 0);
+	atomic_init(&job.incremental_next, 0);
+
+	/* A plain collate skips the sectors unchanged since they were collated, and collates only the lists added to since */
+	ldb_collate_state_t state[256];
+	bool in_place = !merge && !strcmp(table.db, out_table.db) && !strcmp(table.table, out_table.table);
+	bool incremental = in_place && !handler && !delete;
+	if (incremental)
+		ldb_collate_state_load(table, state);
+
+	/* A table collated in place is read without the records deleted by tombstones, which are then purged */
+	job.tombstones = in_place ? ldb_tombstones_get(table, NULL) : NULL;
+
+	/* Existing sectors: those collated before are tried incrementally, the others are collated in full */
+	uint64_t size[256] = {0};
+	job.state = state;
+	job.size = size;
+	for (int k = 0; k < 256; k++)
+	{
+		if (sectors && !sectors[k])
+			continue;
+		uint8_t k0 = k;
+		char *path = ldb_sector_path(table, &k0, "r");
+		if (!path)
+			continue;
+		size[k] = ldb_file_size(path);
+		free(path);
+		if (size[k] && incremental && state[k].inode)
+			job.incremental[job.incremental_number++] = k;
+		else if (size[k])
+			job.order[job.number++] = k;
+	}
+
+	if (workers > job.number + job.incremental_number)
+		workers = job.number + job.incremental_number;
+	ldb_pool_t *pool = workers > 1 ? ldb_pool_create(workers) : NULL;
+	job.reserve = pool != NULL;
+
+	/* Incremental collates run on the workers first, the sectors they give up are added to the full collate */
+	atomic_init(&job.full, job.number);
+	collate_run(pool, job.incremental_number < workers ? job.incremental_number : workers, collate_incremental_worker, &job);
+	job.number = atomic_load(&job.full);
+
+	/* Largest first */
+	qsort_r(job.order, job.number, sizeof(uint8_t), collate_sector_size_cmp, size);
+	if (pool && job.number > 1)
+		log_info("Collating Table %s - %d sectors, %d workers\n", table.table, job.number, job.number < workers ? job.number : workers);
+	collate_run(pool, job.number < workers ? job.number : workers, collate_worker, &job);
+	if (pool)
+		ldb_pool_destroy(pool);
+
+	if (job.tombstones)
+	{
+		ldb_tombstones_purge(table, job.tombstones, job.promoted);
+		ldb_tombstones_release(job.tombstones);
+	}
+	return atomic_load(&job.deleted);
+}
+
+/**
+ * @brief Collate a set of sectors of a table, the largest first. With more than one worker
+ * the sectors are collated in parallel, each worker reserving its collate buffers from the
+ * memory budget; a single worker runs in the calling thread, whose buffers are accounted
+ * by the caller.
+ *
+ * @param table LDB table to be processed
+ * @param out_table Output LDB table
+ * @param max_rec_ln Maximum record lenght
+ * @param merge True for update a record, false to add a new one.
+ * @param sectors sectors to collate, NULL for all of them
+ * @param workers maximum number of sectors collated at the same time
+ * @param handler record handler
+ */
+void ldb_collate_sectors(struct ldb_table table, struct ldb_table out_table, int max_rec_ln, bool merge, bool *sectors, int workers, collate_handler handler)
+{
+	collate_sectors(table, out_table, max_rec_ln, merge, sectors, workers, handler, NULL);
 }
 
 /**
@@ -854,108 +1478,60 @@ void ldb_collate_sector(struct ldb_collate_data *collate, ldb_sector_t * sector)
  * @param out_table Output LDB table
  * @param max_rec_ln Maximum record lenght
  * @param merge True for update a record, false to add a new one.
- * @param del_keys pointer to list of keys to be deleted.
- * @param del_ln number of keys to be deleted
+ * @param p_sector sector to collate, -1 for the whole table (collated in parallel)
+ * @param handler record handler
  */
 void ldb_collate(struct ldb_table table, struct ldb_table out_table, int max_rec_ln, bool merge, int p_sector, collate_handler handler)
 {
-	/* Start with sector 0, unless it is a delete command */
-	uint8_t k0 = 0;
-	if (p_sector >= 0)
-		k0 = p_sector;
-
 	long total_records = 0;
 	setlocale(LC_NUMERIC, "");
 	
 	logger_dbname_set(table.db);
-	/* Read each DB sector */
-	do {
-		log_info("Collating Table %s - Reading sector %02x\n", table.table, k0);
-		struct ldb_collate_data collate;
-		
-		if (ldb_collate_init(&collate, table, out_table, max_rec_ln, merge, k0))
-		{
-
-			/* Load collate data structure */
-			collate.handler = handler;
-			collate.del_tuples = NULL;
-			ldb_sector_t sector  = ldb_load_sector_v2(table, &k0);
-			//skip unexistent sector.
-			if (!sector.size)
-			{
-				ldb_collate_cleanup(&collate);
-				if (p_sector >= 0)
-					break;
-				continue;
-			}
-
-			ldb_collate_sector(&collate, &sector);
-		}
-
-		if (p_sector >=0)
-			break;
 
-		/* Exit here if it is a delete command, otherwise move to the next sector */
-	} while (k0++ < 255);
-
-	/* Show processed totals */
 	if (p_sector >= 0)
+	{
+		bool sectors[256] = {false};
+		sectors[p_sector] = true;
+		ldb_collate_sectors(table, out_table, max_rec_ln, merge, sectors, 1, handler);
 		log_info("Table %s - sector %2x: collate completed with %'ld records\n", table.table , p_sector, total_records);
+	}
 	else
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		ldb_collate_sectors(table, out_table, max_rec_ln, merge, NULL, cpus > 0 ? cpus : 1, handler);
 		log_info("Table %s: collate completed with %'ld records\n", table.table, total_records);
-
+	}
 
 	fflush(stdout);
 }
 
 
 /**
- * @brief Execute the collate job
+ * @brief Delete records from a table. The sectors holding keys to be deleted are collated
+ * in parallel, skipping the records found in the delete list.
  * 
  * @param table LDB table to be processed
  * @param out_table Output LDB table
- * @param max_rec_ln Maximum record lenght
- * @param merge True for update a record, false to add a new one.
- * @param del_keys pointer to list of keys to be deleted.
- * @param del_ln number of keys to be deleted
+ * @param delete tuples to be deleted, sorted and indexed by ldb_collate_load_tuples_to_delete
+ * @param handler record handler
  */
 void ldb_collate_delete(struct ldb_table table, struct ldb_table out_table, job_delete_tuples_t * delete, collate_handler handler)
 {
-
-	/* Start with sector 0, unless it is a delete command */
-	uint8_t k0 = 0;
-	
-	/* Otherwise use the first byte of the first key */
 	if (!delete)
 		return;
 
-	long total_records = 0;
 	setlocale(LC_NUMERIC, "");
-	
 	logger_dbname_set(table.db);
-	int k0_last = -1;
-	/* Read each DB sector */
-	for (int i = 0; i < delete->tuples_number; i++) 
-	{
-		k0 = *delete->tuples[i]->key;
-		struct ldb_collate_data collate;
-		if (k0 != k0_last && ldb_collate_init(&collate, table, out_table, 2048, false, k0))
-		{
-			log_info("Removing keys from Table %s - Reading sector %02x\n", table.table, k0);
-			/* Load collate data structure */
-			collate.handler = handler;
-			collate.del_tuples = delete;
-			collate.del_count = 0;
-			ldb_sector_t sector = ldb_load_sector_v2(table, &k0);
-			ldb_collate_sector(&collate, &sector);
-			total_records += collate.del_count;
-		}
-		k0_last = k0;
-		/* Exit here if it is a delete command, otherwise move to the next sector */
-	} 
+
+	/* Sectors with keys to delete */
+	bool sectors[256] = {false};
+	for (int i = 0; i < delete->tuples_number; i++)
+		sectors[delete->tuples[i]->key[0]] = true;
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	long total_records = collate_sectors(table, out_table, 2048, false, sectors, cpus > 0 ? cpus : 1, handler, delete);
 
 	/* Show processed totals */
 	log_info("Table %s: cleanup completed with %'ld records\n", table.table, total_records);
 	fflush(stdout);
-
 }
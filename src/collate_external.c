@@ -0,0 +1,417 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/collate_external.c
+ *
+ * Out-of-core collate of sectors that do not fit in RAM
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file collate_external.c
+ * @date 18 October 2026
+ * @brief Collate a sector on disk with sequential reads and bounded memory.
+ *
+ * Following the lists of a sector on disk node by node means one seek per node. Instead the
+ * sector is read once front to back (ldb_sector_scan).
+ *
+ * The records read are kept in a sorting run (an arena indexed by radix sorted entries).
+ * When the run exceeds LDB_COLLATE_RUN bytes it is sorted and spilled to the tmp path.
+ * The runs are k-way merged and the records passed, in key order, to ldb_collate_handler.
+ * A sector whose records fit in a single run is never written to the tmp path.
+ *
+ * If the sector cannot be read the scan is abandoned before any record is collated and the
+ * caller falls back to reading the lists node by node.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "ldb.h"
+#include "collate.h"
+#include "memory.h"
+#include "logger.h"
+#include "bsort.h"
+
+#define RUN_PREFIX 12 // main key and first bytes of the record, radix sorted
+#define RUN_RADIX_STACK 5
+#define RUN_RECORD_MAX (LDB_KEY_LN + LDB_MAX_REC_LN + 256) // largest record held in a run
+
+/* Record held in a run: main key and payload (subkey and data) in the arena */
+typedef struct run_entry_t
+{
+	uint8_t prefix[RUN_PREFIX];
+	uint32_t size;       // payload size
+	uint64_t offset;     // record in the arena
+} run_entry_t;
+
+typedef struct collate_run_t
+{
+	uint8_t *arena;
+	size_t used;
+	size_t size;
+	run_entry_t *entries;
+	size_t count;
+	size_t entries_size;
+	size_t limit;        // spill when the run grows over this size
+	bool reserved;       // limit reserved from the memory budget
+} collate_run_t;
+
+/* Spilled run being merged */
+typedef struct run_merge_t
+{
+	FILE *fp;
+	uint8_t *record;     // main key and payload
+	uint32_t size;       // payload size
+} run_merge_t;
+
+typedef struct collate_external_t
+{
+	struct ldb_collate_data *collate;
+	collate_run_t run;
+	run_merge_t *runs;
+	int runs_number;
+	int subkey_ln;
+	uint8_t *batch;      // fixed records of a key passed at once to the handler
+	uint32_t batch_size;
+	uint8_t batch_key[LDB_KEY_LN];
+	uint64_t records;    // records read from the sector
+} collate_external_t;
+
+/* Set per thread, tables with different TMP_PATH may be collated at the same time */
+static __thread char collate_tmp_path[LDB_MAX_PATH] = LDB_COLLATE_TMP_PATH;
+
+/**
+ * @brief Set the directory where the calling thread spills its collate sorting runs
+ *
+ * @param path tmp directory
+ */
+void ldb_collate_tmp_path(char *path)
+{
+	if (path && *path)
+		snprintf(collate_tmp_path, sizeof(collate_tmp_path), "%s", path);
+}
+
+/**
+ * @brief Directory where the calling thread spills its collate sorting runs
+ */
+char *ldb_collate_tmp_path_get(void)
+{
+	return collate_tmp_path;
+}
+
+/* Order of records: main key, payload, then size */
+static int run_record_cmp(const uint8_t *a, uint32_t a_size, const uint8_t *b, uint32_t b_size)
+{
+	int r = memcmp(a, b, LDB_KEY_LN + (a_size < b_size ? a_size : b_size));
+	if (r)
+		return r;
+	return (a_size > b_size) - (a_size < b_size);
+}
+
+static int run_entry_cmp(const void *a, const void *b, void *arg)
+{
+	const run_entry_t *x = a, *y = b;
+	int r = memcmp(x->prefix, y->prefix, RUN_PREFIX);
+	if (r)
+		return r;
+	uint8_t *arena = arg;
+	return run_record_cmp(arena + x->offset, x->size, arena + y->offset, y->size);
+}
+
+static bool run_add(collate_run_t *run, uint8_t *key, uint8_t *payload, uint32_t size, uint8_t *data, uint32_t data_size)
+{
+	size_t ln = LDB_KEY_LN + size + data_size;
+	/* Growth is capped by the run limit, the run is spilled when it is reached */
+	if (run->used + ln > run->size)
+	{
+		size_t new_size = run->size * 2 < run->limit ? run->size * 2 : run->limit;
+		if (new_size < run->used + ln)
+			new_size = run->used + ln;
+		uint8_t *arena = realloc(run->arena, new_size);
+		if (!arena)
+			return false;
+		run->arena = arena;
+		run->size = new_size;
+	}
+	if (run->count == run->entries_size)
+	{
+		size_t entries_size = 2 * run->entries_size < run->limit / sizeof(run_entry_t) ? 2 * run->entries_size : run->limit / sizeof(run_entry_t) + 1;
+		run_entry_t *entries = realloc(run->entries, entries_size * sizeof(run_entry_t));
+		if (!entries)
+			return false;
+		run->entries = entries;
+		run->entries_size = entries_size;
+	}
+
+	uint8_t *record = run->arena + run->used;
+	memcpy(record, key, LDB_KEY_LN);
+	memcpy(record + LDB_KEY_LN, payload, size);
+	memcpy(record + LDB_KEY_LN + size, data, data_size);
+
+	run_entry_t *entry = &run->entries[run->count++];
+	size += data_size;
+	for (int i = 0; i < RUN_PREFIX; i++)
+		entry->prefix[i] = i < LDB_KEY_LN + size ? record[i] : 0;
+	entry->size = size;
+	entry->offset = run->used;
+	run->used += ln;
+	return true;
+}
+
+static void run_sort(collate_run_t *run)
+{
+	run_entry_t *entries = run->entries;
+	radixify((unsigned char *) entries, run->count, 0, 0, 255, sizeof(run_entry_t), RUN_PREFIX, RUN_RADIX_STACK, RUN_PREFIX - 1);
+
+	for (size_t i = 0, j; i < run->count; i = j)
+	{
+		for (j = i + 1; j < run->count && !memcmp(entries[i].prefix, entries[j].prefix, RUN_PREFIX); j++);
+		if (j - i > 1)
+			qsort_r(entries + i, j - i, sizeof(run_entry_t), run_entry_cmp, run->arena);
+	}
+}
+
+/**
+ * @brief Sort the current run and write it to an anonymous file in the tmp path.
+ * Duplicated records are written once.
+ */
+static bool run_spill(collate_external_t *ext)
+{
+	collate_run_t *run = &ext->run;
+	run_sort(run);
+
+	char tmp[LDB_MAX_PATH + 32];
+	snprintf(tmp, sizeof(tmp), "%s/ldb-collate-XXXXXX", collate_tmp_path);
+	int fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+	{
+		log_info("Cannot create collate run in %s: %s\n", collate_tmp_path, strerror(errno));
+		return false;
+	}
+	unlink(tmp);
+
+	FILE *fp = fdopen(fd, "w+");
+	setvbuf(fp, NULL, _IOFBF, LDB_COLLATE_RUN_BUFFER);
+	run_entry_t *last = NULL;
+	bool ok = true;
+	for (size_t i = 0; i < run->count && ok; i++)
+	{
+		run_entry_t *entry = &run->entries[i];
+		uint8_t *record = run->arena + entry->offset;
+		if (last && !run_record_cmp(run->arena + last->offset, last->size, record, entry->size))
+			continue;
+		ok = fwrite(&entry->size, sizeof(uint32_t), 1, fp) == 1 && fwrite(record, LDB_KEY_LN + entry->size, 1, fp) == 1;
+		last = entry;
+	}
+	if (!ok || fflush(fp))
+	{
+		log_info("Cannot write collate run in %s: %s\n", collate_tmp_path, strerror(errno));
+		fclose(fp);
+		return false;
+	}
+	rewind(fp);
+
+	ext->runs = realloc(ext->runs, (ext->runs_number + 1) * sizeof(run_merge_t));
+	ext->runs[ext->runs_number++] = (run_merge_t) {.fp = fp, .record = malloc(RUN_RECORD_MAX), .size = 0};
+	run->used = 0;
+	run->count = 0;
+	return true;
+}
+
+/* Keep a record of the sector in the current run, spilling it when full */
+static bool collate_external_add(collate_external_t *ext, uint8_t *key, uint8_t *payload, uint32_t size, uint8_t *data, uint32_t data_size)
+{
+	collate_run_t *run = &ext->run;
+	if (run->used + run->count * sizeof(run_entry_t) >= run->limit && !run_spill(ext))
+		return false;
+	ext->records++;
+	return run_add(run, key, payload, size, data, data_size);
+}
+
+/* Pass the fixed records gathered for a key to the handler, as a node would */
+static void collate_external_flush_batch(collate_external_t *ext)
+{
+	if (ext->batch_size)
+		ldb_collate_handler(ext->batch_key, NULL, 0, ext->batch, ext->batch_size, 0, ext->collate);
+	ext->batch_size = 0;
+}
+
+/* Pass a record, in key order, to the collate handler */
+static void collate_external_emit(collate_external_t *ext, uint8_t *record, uint32_t size)
+{
+	struct ldb_collate_data *collate = ext->collate;
+	uint8_t *payload = record + LDB_KEY_LN;
+
+	if (!collate->table_rec_ln)
+	{
+		ldb_collate_handler(record, payload, ext->subkey_ln, payload + ext->subkey_ln, size - ext->subkey_ln, 0, collate);
+		return;
+	}
+
+	if (ext->batch_size && (memcmp(ext->batch_key, record, LDB_KEY_LN) || ext->batch_size + size > LDB_COLLATE_NODE_MAX))
+		collate_external_flush_batch(ext);
+	memcpy(ext->batch_key, record, LDB_KEY_LN);
+	memcpy(ext->batch + ext->batch_size, payload, size);
+	ext->batch_size += size;
+}
+
+static bool run_merge_next(run_merge_t *run)
+{
+	if (fread(&run->size, sizeof(uint32_t), 1, run->fp) != 1 || run->size > RUN_RECORD_MAX - LDB_KEY_LN)
+		return false;
+	return fread(run->record, LDB_KEY_LN + run->size, 1, run->fp) == 1;
+}
+
+static void run_heap_down(run_merge_t *runs, int *heap, int n, int i)
+{
+	while (true)
+	{
+		int min = i, l = 2 * i + 1, r = 2 * i + 2;
+		if (l < n && run_record_cmp(runs[heap[l]].record, runs[heap[l]].size, runs[heap[min]].record, runs[heap[min]].size) < 0)
+			min = l;
+		if (r < n && run_record_cmp(runs[heap[r]].record, runs[heap[r]].size, runs[heap[min]].record, runs[heap[min]].size) < 0)
+			min = r;
+		if (min == i)
+			return;
+		int t = heap[i];
+		heap[i] = heap[min];
+		heap[min] = t;
+		i = min;
+	}
+}
+
+/* k-way merge of the spilled runs into the collate handler */
+static void collate_external_merge(collate_external_t *ext)
+{
+	run_merge_t *runs = ext->runs;
+	int *heap = malloc(ext->runs_number * sizeof(int));
+	int n = 0;
+	for (int i = 0; i < ext->runs_number; i++)
+		if (run_merge_next(&runs[i]))
+			heap[n++] = i;
+	for (int i = n / 2 - 1; i >= 0; i--)
+		run_heap_down(runs, heap, n, i);
+
+	while (n)
+	{
+		run_merge_t *top = &runs[heap[0]];
+		collate_external_emit(ext, top->record, top->size);
+		if (!run_merge_next(top))
+			heap[0] = heap[--n];
+		run_heap_down(runs, heap, n, 0);
+	}
+	free(heap);
+}
+
+/**
+ * @brief Scan handler: keep the records of the sector in the current run
+ *
+ * @return true to stop the scan if a run cannot be spilled
+ */
+static bool collate_external_record(uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t *data, uint32_t size, int iteration, void *ptr)
+{
+	collate_external_t *ext = ptr;
+	int rec_ln = ext->collate->table_rec_ln;
+
+	if (!rec_ln)
+		return !collate_external_add(ext, key, subkey, subkey_ln, data, size);
+
+	/* A node of fixed records, the handler ignores nodes that are not made of whole records */
+	if (size % rec_ln)
+		return false;
+	for (uint32_t i = 0; i < size; i += rec_ln)
+		if (!collate_external_add(ext, key, data + i, rec_ln, NULL, 0))
+			return true;
+	return false;
+}
+
+static void collate_external_free(collate_external_t *ext)
+{
+	for (int i = 0; i < ext->runs_number; i++)
+	{
+		fclose(ext->runs[i].fp);
+		free(ext->runs[i].record);
+	}
+	free(ext->runs);
+	free(ext->run.arena);
+	free(ext->run.entries);
+	free(ext->batch);
+	if (ext->run.reserved)
+		ldb_memory_release(ext->run.limit);
+}
+
+/**
+ * @brief Collate a sector on disk reading it sequentially. The records are sorted in runs
+ * of bounded size, spilled to the tmp path and merged into ldb_collate_handler.
+ *
+ * @param collate collate data, initialised
+ * @param sector sector on disk (data is NULL, file is open)
+ * @param it disk mode iterator of the sector
+ * @return false if nothing was collated and the lists must be read node by node
+ */
+bool ldb_collate_external(struct ldb_collate_data *collate, ldb_sector_t *sector, ldb_sector_iterator_t *it)
+{
+	if (sector->data || !sector->file || it->map)
+		return false;
+
+	collate_external_t ext = {.collate = collate, .subkey_ln = collate->table_key_ln - LDB_KEY_LN};
+	if (collate->table_rec_ln)
+		ext.subkey_ln = 0;
+
+	/* The run is taken from the memory budget, without waiting */
+	collate_run_t *run = &ext.run;
+	run->limit = LDB_COLLATE_RUN;
+	while (!(run->reserved = ldb_memory_reserve(run->limit, false)) && run->limit > LDB_COLLATE_RUN_MIN)
+		run->limit /= 2;
+
+	run->size = LDB_SCAN_BLOCK;
+	run->entries_size = LDB_SCAN_BLOCK / 64;
+	run->arena = malloc(run->size);
+	run->entries = malloc(run->entries_size * sizeof(run_entry_t));
+	ext.batch = malloc(LDB_COLLATE_NODE_MAX);
+	if (!run->arena || !run->entries || !ext.batch ||
+		!ldb_sector_scan(collate->in_table, sector->file, it, collate_external_record, &ext))
+	{
+		collate_external_free(&ext);
+		return false;
+	}
+
+	/* A single run is passed from memory */
+	if (!ext.runs_number)
+	{
+		log_info("Sector %02x: %'lu records read sequentially\n", sector->id, ext.records);
+		run_sort(run);
+		for (size_t i = 0; i < run->count; i++)
+			collate_external_emit(&ext, run->arena + run->entries[i].offset, run->entries[i].size);
+	}
+	else
+	{
+		if (!run_spill(&ext))
+		{
+			collate_external_free(&ext);
+			return false;
+		}
+		log_info("Sector %02x: %'lu records read sequentially, merging %d runs from %s\n", sector->id, ext.records, ext.runs_number, collate_tmp_path);
+		collate_external_merge(&ext);
+	}
+
+	collate_external_flush_batch(&ext);
+	collate_external_free(&ext);
+	return true;
+}
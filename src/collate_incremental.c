@@ -0,0 +1,413 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/collate_incremental.c
+ *
+ * Incremental collate
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file collate_incremental.c
+ * @date 18 October 2026
+ * @brief Collate only the lists of a sector that changed since it was last collated.
+ *
+ * Nodes are only ever appended to a sector. When a sector is collated, its inode, its size
+ * (the collated extent) and the maximum record length are recorded in the state file of the
+ * table (LDB_COLLATE_STATE_NAME). A sector that did not grow since is clean and is not
+ * collated again, unless a smaller maximum record length is asked for. In a sector that grew,
+ * the dirty lists are those whose header or last node lies past the extent: they were
+ * created or added to afterwards, whoever wrote them.
+ *
+ * The dirty lists are collated one by one into memory and appended, compacted, to the end of
+ * the sector. Only once all of them are on disk are their map pointers moved to the new
+ * lists, so an interrupted collate leaves the sector as it was. The old lists are left in
+ * place as dead space, accounted in the state file. When the dead space would exceed
+ * LDB_COLLATE_DEAD_MAX percent of the sector, the whole sector is collated instead.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "ldb.h"
+#include "collate.h"
+#include "ldb_error.h"
+#include "logger.h"
+
+#define STATE_BLOCK (1048576) // list headers are read in blocks of this size
+
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void collate_state_path(struct ldb_table table, char *path)
+{
+	snprintf(path, LDB_MAX_PATH, "%s/%s/%s/%s", ldb_root, table.db, table.table, LDB_COLLATE_STATE_NAME);
+}
+
+/**
+ * @brief Load the collate state of the sectors of a table
+ *
+ * @param table table
+ * @param state [out] 256 sectors, zeroed if unknown
+ */
+void ldb_collate_state_load(struct ldb_table table, ldb_collate_state_t *state)
+{
+	memset(state, 0, 256 * sizeof(ldb_collate_state_t));
+
+	char path[LDB_MAX_PATH];
+	collate_state_path(table, path);
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return;
+
+	unsigned int k;
+	ldb_collate_state_t entry;
+	char line[128];
+	while (fgets(line, sizeof(line), fp))
+	{
+		/* States written without the maximum record length leave it unknown */
+		entry.max_rec_ln = 0;
+		if (sscanf(line, "%x\t%lu\t%lu\t%lu\t%d", &k, &entry.inode, &entry.extent, &entry.dead, &entry.max_rec_ln) >= 4 && k < 256)
+			state[k] = entry;
+	}
+	fclose(fp);
+}
+
+/**
+ * @brief Save the collate state of a sector
+ *
+ * @param table table
+ * @param k0 sector number
+ * @param state state of the sector, NULL to forget it
+ */
+void ldb_collate_state_save(struct ldb_table table, uint8_t k0, ldb_collate_state_t *state)
+{
+	char path[LDB_MAX_PATH];
+	char tmp_path[LDB_MAX_PATH + 4];
+	collate_state_path(table, path);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	/* Sectors are collated in parallel */
+	pthread_mutex_lock(&state_lock);
+	ldb_collate_state_t sectors[256];
+	ldb_collate_state_load(table, sectors);
+	if (state)
+		sectors[k0] = *state;
+	else
+		memset(&sectors[k0], 0, sizeof(ldb_collate_state_t));
+
+	bool result = false;
+	FILE *fp = fopen(tmp_path, "w");
+	if (fp)
+	{
+		for (int k = 0; k < 256; k++)
+			if (sectors[k].inode)
+				fprintf(fp, "%02x\t%lu\t%lu\t%lu\t%d\n", k, sectors[k].inode, sectors[k].extent, sectors[k].dead, sectors[k].max_rec_ln);
+		result = !fclose(fp) && !rename(tmp_path, path);
+	}
+	if (!result)
+		log_info("Warning: cannot update the collate state %s\n", path);
+	pthread_mutex_unlock(&state_lock);
+}
+
+/**
+ * @brief Record a sector as collated up to its current size
+ *
+ * @param table table
+ * @param k0 sector number
+ * @param max_rec_ln maximum record length of the collate
+ */
+void ldb_collate_state_record(struct ldb_table table, uint8_t k0, int max_rec_ln)
+{
+	char path[LDB_MAX_PATH];
+	snprintf(path, sizeof(path), "%s/%s/%s/%02x.ldb", ldb_root, table.db, table.table, k0);
+
+	struct stat st;
+	if (stat(path, &st))
+	{
+		ldb_collate_state_save(table, k0, NULL);
+		return;
+	}
+
+	ldb_collate_state_t state = {.inode = st.st_ino, .extent = st.st_size, .dead = 0, .max_rec_ln = max_rec_ln};
+	ldb_collate_state_save(table, k0, &state);
+}
+
+/**
+ * @brief Add a node to a list in memory, with the layout ldb_node_write gives it in a sector:
+ * the list header (pointer to the last node) and the nodes, each one linked to the next.
+ *
+ * @param list list, its nodes are addressed from list->base
+ * @param table table giving the node format
+ * @param key key of the list
+ * @param data node data
+ * @param dataln data length
+ * @param records number of records (fixed records), 0 for variable records
+ * @return LDB_ERROR_NOERROR or an error code
+ */
+int ldb_collate_list_node(ldb_collate_list_t *list, struct ldb_table table, uint8_t *key, uint8_t *data, uint32_t dataln, uint16_t records)
+{
+	uint32_t subkey_ln = table.key_ln - LDB_KEY_LN;
+	if (table.ts_ln != 2 && table.ts_ln != 4)
+	{
+		log_info("E060 Unsupported node_length size (must be 2 or 4 bytes)\n");
+		return LDB_ERROR_NODE_SIZE_INVALID;
+	}
+
+	size_t header_ln = list->size ? 0 : LDB_PTR_LN;
+	size_t node_ln = LDB_PTR_LN + table.ts_ln + subkey_ln + dataln;
+	if (list->size + header_ln + node_ln > list->capacity)
+	{
+		size_t capacity = list->capacity ? list->capacity * 2 : STATE_BLOCK;
+		while (capacity < list->size + header_ln + node_ln)
+			capacity *= 2;
+		uint8_t *buffer = realloc(list->data, capacity);
+		if (!buffer)
+			return LDB_ERROR_MEM_NOMEM;
+		list->data = buffer;
+		list->capacity = capacity;
+	}
+
+	/* LN: the header points to the last node, the previous last node links to the new one */
+	size_t node = list->size + header_ln;
+	uint40_write(list->data, list->base + node);
+	if (list->size)
+		uint40_write(list->data + list->last, list->base + node);
+
+	uint8_t *p = list->data + node;
+	uint40_write(p, 0);
+	p += LDB_PTR_LN;
+
+	/* TS: number of records (fixed records) or bytes (variable records) */
+	uint32_t ts = records ? records : dataln + subkey_ln;
+	if (table.ts_ln == 2)
+		uint16_write(p, ts);
+	else
+		uint32_write(p, ts);
+	p += table.ts_ln;
+
+	memcpy(p, key + LDB_KEY_LN, subkey_ln);
+	memcpy(p + subkey_ln, data, dataln);
+
+	list->last = node;
+	list->size = node + node_ln;
+	return LDB_ERROR_NOERROR;
+}
+
+/* Bytes taken by a list in the sector, header included */
+static uint64_t collate_list_bytes(int fd, struct ldb_table table, uint64_t list, uint64_t size)
+{
+	int header_ln = LDB_PTR_LN + table.ts_ln;
+	uint8_t header[LDB_PTR_LN + 4];
+	uint64_t bytes = LDB_PTR_LN;
+	uint64_t node = list + LDB_PTR_LN;
+
+	/* A list cannot have more nodes than fit in the sector */
+	for (uint64_t n = 0; node && n < size / header_ln; n++)
+	{
+		if (pread(fd, header, header_ln, node) != header_ln)
+			break;
+		uint64_t node_size = table.ts_ln == 2 ? uint16_read(header + LDB_PTR_LN) : uint32_read(header + LDB_PTR_LN);
+		bytes += header_ln + (table.rec_ln ? node_size * table.rec_ln : node_size);
+
+		uint64_t next = uint40_read(header);
+		if (next == node)
+			break;
+		node = next;
+	}
+	return bytes;
+}
+
+/* Keep the lists of the iterator created or added to past the extent, or with tombstones */
+static bool collate_dirty_lists(int fd, ldb_sector_iterator_t *it, uint64_t extent, ldb_tombstones_t *tombstones)
+{
+	uint8_t *block = malloc(STATE_BLOCK);
+	if (!block)
+		return false;
+
+	/* The lists are in offset order, their headers are read forwards */
+	uint64_t start = 0, length = 0;
+	uint32_t dirty = 0;
+	for (uint32_t i = 0; i < it->number; i++)
+	{
+		uint64_t list = it->list[i] >> 24;
+		if (list + LDB_PTR_LN > start + length || list < start)
+		{
+			ssize_t r = pread(fd, block, STATE_BLOCK, list);
+			if (r < LDB_PTR_LN)
+			{
+				free(block);
+				return false;
+			}
+			start = list;
+			length = r;
+		}
+
+		uint32_t position = it->list[i] & 0xFFFFFF;
+		uint8_t key[LDB_KEY_LN] = {it->id, position >> 16, position >> 8, position};
+		if (list >= extent || uint40_read(block + (list - start)) >= extent || (tombstones && ldb_tombstones_listed(tombstones, key)))
+			it->list[dirty++] = it->list[i];
+	}
+	it->number = dirty;
+	free(block);
+	return true;
+}
+
+/* Collate the dirty lists of a sector, appending them compacted and retargeting the map */
+static bool collate_lists(struct ldb_table table, struct ldb_table out_table, int max_rec_ln, FILE *file, ldb_sector_iterator_t *it,
+	uint64_t size, uint64_t *end, uint64_t *dead)
+{
+	int fd = fileno(file);
+	struct ldb_collate_data collate;
+	ldb_collate_list_t list = {0};
+	if (!ldb_collate_list_init(&collate, table, out_table, max_rec_ln, &list))
+		return false;
+
+	uint8_t key[LDB_KEY_LN] = {it->id};
+	bool result = true;
+	for (uint32_t i = 0; result && i < it->number; i++)
+	{
+		uint32_t position = it->list[i] & 0xFFFFFF;
+		uint64_t old_list = it->list[i] >> 24;
+		key[1] = position >> 16;
+		key[2] = position >> 8;
+		key[3] = position;
+
+		/* The list is read through the locked stream: closing another descriptor of the
+		   sector would release the lock */
+		ldb_sector_t sector = {.id = it->id, .file = file};
+		list.base = *end;
+		list.size = 0;
+		ldb_fetch_recordset_v2(&sector, table, key, true, ldb_collate_handler, &collate);
+		if (collate.data_ptr)
+		{
+			ldb_collate_sort(&collate);
+			result = ldb_import_list(&collate);
+		}
+		collate.data_ptr = 0;
+		collate.entries_number = 0;
+		collate.hash_generation++;
+		collate.key_rec_count = 0;
+
+		if (result && list.size && pwrite(fd, list.data, list.size, *end) != (ssize_t) list.size)
+			result = false;
+
+		/* The new list replaces the old one once every list is written */
+		it->list[i] = (list.size ? *end : 0) << 24 | position;
+		*end += list.size;
+		*dead += collate_list_bytes(fd, table, old_list, size);
+	}
+
+	/* Retarget the map, in map order */
+	if (result)
+		result = !fdatasync(fd);
+	if (result)
+	{
+		ldb_sector_iterator_key_order(it);
+		for (uint32_t i = 0; result && i < it->number; i++)
+		{
+			uint8_t pointer[LDB_PTR_LN];
+			uint32_t position = it->list[i] & 0xFFFFFF;
+			uint8_t k[LDB_KEY_LN] = {it->id, position >> 16, position >> 8, position};
+			uint40_write(pointer, it->list[i] >> 24);
+			result = pwrite(fd, pointer, LDB_PTR_LN, ldb_map_pointer_pos(k)) == LDB_PTR_LN;
+		}
+		result = !fdatasync(fd) && result;
+	}
+
+	free(list.data);
+	ldb_collate_cleanup(&collate);
+	return result;
+}
+
+/**
+ * @brief Collate a sector incrementally if it was collated before: a sector that did not
+ * change is skipped and a sector that grew has only its dirty lists collated.
+ *
+ * @param table table
+ * @param out_table table giving the format of the nodes written (collate output table)
+ * @param max_rec_ln maximum record length
+ * @param k0 sector number
+ * @param state collate state of the sector, updated
+ * @param size sector size
+ * @param tombstones tombstones to purge (the lists with tombstones are collated), may be NULL
+ * @return false if the sector must be collated in full
+ */
+bool ldb_collate_incremental(struct ldb_table table, struct ldb_table out_table, int max_rec_ln, uint8_t k0, ldb_collate_state_t *state, uint64_t size, ldb_tombstones_t *tombstones)
+{
+	/* Clean lists keep the records up to the previous maximum length */
+	if (!state->inode || size < state->extent || max_rec_ln < state->max_rec_ln || !state->max_rec_ln)
+		return false;
+
+	/* Dead space left once the lists written since the last collate are replaced */
+	uint64_t data = size - LDB_MAP_SIZE;
+	if ((state->dead + size - state->extent) * 100 > data * LDB_COLLATE_DEAD_MAX)
+	{
+		log_info("Table %s - sector %02x: %lu KB of dead space over %d%%, collating the whole sector\n", table.table, k0, (state->dead + size - state->extent) >> 10, LDB_COLLATE_DEAD_MAX);
+		return false;
+	}
+
+	FILE *file = ldb_open(table, &k0, "r+");
+	if (!file)
+		return false;
+
+	struct stat st;
+	if (fstat(fileno(file), &st) || st.st_ino != state->inode || (uint64_t) st.st_size != size)
+	{
+		ldb_close_unlock(file);
+		return false;
+	}
+
+	if (tombstones && !tombstones->sectors[k0])
+		tombstones = NULL;
+
+	if (size == state->extent && !tombstones)
+	{
+		log_debug("Table %s - sector %02x: unchanged since it was collated\n", table.table, k0);
+		ldb_close_unlock(file);
+		return true;
+	}
+
+	ldb_sector_iterator_t it;
+	if (!ldb_sector_iterator_init(&it, k0, NULL, file))
+	{
+		ldb_close_unlock(file);
+		return false;
+	}
+
+	uint32_t lists = it.number;
+	uint64_t end = size, dead = state->dead;
+	bool result = collate_dirty_lists(fileno(file), &it, state->extent, tombstones) &&
+		collate_lists(table, out_table, max_rec_ln, file, &it, size, &end, &dead);
+
+	if (result)
+	{
+		log_info("Table %s - sector %02x: %u of %u lists collated incrementally, %lu KB appended\n", table.table, k0, it.number, lists, (end - size) >> 10);
+		state->extent = end;
+		state->dead = dead;
+		state->max_rec_ln = max_rec_ln;
+		ldb_collate_state_save(table, k0, state);
+	}
+	else
+		log_info("Table %s - sector %02x: incremental collate failed, collating the whole sector\n", table.table, k0);
+
+	ldb_sector_iterator_free(&it);
+	ldb_close_unlock(file);
+	if (result)
+		ldb_sector_publish(table, k0);
+	return result;
+}
@@ -46,6 +46,7 @@
 #include "ldb_string.h"
 #include "import.h"
 #include "collate.h"
+#include "writeback.h"
 #include "logger.h"
 char *ldb_commands[] = 
 {
@@ -63,6 +64,9 @@ char *ldb_commands[] =
 	"delete from {ascii} max {ascii} keys {ascii}",
 	"delete from {ascii} record {ascii}",
 	"delete from {ascii} records from {ascii}",
+	"tombstone from {ascii} keys {ascii}",
+	"tombstone from {ascii} record {ascii}",
+	"tombstone from {ascii} records from {ascii}",
 	"collate {ascii} max {ascii}",
 	"bulk insert {ascii} from {ascii} with {ascii}",
 	"bulk insert {ascii} from {ascii}",
@@ -236,15 +240,6 @@ uint8_t *fetch_keys(char *keys, long *size, int key_ln)
 	return keyblob;
 }
 
-void job_delete_tuples_free(job_delete_tuples_t * job)
-{
-	for (int i = 0; i < job->tuples_number; i++)
-	{
-		free(job->tuples[i]->data);
-		free(job->tuples[i]);
-	}
-	free(job->tuples);
-}
 /**
  * @brief LDB console command to delete keys
  * 
@@ -292,7 +287,7 @@ void ldb_command_delete(char *command)
 
 		/* Unlock DB */
 		ldb_unlock(dbtable);
-		job_delete_tuples_free(&del_job);
+		ldb_collate_delete_free(&del_job);
 	}
 	/* Free memory */
 	free(dbtable);
@@ -369,7 +364,7 @@ void ldb_command_delete_records(char *command)
 			fprintf(stderr, "No csv record could be read from %s\n", path);
 		}
 
-		job_delete_tuples_free(&del_job);
+		ldb_collate_delete_free(&del_job);
 		/* Unlock DB */
 		ldb_unlock(dbtable);
 	}
@@ -380,6 +375,65 @@ void ldb_command_delete_records(char *command)
 	free(path);
 }
 
+/**
+ * @brief LDB console command to delete keys or records at read time: tombstones are added to
+ * the delete log of the table, and purged by the next collate
+ * 
+ * @param command command to be executed
+ */
+void ldb_command_tombstone(char *command)
+{
+	/* Extract values from command */
+	char *dbtable = ldb_extract_word(3, command);
+	char *mode = ldb_extract_word(4, command);
+
+	if (ldb_valid_table(dbtable))
+	{
+		struct ldb_table ldbtable = ldb_read_cfg(dbtable);
+		logger_dbname_set(ldbtable.db);
+
+		char *buffer = NULL;
+		char *delimiter = "\r\n";
+		if (!strcmp(mode, "keys"))
+		{
+			buffer = strdup(keys_start(command, " keys "));
+			delimiter = ", ";
+		}
+		else if (!strcmp(mode, "record"))
+			buffer = strdup(keys_start(command, " record "));
+		else
+		{
+			char *path = ldb_extract_word(6, command);
+			uint64_t size = ldb_file_size(path);
+			FILE *fp = size ? fopen(path, "r") : NULL;
+			if (fp)
+			{
+				buffer = calloc(size + 1, 1);
+				if (fread(buffer, 1, size, fp) != size)
+				{
+					free(buffer);
+					buffer = NULL;
+				}
+				fclose(fp);
+			}
+			if (!buffer)
+				fprintf(stderr, "File %s could not be loaded\n", path);
+			free(path);
+		}
+
+		if ((ldbtable.definitions > 0 && ldbtable.definitions & LDB_TABLE_DEFINITION_MZ) ||
+			(!strcmp(ldbtable.table, "sources") || !strcmp(ldbtable.table, "notices")))
+			printf("E077 Tombstones are not supported by MZ tables\n");
+		else if (buffer && ldb_tombstone_add(ldbtable, buffer, delimiter) < 0)
+			printf("E078 Cannot add the tombstones to %s\n", dbtable);
+		free(buffer);
+	}
+
+	/* Free memory */
+	free(dbtable);
+	free(mode);
+}
+
 /**
  * @brief Execute the LDB command collate
  * 
@@ -416,7 +470,12 @@ void ldb_command_collate(char *command)
 			else if (max < ldbtable.key_ln)
 				printf("E076 Max record length cannot be smaller than table key\n");
 			else
+			{
+				/* The collate workers pace their writes as the table imports do */
+				ldb_writeback_enable(ldb_import_table_option(ldbtable.db, ldbtable.table, "PACE_WRITES", 0) > 0);
 				ldb_collate(ldbtable, tmptable, max, false,-1, NULL);
+				ldb_writeback_enable(false);
+			}
 		}
 	}
 
@@ -544,6 +603,7 @@ void ldb_command_unlink_list(char *command)
 			sector = ldb_open(ldbtable, keybin, "r+");
 			ldb_list_unlink(sector, keybin);
 			ldb_close_unlock(sector);
+			ldb_sector_publish(ldbtable, keybin[0]);
 		}
 	}
 
@@ -23,6 +23,9 @@ SELECT,
 DELETE,
 DELETE_RECORD,
 DELETE_RECORDS,
+TOMBSTONE_KEYS,
+TOMBSTONE_RECORD,
+TOMBSTONE_RECORDS,
 COLLATE,
 BULK_INSERT,
 BULK_INSERT_DEFAULT,
@@ -52,5 +55,6 @@ void ldb_command_delete(char *command);
 void ldb_command_collate(char *command);
 void ldb_command_unlink_list(char *command);
 void ldb_command_delete_records(char *command);
+void ldb_command_tombstone(char *command);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/csv.c
+ *
+ * CSV tokenizer of the importer
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file csv.c
+ * @date 18 October 2026
+ * @brief Single pass CSV tokenizer.
+ *
+ * The input is read in large blocks. Each line is scanned once, 16 bytes at a time with
+ * SSE2 (a scalar loop elsewhere), finding the line end and the field separators together.
+ * The importer takes the field count and the field offsets from the scan instead of
+ * searching the line again. Fields are not quoted in the LDB CSV format.
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "csv.h"
+
+/**
+ * @brief Start reading a CSV input
+ *
+ * @param reader reader
+ * @param fp input
+ */
+void ldb_csv_reader_init(ldb_csv_reader_t *reader, FILE *fp)
+{
+	memset(reader, 0, sizeof(ldb_csv_reader_t));
+	reader->fp = fp;
+	reader->size = LDB_CSV_BUFFER;
+	reader->buffer = malloc(reader->size + 1);
+}
+
+void ldb_csv_reader_free(ldb_csv_reader_t *reader)
+{
+	free(reader->buffer);
+	reader->buffer = NULL;
+}
+
+static inline void csv_separator(ldb_csv_line_t *line, size_t offset)
+{
+	if (line->fields < LDB_CSV_FIELDS_MAX)
+		line->field[line->fields] = offset + 1;
+	line->fields++;
+}
+
+/**
+ * @brief Scan data for the end of the line, recording the separators found before it
+ *
+ * @param data data to scan
+ * @param ln data length
+ * @param line line being tokenized
+ * @param base offset of data in the line
+ * @return position of the LF in data, ln if there is none
+ */
+static size_t csv_scan(const char *data, size_t ln, ldb_csv_line_t *line, size_t base)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i comma = _mm_set1_epi8(',');
+	for (; i + 16 <= ln; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+		unsigned lf_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+		unsigned comma_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, comma));
+
+		/* Only the separators before the LF belong to this line */
+		if (lf_mask)
+			comma_mask &= (lf_mask & -lf_mask) - 1;
+
+		while (comma_mask)
+		{
+			csv_separator(line, base + i + __builtin_ctz(comma_mask));
+			comma_mask &= comma_mask - 1;
+		}
+
+		if (lf_mask)
+			return i + __builtin_ctz(lf_mask);
+	}
+#endif
+	for (; i < ln; i++)
+	{
+		if (data[i] == '\n')
+			return i;
+		if (data[i] == ',')
+			csv_separator(line, base + i);
+	}
+	return ln;
+}
+
+/* Move the pending data to the start of the buffer and read more */
+static void csv_fill(ldb_csv_reader_t *reader)
+{
+	size_t pending = reader->end - reader->start;
+	if (reader->start)
+	{
+		memmove(reader->buffer, reader->buffer + reader->start, pending);
+		reader->start = 0;
+		reader->end = pending;
+	}
+
+	/* A line longer than the buffer */
+	if (reader->end == reader->size)
+	{
+		reader->size *= 2;
+		reader->buffer = realloc(reader->buffer, reader->size + 1);
+	}
+
+	size_t n = fread(reader->buffer + reader->end, 1, reader->size - reader->end, reader->fp);
+	reader->end += n;
+	if (!n)
+		reader->eof = true;
+}
+
+/**
+ * @brief Read and tokenize the next line. The line is valid until the next call.
+ *
+ * @param reader reader
+ * @param line [out] line
+ * @return false at the end of the input
+ */
+bool ldb_csv_read(ldb_csv_reader_t *reader, ldb_csv_line_t *line)
+{
+	line->fields = 1;
+	line->field[0] = 0;
+
+	size_t scanned = 0;
+	while (true)
+	{
+		size_t available = reader->end - reader->start;
+		size_t lf = csv_scan(reader->buffer + reader->start + scanned, available - scanned, line, scanned);
+		scanned += lf;
+
+		if (scanned < available)
+		{
+			line->ln = scanned;
+			line->read = scanned + 1;
+			break;
+		}
+
+		if (reader->eof)
+		{
+			/* Last line without LF */
+			if (!available)
+				return false;
+			line->ln = line->read = available;
+			break;
+		}
+		csv_fill(reader);
+	}
+
+	line->data = reader->buffer + reader->start;
+	line->data[line->ln] = 0;
+	reader->start += line->read;
+	return true;
+}
+
+/**
+ * @brief Get field n (starting at 1) of a line
+ *
+ * @param line line
+ * @param n field number
+ * @return field, NULL if the line has less fields
+ */
+char *ldb_csv_field(ldb_csv_line_t *line, int n)
+{
+	if (n < 1 || n > line->fields || n > LDB_CSV_FIELDS_MAX)
+		return NULL;
+	return line->data + line->field[n - 1];
+}
+
+/**
+ * @brief Length of field n (starting at 1) of a line
+ */
+size_t ldb_csv_field_ln(ldb_csv_line_t *line, int n)
+{
+	if (n < 1 || n > line->fields || n > LDB_CSV_FIELDS_MAX)
+		return 0;
+	size_t end = n < line->fields && n < LDB_CSV_FIELDS_MAX ? line->field[n] - 1 : line->ln;
+	if (n < line->fields && n == LDB_CSV_FIELDS_MAX)
+		end = (char *) memchr(line->data + line->field[n - 1], ',', line->ln - line->field[n - 1]) - line->data;
+	return end - line->field[n - 1];
+}
+
+/**
+ * @brief Check that data is hexadecimal
+ *
+ * @param data data
+ * @param ln data length
+ * @return true if every character is an hex digit
+ */
+bool ldb_csv_hex(const char *data, size_t ln)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i below_0 = _mm_set1_epi8('0' - 1);
+	const __m128i above_9 = _mm_set1_epi8('9' + 1);
+	const __m128i below_a = _mm_set1_epi8('a' - 1);
+	const __m128i above_f = _mm_set1_epi8('f' + 1);
+	const __m128i lower = _mm_set1_epi8(0x20);
+	for (; i + 16 <= ln; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+		__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, below_0), _mm_cmplt_epi8(v, above_9));
+		__m128i l = _mm_or_si128(v, lower);
+		__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(l, below_a), _mm_cmplt_epi8(l, above_f));
+		if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF)
+			return false;
+	}
+#endif
+	for (; i < ln; i++)
+	{
+		char c = data[i] | 0x20;
+		if (!((data[i] >= '0' && data[i] <= '9') || (c >= 'a' && c <= 'f')))
+			return false;
+	}
+	return true;
+}
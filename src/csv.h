@@ -0,0 +1,37 @@
+#ifndef __CSV_H
+#define __CSV_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define LDB_CSV_BUFFER (1024 * 1024) // input read per block
+#define LDB_CSV_FIELDS_MAX 8 // field offsets recorded per line
+
+/* A CSV line, tokenized in a single pass */
+typedef struct ldb_csv_line_t
+{
+	char *data;                          // line, NUL terminated, without the LF
+	size_t ln;                           // line length, without the LF
+	size_t read;                         // bytes taken from the input, LF included
+	int fields;                          // number of fields
+	uint32_t field[LDB_CSV_FIELDS_MAX];  // offsets of the first fields
+} ldb_csv_line_t;
+
+typedef struct ldb_csv_reader_t
+{
+	FILE *fp;
+	char *buffer;
+	size_t size;
+	size_t start;   // next line
+	size_t end;     // end of the data read
+	bool eof;
+} ldb_csv_reader_t;
+
+void ldb_csv_reader_init(ldb_csv_reader_t *reader, FILE *fp);
+bool ldb_csv_read(ldb_csv_reader_t *reader, ldb_csv_line_t *line);
+void ldb_csv_reader_free(ldb_csv_reader_t *reader);
+char *ldb_csv_field(ldb_csv_line_t *line, int n);
+size_t ldb_csv_field_ln(ldb_csv_line_t *line, int n);
+bool ldb_csv_hex(const char *data, size_t ln);
+#endif
@@ -1,14 +1,16 @@
 #include "decode.h"
 #include "logger.h"
+#include <pthread.h>
 void * lib_handle = NULL;
 
 int (*decode) (int op, unsigned char *key, unsigned char *nonce,
 		        const char *buffer_in, int buffer_in_len, unsigned char *buffer_out) = NULL;
 
-bool ldb_decoder_lib_load(void)
+static pthread_once_t decoder_once = PTHREAD_ONCE_INIT;
+static bool decoder_loaded = false;
+
+static void decoder_load(void)
 {
-	if (lib_handle != NULL)
-		return true;
 	/*set decode funtion pointer to NULL*/
 	decode = NULL;
 	lib_handle = dlopen("libscanoss_encoder.so", RTLD_NOW);
@@ -20,12 +22,21 @@ bool ldb_decoder_lib_load(void)
 		if ((err = dlerror())) 
 		{
 			log_info("%s\n", err);
-			return false;
+			return;
 		}
-		return true;
+		decoder_loaded = true;
      }
-	 
-	 return false;
+}
+
+/**
+ * @brief Load the decoder library. The library is loaded once, concurrent callers wait for it
+ *
+ * @return true if the decoder is available
+ */
+bool ldb_decoder_lib_load(void)
+{
+	pthread_once(&decoder_once, decoder_load);
+	return decoder_loaded;
 }
 
 void ldb_decoder_lib_close(void)
@@ -22,6 +22,8 @@
 #include "ldb.h"
 #include <stdio.h>
 #include "ldb_string.h"
+#include "collate.h"
+#include "memory.h"
  /**
   * @file dump.c
   * @date 12 Jul 2020 
@@ -47,23 +49,31 @@ void ldb_dump(struct ldb_table table, int hex_bytes, int sectorn)
 	if (sectorn >= 0) k0 = (uint8_t) sectorn;
 
 	do {
-		uint8_t *sector = ldb_load_sector(table, &k0);
-		if (sector)
+		/* The output is in key order, each key with all its records, whether the sector is loaded
+		   (when it fits in the memory budget) or not. On disk the lists are read in key order
+		   through a single stream: the sequential scan (ldb_sector_scan) yields the records in
+		   file order, with the lists interleaved, so dump does not use it */
+		ldb_sector_t sector = ldb_collate_load_sector(table, k0);
+		if (sector.size)
 		{
-			/* Read each one of the (256 ^ 3) list pointers from the map */
+			if (!sector.data)
+				sector.file = ldb_open(table, &k0, "r");
 			uint8_t k[LDB_KEY_LN];
-			k[0] = k0;
-			for (int k1 = 0; k1 < 256; k1++)
-				for (int k2 = 0; k2 < 256; k2++)
-					for (int k3 = 0; k3 < 256; k3++)
-					{
-						k[1] = k1;
-						k[2] = k2;
-						k[3] = k3;
-						/* Process records */
-						ldb_fetch_recordset(sector, table, k, true, ldb_csvprint, &hex_bytes);
-					}
-			free(sector);
+			ldb_sector_iterator_t it;
+			if (ldb_sector_iterator_init(&it, k0, sector.data, sector.file))
+			{
+				ldb_sector_iterator_key_order(&it);
+				while (ldb_sector_iterator_next(&it, k))
+					ldb_fetch_recordset_v2(&sector, table, k, true, ldb_csvprint, &hex_bytes);
+				ldb_sector_iterator_free(&it);
+			}
+			if (sector.file)
+				fclose(sector.file);
+			if (sector.data)
+			{
+				free(sector.data);
+				ldb_memory_release(sector.size);
+			}
 		}
 		if (sectorn >= 0) break;
 	} while (k0++ < 255);
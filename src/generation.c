@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/generation.c
+ *
+ * Sector generations
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file generation.c
+ * @date 18 October 2026
+ * @brief Generations of the sectors of a table, telling readers and caches when to reopen them.
+ *
+ * A sector is published when it is replaced (collate, overwrite import), erased, or written
+ * in place (import, incremental collate). Each publication increments the generation of the
+ * table and stamps the sectors published with it in the table manifest (LDB_GENERATION_NAME,
+ * in the table directory), a tab separated file replaced atomically:
+ *
+ *   generation <N>      generation of the table
+ *   <sector> <N>        generation that last published the sector
+ *
+ * A replaced sector is renamed over the old one, which stays readable by the readers that
+ * have it open: a reader keeps its snapshot until it reopens the sector. Readers and caches
+ * compare the generation they loaded with the manifest to know when to do so.
+ *
+ * Publications are serialized by an exclusive flock of the manifest, so processes writing
+ * the same table (an import and a collate) do not lose each other's updates.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "ldb.h"
+#include "logger.h"
+
+static void generation_path(struct ldb_table table, char *path)
+{
+	snprintf(path, LDB_MAX_PATH, "%s/%s/%s/%s", ldb_root, table.db, table.table, LDB_GENERATION_NAME);
+}
+
+/* Open the manifest locked, it may have been replaced while waiting for the lock */
+static int generation_open_locked(char *path)
+{
+	while (true)
+	{
+		int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return -1;
+		struct stat st, path_st;
+		if (flock(fd, LOCK_EX) || fstat(fd, &st))
+		{
+			close(fd);
+			return -1;
+		}
+		if (!stat(path, &path_st) && path_st.st_ino == st.st_ino)
+			return fd;
+		close(fd);
+	}
+}
+
+/* Load the manifest of a table: the table generation is returned, the sector ones go to "sectors" (optional) */
+static uint64_t generation_load(struct ldb_table table, uint64_t *sectors)
+{
+	if (sectors)
+		memset(sectors, 0, 256 * sizeof(uint64_t));
+
+	char path[LDB_MAX_PATH];
+	generation_path(table, path);
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+
+	uint64_t generation = 0, value;
+	unsigned int k;
+	char line[64];
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (sscanf(line, "generation\t%lu", &value) == 1)
+			generation = value;
+		else if (sectors && sscanf(line, "%x\t%lu", &k, &value) == 2 && k < 256)
+			sectors[k] = value;
+	}
+	fclose(fp);
+	return generation;
+}
+
+/**
+ * @brief Get the generation of a table
+ *
+ * @param table table
+ * @return generation, 0 if the table never published a sector
+ */
+uint64_t ldb_table_generation(struct ldb_table table)
+{
+	return generation_load(table, NULL);
+}
+
+/**
+ * @brief Get the generation that last published a sector
+ *
+ * @param table table
+ * @param k0 sector number
+ * @return generation, 0 if the sector was never published
+ */
+uint64_t ldb_sector_generation(struct ldb_table table, uint8_t k0)
+{
+	uint64_t sectors[256];
+	generation_load(table, sectors);
+	return sectors[k0];
+}
+
+/**
+ * @brief Check if a sector loaded by a reader is still the published one
+ *
+ * @param table table
+ * @param sector sector loaded with ldb_load_sector_v2
+ * @return false if the sector was published again since it was loaded
+ */
+bool ldb_sector_current(struct ldb_table table, ldb_sector_t *sector)
+{
+	return ldb_sector_generation(table, sector->id) == sector->generation;
+}
+
+/**
+ * @brief Publish a set of sectors: the table moves to a new generation, which stamps them
+ *
+ * @param table table
+ * @param published sectors published (256)
+ * @return new generation of the table, 0 if the manifest cannot be written
+ */
+uint64_t ldb_table_publish(struct ldb_table table, bool *published)
+{
+	char path[LDB_MAX_PATH];
+	char tmp_path[LDB_MAX_PATH + 4];
+	generation_path(table, path);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	int fd = generation_open_locked(path);
+	if (fd < 0)
+	{
+		log_info("Warning: cannot lock the manifest %s\n", path);
+		return 0;
+	}
+
+	uint64_t sectors[256];
+	uint64_t generation = generation_load(table, sectors) + 1;
+	for (int k = 0; k < 256; k++)
+		if (published[k])
+			sectors[k] = generation;
+
+	bool result = false;
+	FILE *fp = fopen(tmp_path, "w");
+	if (fp)
+	{
+		fprintf(fp, "generation\t%lu\n", generation);
+		for (int k = 0; k < 256; k++)
+			if (sectors[k])
+				fprintf(fp, "%02x\t%lu\n", k, sectors[k]);
+		result = !fflush(fp) && !fdatasync(fileno(fp));
+		result = !fclose(fp) && result && !rename(tmp_path, path);
+	}
+	close(fd);
+
+	if (!result)
+	{
+		log_info("Warning: cannot update the manifest %s\n", path);
+		return 0;
+	}
+	log_debug("%s/%s: generation %lu published\n", table.db, table.table, generation);
+	return generation;
+}
+
+/**
+ * @brief Publish a sector
+ *
+ * @param table table
+ * @param k0 sector number
+ * @return new generation of the table, 0 if the manifest cannot be written
+ */
+uint64_t ldb_sector_publish(struct ldb_table table, uint8_t k0)
+{
+	bool published[256] = {false};
+	published[k0] = true;
+	return ldb_table_publish(table, published);
+}
@@ -37,23 +37,50 @@
 #include "./ldb.h"
 #include "bsort.h"
 #include "join.h"
+#include "writeback.h"
 #include <pthread.h>
 #include <sys/sysinfo.h>
-#include "ignored.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include "wfp_ignore.h"
 #include <signal.h>
 #include "collate.h"
 #include "logger.h"
 #include "ldb_error.h"
 #include "decode.h"
+#include "stream.h"
+#include "pool.h"
+#include "memory.h"
+#include "journal.h"
+#include "manifest.h"
+#include "autotune.h"
+#include "csv.h"
 #include <stdatomic.h>
 #define REC_SIZE_LEN 2
-
-pthread_mutex_t lock;
+#define WFP_RAW_LN 21 // wfp crc32(3) + file md5(16) + line(2)
+#define WFP_REC_LN (WFP_RAW_LN - 3)
+#define WFP_NODE_HEADER_LN (LDB_KEY_LN + 2) // key + records, in the batches of the snippet importer
+#define WFP_BATCH_LN (16 * 1024 * 1024) // node batch handed to the sector writer
+#define DECODE_BLOCK_LINES 4096 // encrypted CSV lines read ahead and decoded per block
+#define DECODE_CHUNK_LINES 256 // lines per decode task
 
 int max_threads = 0;
-pthread_t * threads_list;
-static long IGNORED_WFP_LN = sizeof(IGNORED_WFP);
-double progress_timer = 0;
+static ldb_pool_t * import_pool = NULL;
+
+/* Last progress report (ms), the first thread to claim an interval reports it */
+static atomic_uint_fast64_t progress_timer = ATOMIC_VAR_INIT(0);
+
+/* Tables created (or checked) by this import, so each one is set up once */
+typedef struct import_table_t
+{
+	char name[LDB_MAX_NAME * 2];
+	pthread_mutex_t lock;
+	bool ready;
+	struct import_table_t * next;
+} import_table_t;
+
+static pthread_mutex_t import_tables_lock = PTHREAD_MUTEX_INITIALIZER;
+static import_table_t * import_tables = NULL;
 
 /* Thread error handling - using atomic for lock-free reads */
 atomic_bool thread_error_flag = ATOMIC_VAR_INIT(false);
@@ -176,13 +203,11 @@ void progress(char * path, char * table, size_t count, size_t max, bool percent)
 {
 	struct timeval t;
 	gettimeofday(&t, NULL);
-	double tmp = (double)(t.tv_usec) / 1000000 + (double)(t.tv_sec);
+	uint_fast64_t now = (uint_fast64_t) t.tv_sec * 1000 + t.tv_usec / 1000;
 	logger_basic(NULL);
-	if ((tmp - progress_timer) < 5)
+	uint_fast64_t last = atomic_load(&progress_timer);
+	if (now - last < 5000 || !atomic_compare_exchange_strong(&progress_timer, &last, now))
 		return;
-	pthread_mutex_lock(&lock);
-	progress_timer = tmp;
-	pthread_mutex_unlock(&lock);
 
 	if (percent)
 	{
@@ -197,14 +222,175 @@ void progress(char * path, char * table, size_t count, size_t max, bool percent)
 	//fflush(stdout);
 }
 
+/**
+ * @brief Create a table if it does not exist. Each table is set up once per import:
+ * jobs of the same table wait for its creation, other tables are not blocked
+ *
+ * @param dbname database name
+ * @param table table name
+ * @param key_ln key length
+ * @param rec_ln fixed record length (0 for variable)
+ * @param keys number of keys
+ * @param definitions table definitions
+ * @return true if the table was created by this call
+ */
+static bool import_table_create(char * dbname, char * table, int key_ln, int rec_ln, int keys, int definitions)
+{
+	char name[LDB_MAX_NAME * 2];
+	snprintf(name, sizeof(name), "%s/%s", dbname, table);
+
+	pthread_mutex_lock(&import_tables_lock);
+	import_table_t * entry = import_tables;
+	while (entry && strcmp(entry->name, name))
+		entry = entry->next;
+
+	if (!entry)
+	{
+		if (!ldb_database_exists(dbname))
+			ldb_create_database(dbname);
+
+		entry = calloc(1, sizeof(import_table_t));
+		strcpy(entry->name, name);
+		pthread_mutex_init(&entry->lock, NULL);
+		entry->next = import_tables;
+		import_tables = entry;
+	}
+	pthread_mutex_unlock(&import_tables_lock);
+
+	bool created = false;
+	pthread_mutex_lock(&entry->lock);
+	if (!entry->ready)
+	{
+		if (!ldb_table_exists(dbname, table))
+			created = ldb_create_table_new(dbname, table, key_ln, rec_ln, keys, definitions);
+		entry->ready = true;
+	}
+	pthread_mutex_unlock(&entry->lock);
+	return created;
+}
+
+/* Forget the tables set up by an import */
+static void import_tables_free(void)
+{
+	pthread_mutex_lock(&import_tables_lock);
+	while (import_tables)
+	{
+		import_table_t * next = import_tables->next;
+		pthread_mutex_destroy(&import_tables->lock);
+		free(import_tables);
+		import_tables = next;
+	}
+	pthread_mutex_unlock(&import_tables_lock);
+}
+
+/* Node batches handed from the snippet importer to its sector writer */
+typedef struct wfp_writer_t
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint8_t *batch[2];     // nodes: key(4) + records(2) + records * WFP_REC_LN
+	size_t batch_ln[2];
+	bool ready[2];         // batch waiting to be written
+	bool done;
+	int error;
+	bool pace_writes;
+	struct ldb_table table;
+	FILE *out;
+} wfp_writer_t;
+
+/* Write the nodes of a batch */
+static int wfp_write_batch(wfp_writer_t *w, uint8_t *batch, size_t ln)
+{
+	size_t ptr = 0;
+	while (ptr < ln)
+	{
+		uint8_t *key = batch + ptr;
+		uint16_t records = uint16_read(batch + ptr + LDB_KEY_LN);
+		uint32_t node_ln = records * WFP_REC_LN;
+
+		log_debug("Writing WFP node: key=%02x%02x%02x%02x, record_ln=%u, records=%u\n",
+			key[0], key[1], key[2], key[3], node_ln, records);
+		int error = ldb_node_write(w->table, w->out, key, key + WFP_NODE_HEADER_LN, node_ln, records);
+		if (error < 0)
+			return error;
+		ptr += WFP_NODE_HEADER_LN + node_ln;
+	}
+	return LDB_ERROR_NOERROR;
+}
+
+/* Sector writer thread: writes the batches in the order they are handed over */
+static void *wfp_writer(void *arg)
+{
+	wfp_writer_t *w = arg;
+	ldb_writeback_enable(w->pace_writes);
+
+	int current = 0;
+	pthread_mutex_lock(&w->lock);
+	while (true)
+	{
+		while (!w->ready[current] && !w->done)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (!w->ready[current])
+			break;
+
+		pthread_mutex_unlock(&w->lock);
+		int error = w->error ? w->error : wfp_write_batch(w, w->batch[current], w->batch_ln[current]);
+		pthread_mutex_lock(&w->lock);
+
+		w->error = error;
+		w->ready[current] = false;
+		pthread_cond_broadcast(&w->cond);
+		current ^= 1;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/**
+ * @brief Hand the current batch to the writer and wait for the other one to be free
+ *
+ * @param w writer
+ * @param current [in/out] batch being filled
+ * @return writer error
+ */
+static int wfp_writer_submit(wfp_writer_t *w, int *current)
+{
+	pthread_mutex_lock(&w->lock);
+	w->ready[*current] = true;
+	pthread_cond_broadcast(&w->cond);
+	*current ^= 1;
+	while (w->ready[*current])
+		pthread_cond_wait(&w->cond, &w->lock);
+	int error = w->error;
+	pthread_mutex_unlock(&w->lock);
+
+	w->batch_ln[*current] = 0;
+	return error;
+}
+
+/* Wait for the writer to finish the batches handed over */
+static int wfp_writer_finish(wfp_writer_t *w)
+{
+	pthread_mutex_lock(&w->lock);
+	w->done = true;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->cond);
+	return w->error;
+}
+
 /**
  * @brief Import a raw wfp file which simply contains a series of 21-byte records containing wfp(3)+md5(16)+line(2). While the wfp is 4 bytes,
  * the first byte is the file name
  *
- * @param db_name DB name
- * @param filename filename string
- * @param skip_delete true to avoid delete
- * @return true is succed
+ * The sorted file is mapped in memory. Nodes are assembled in batches which a writer thread
+ * writes into the sector while the next batch is being assembled.
+ *
+ * @param config import job
+ * @return LDB_ERROR_NOERROR on success
  */
 int ldb_import_snippets(ldb_importation_config_t * config)
 {
@@ -224,205 +410,180 @@ int ldb_import_snippets(ldb_importation_config_t * config)
 	int tick = 10000; // activate progress every "tick" records
 
 	/* raw record length = wfp crc32(3) + file md5(16) + line(2) = 21 bytes */
-	int raw_ln = 21;
+	int raw_ln = WFP_RAW_LN;
 
 	/* First three bytes are bytes 2nd-4th of the wfp) */
-	int rec_ln = raw_ln - 3;
+	int rec_ln = WFP_REC_LN;
 
 	/* First byte of the wfp is the file name */
 	uint8_t key1 = first_byte(config->csv_path);
 
 	/* File should contain 21 * N bytes */
-	if (ldb_file_size(config->csv_path) % 21)
+	if (totalbytes % raw_ln)
 	{
 		printf("File %s does not contain 21-byte records\n", config->csv_path);
 		exit(EXIT_FAILURE);
 	}
 
-	/* Load ignored wfps into boolean array */
-	bool *bl = calloc(256 * 256 * 256, 1);
-	for (int i = 0; i < IGNORED_WFP_LN; i += 4)
-		if (IGNORED_WFP[i] == key1)
-			bl[IGNORED_WFP[i + 1] + IGNORED_WFP[i + 2] * 256 + IGNORED_WFP[i + 3] * 256 * 256] = true;
-
-	FILE *in, *out;
-	out = NULL;
+	int fd = open(config->csv_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
 
-	in = fopen(config->csv_path, "rb");
-	if (in == NULL)
+	/* An empty file has nothing to import */
+	if (!totalbytes)
 	{
-		free(bl);
-		return -1;
+		close(fd);
+		return LDB_ERROR_NOERROR;
 	}
 
-	/* Lock DB */
-	char lock_file[LDB_MAX_PATH];
-	sprintf(lock_file, "%s.%s",oss_wfp.db,oss_wfp.table);
-	//ldb_lock(lock_file);
+	uint8_t *in = mmap(NULL, totalbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (in == MAP_FAILED)
+		return -1;
+	madvise(in, totalbytes, MADV_SEQUENTIAL);
 
-	uint64_t wfp_counter = 0;
-	uint64_t ignore_counter = 0;
+	/* Create table if it doesn't exist */
+	import_table_create(config->dbname, config->table, 4, rec_ln, 1, LDB_TABLE_DEFINITION_STANDARD);
 
 	/* We keep the last read key to group wfp records */
 	uint8_t last_wfp[4] = "\0\0\0\0";
-	uint8_t tmp_wfp[4] = "\0\0\0\0";
 	*last_wfp = key1;
-	*tmp_wfp = key1;
-
-	/* This will store the LDB record, which cannot be larger than 65535 md5s(16)+line(2) (>1Mb) */
-	uint8_t *record = malloc(256 * 256 * rec_ln);
-	uint32_t record_ln = 0;
 
-	/* The first byte of the wfp crc32(4) is the actual file name containing the records
-		 We'll read 50 million wfp at a time (making a buffer of about 1Gb) */
-	uint32_t buffer_ln = 50000000 * raw_ln;
-	uint8_t *buffer = malloc(buffer_ln);
+	/* Open ldb, preallocating the records to be imported */
+	wfp_writer_t writer = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER,
+		.table = oss_wfp, .pace_writes = ldb_writeback_enabled()};
+	writer.out = ldb_open(oss_wfp, last_wfp, "r+");
+	ldb_sector_preallocate(writer.out, totalbytes / raw_ln * rec_ln);
+	writer.batch[0] = ldb_pool_buffer(LDB_POOL_BUFFER_WFP_BATCH, WFP_BATCH_LN);
+	writer.batch[1] = ldb_pool_buffer(LDB_POOL_BUFFER_WFP_BATCH_NEXT, WFP_BATCH_LN);
 
-	/* Create table if it doesn't exist */
-	if (!ldb_table_exists(config->dbname, config->table))
-		ldb_create_table_new(config->dbname, config->table, 4, rec_ln, 1, LDB_TABLE_DEFINITION_STANDARD);
+	int error = LDB_ERROR_NOERROR;
+	if (!writer.out || !writer.batch[0] || !writer.batch[1] || pthread_create(&writer.thread, NULL, wfp_writer, &writer))
+	{
+		if (writer.out)
+			ldb_close_unlock(writer.out);
+		ldb_pool_buffer_release(writer.batch[0]);
+		ldb_pool_buffer_release(writer.batch[1]);
+		munmap(in, totalbytes);
+		return LDB_ERROR_MEM_NOMEM;
+	}
 
-	/* Open ldb */
-	out = ldb_open(oss_wfp, last_wfp, "r+");
+	uint64_t wfp_counter = 0;
+	uint64_t ignore_counter = 0;
 
-	bool first_read = true;
-	uint32_t bytes_read = 0;
-	int buffer_count = 0;
+	/* Node being assembled in the current batch */
+	int current = 0;
+	uint8_t *batch = writer.batch[current];
+	size_t node = 0;
+	uint32_t node_records = 0;
 
-	while ((bytes_read = fread(buffer, 1, buffer_ln, in)) > 0)
+	for (uint64_t i = 0; (i + raw_ln) <= totalbytes; i += raw_ln)
 	{
-		/* Check for thread error every 10 buffers (~10GB of data) - lock-free atomic read */
-		if (++buffer_count % 10 == 0 && check_thread_error()) {
+		uint8_t *wfp = in + i;
+		uint8_t *rec = in + i + 3;
+
+		/* Check for thread error every million records - lock-free atomic read */
+		if (!(i % (1000000 * raw_ln)) && check_thread_error())
+		{
 			log_info("Aborting WFP import due to thread error\n");
-			fclose(in);
-			free(record);
-			free(buffer);
-			free(bl);
-			if (out) ldb_close_unlock(out);
-			return LDB_ERROR_THREAD_ABORT;
+			error = LDB_ERROR_THREAD_ABORT;
+			break;
 		}
 
-		for (int i = 0; (i + raw_ln) <= bytes_read; i += raw_ln)
+		if (ldb_wfp_ignored(key1, wfp))
 		{
-			uint8_t *wfp = buffer + i;
-			uint8_t *rec = buffer + i + 3;
+			ignore_counter++;
+			continue;
+		}
 
-			if (bl[wfp[0] + wfp[1] * 256 + wfp[2] * 256 * 256])
-			{
-				ignore_counter++;
-				continue;
-			}
+		bool new_key = !node_records || !reverse_memcmp(last_wfp + 1, wfp, 3);
+		bool full_node = node_records >= 65535;
 
-			bool new_key = (!reverse_memcmp(last_wfp + 1, wfp, 3));
-			bool full_node = ((record_ln / rec_ln) >= 65535);
+		/* Do we have a new key, or is the node full? */
+		if (new_key || full_node)
+		{
+			/* Close the previous node */
+			if (node_records)
+				uint16_write(batch + node + LDB_KEY_LN, node_records);
 
-			/* Do we have a new key, or is the buffer full? */
-			if (new_key || full_node || first_read)
+			/* Hand the batch to the writer if a full node may not fit */
+			if (WFP_BATCH_LN - writer.batch_ln[current] < WFP_NODE_HEADER_LN + 65535 * WFP_REC_LN)
 			{
-				first_read = false;
-
-				/* If there is a buffer, write it */
-				if (record_ln)
-				{
-					log_debug("Writing WFP node: key=%02x%02x%02x%02x, record_ln=%u, records=%u\n",
-						last_wfp[0], last_wfp[1], last_wfp[2], last_wfp[3], record_ln, (uint16_t)(record_ln / rec_ln));
-					int error = ldb_node_write(oss_wfp, out, last_wfp, record, record_ln, (uint16_t)(record_ln / rec_ln));
-					//abort in case of error
-					if (error < 0) {
-						log_info("ERROR: Failed writing WFP at line %d, file: %s\n", __LINE__, config->csv_path);
-						fclose(in);
-						if (out) ldb_close_unlock(out);
-						free(record);
-						free(buffer);
-						free(bl);
-						return error;
-					}
-				}
-				wfp_counter++;
-
-				/* Initialize record */
-				memcpy(record, rec, rec_ln);
-				record_ln = rec_ln;
-
-				/* Save key */
-				memcpy(last_wfp + 1, wfp, 3);
+				if ((error = wfp_writer_submit(&writer, &current)) < 0)
+					break;
+				batch = writer.batch[current];
 			}
 
-			/* Add file id to existing record */
-			else
-			{
-				/* Skip duplicated records. Since md5 records to be imported are sorted, it will be faster
-					 to compare them from last to first byte. Also, we only compare the 16 byte md5 */
-				if (record_ln > 0)
-					if (!reverse_memcmp(record + record_ln - rec_ln, rec, 16))
-					{
-						memcpy(record + record_ln, rec, rec_ln);
-						record_ln += rec_ln;
-						wfp_counter++;
-					}
-			}
+			/* Start a new node with its key */
+			memcpy(last_wfp + 1, wfp, 3);
+			node = writer.batch_ln[current];
+			memcpy(batch + node, last_wfp, LDB_KEY_LN);
+			memcpy(batch + node + WFP_NODE_HEADER_LN, rec, rec_ln);
+			writer.batch_ln[current] += WFP_NODE_HEADER_LN + rec_ln;
+			node_records = 1;
+			wfp_counter++;
+		}
 
-			/* Update progress every "tick" records */
-			if (++reccounter > tick)
+		/* Add file id to existing node */
+		else
+		{
+			/* Skip duplicated records. Since md5 records to be imported are sorted, it will be faster
+				 to compare them from last to first byte. Also, we only compare the 16 byte md5 */
+			if (!reverse_memcmp(batch + writer.batch_ln[current] - rec_ln, rec, 16))
 			{
-				bytecounter += (rec_ln * reccounter);
-				progress(config->csv_path,config->table, bytecounter, totalbytes, true);
-				reccounter = 0;
+				memcpy(batch + writer.batch_ln[current], rec, rec_ln);
+				writer.batch_ln[current] += rec_ln;
+				node_records++;
+				wfp_counter++;
 			}
 		}
+
+		/* Update progress every "tick" records */
+		if (++reccounter > tick)
+		{
+			bytecounter += (rec_ln * reccounter);
+			progress(config->csv_path,config->table, bytecounter, totalbytes, true);
+			reccounter = 0;
+		}
 	}
-	log_info("%s: %'lu wfp imported, %'lu ignored\n", config->csv_path, wfp_counter, ignore_counter);
 
-	if (record_ln)
+	/* Hand over the last node */
+	if (error == LDB_ERROR_NOERROR && node_records)
 	{
-		log_debug("Final WFP write: key=%02x%02x%02x%02x, record_ln=%u, records=%u\n",
-			last_wfp[0], last_wfp[1], last_wfp[2], last_wfp[3], record_ln, (uint16_t)(record_ln / rec_ln));
-		int error = ldb_node_write(oss_wfp, out, last_wfp, record, record_ln, (uint16_t)(record_ln / rec_ln));
-		//abort in case of error
-		if (error < 0) {
-			log_info("ERROR: Failed final WFP write at line %d, file: %s\n", __LINE__, config->csv_path);
-			fclose(in);
-			if (out) ldb_close_unlock(out);
-			free(record);
-			free(buffer);
-			free(bl);
-			return error;
-		}
+		uint16_write(batch + node + LDB_KEY_LN, node_records);
+		error = wfp_writer_submit(&writer, &current);
 	}
 
-	if (out)
-		ldb_close_unlock(out);
+	int write_error = wfp_writer_finish(&writer);
+	if (error == LDB_ERROR_NOERROR)
+		error = write_error;
+
+	munmap(in, totalbytes);
+	ldb_pool_buffer_release(writer.batch[0]);
+	ldb_pool_buffer_release(writer.batch[1]);
+
+	if (error < 0)
+	{
+		if (error != LDB_ERROR_THREAD_ABORT)
+			log_info("ERROR: Failed writing WFP, file: %s\n", config->csv_path);
+		ldb_close_unlock(writer.out);
+		return error;
+	}
+
+	log_info("%s: %'lu wfp imported, %'lu ignored\n", config->csv_path, wfp_counter, ignore_counter);
+
+	ldb_sector_trim(writer.out);
+	ldb_close_unlock(writer.out);
 
-	fclose(in);
 	if (config->opt.params.delete_after_import)
 		unlink(config->csv_path);
 
-	free(record);
-	free(buffer);
-	free(bl);
-
 	if (config->opt.params.overwrite)
 		ldb_sector_update(oss_wfp, last_wfp);
+	else
+		ldb_sector_publish(oss_wfp, last_wfp[0]);
 
-	/* Lock DB */
-	//ldb_unlock(lock_file);
-
-	return 0;
-}
-
-/**
- * @brief Count number of comma delimited fields in data
- *
- * @param data pointer to data
- * @return int count
- */
-int csv_fields(char *data)
-{
-	int commas = 0;
-	while (*data)
-		if (*data++ == ',')
-			commas++;
-	return commas + 1;
+	return LDB_ERROR_NOERROR;
 }
 
 /**
@@ -530,10 +691,8 @@ int ldb_import_mz(ldb_importation_config_t * job)
 	char dest_path[LDB_MAX_PATH];
 	sprintf(dest_path, "%s/%s/%s/%s", ldb_root, job->dbname, job->table, basename(job->csv_path));
 	
-	if (!ldb_table_exists(job->dbname, job->table))
-		ldb_create_table_new(job->dbname, job->table, 16, 0, job->opt.params.keys_number, LDB_TABLE_DEFINITION_MZ |
-						(job->opt.params.binary_mode ? LDB_TABLE_DEFINITION_ENCRYPTED : LDB_TABLE_DEFINITION_STANDARD));
-	else
+	if (!import_table_create(job->dbname, job->table, 16, 0, job->opt.params.keys_number, LDB_TABLE_DEFINITION_MZ |
+						(job->opt.params.binary_mode ? LDB_TABLE_DEFINITION_ENCRYPTED : LDB_TABLE_DEFINITION_STANDARD)))
 	{
 			/* Create table structure for bulk import (32-bit key) */
 		char db_table[LDB_MAX_NAME];
@@ -551,6 +710,285 @@ int ldb_import_mz(ldb_importation_config_t * job)
 	return (ldb_bin_join(job->csv_path, dest_path, job->opt.params.overwrite, false, job->opt.params.delete_after_import));
 }
 
+/**
+ * @brief Close the CSV input, either a plain file or a stream
+ *
+ * @param fp input file
+ * @param stream stream, NULL for plain files
+ * @return 0 on success
+ */
+static int csv_input_close(FILE *fp, ldb_stream_t *stream)
+{
+	if (stream)
+		return ldb_stream_close(stream);
+
+	int fd = fileno(fp);
+	if (fclose(fp))
+	{
+		fprintf(stderr,"error closing %d\n", fd);
+		return -1;
+	}
+	return 0;
+}
+
+/* Block of encrypted CSV lines decoded by the decode workers */
+typedef struct decode_block_t
+{
+	char * text;               // lines as read, each one NUL terminated
+	size_t text_ln;
+	size_t text_size;
+	size_t * offset;           // offset of each line in text
+	ldb_csv_line_t * line;     // tokenized lines, their data is set when they are consumed
+	int * r_size;              // decoded record size, <= 0 if the line cannot be decoded
+	unsigned char * out;       // decoded records, MAX_CSV_LINE_LEN bytes per line
+	int lines;
+	int field;                 // csv field holding the encoded data
+	struct decode_chunk_t
+	{
+		struct decode_block_t * block;
+		int first;
+		int last;
+	} chunks[DECODE_BLOCK_LINES / DECODE_CHUNK_LINES];
+	int pending;               // decode tasks not finished
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+} decode_block_t;
+
+/* Line reader of the CSV importer. Encrypted files are read ahead in blocks and decoded
+in parallel while the previous block is assembled into nodes, keeping the line order */
+typedef struct csv_reader_t
+{
+	ldb_csv_reader_t input;
+	bool decoding;
+	decode_block_t block[2];
+	int current;               // block being consumed
+	int next;                  // next line of the current block
+} csv_reader_t;
+
+/* Decode workers, shared by the encrypted imports running at the same time */
+static ldb_pool_t * decode_pool = NULL;
+static pthread_mutex_t decode_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ldb_pool_t * decode_pool_get(void)
+{
+	pthread_mutex_lock(&decode_pool_lock);
+	if (!decode_pool)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		decode_pool = ldb_pool_create(cpus > 0 ? cpus : 1);
+	}
+	pthread_mutex_unlock(&decode_pool_lock);
+	return decode_pool;
+}
+
+/* Stop the decode workers when the import ends */
+static void decode_pool_destroy(void)
+{
+	pthread_mutex_lock(&decode_pool_lock);
+	if (decode_pool)
+		ldb_pool_destroy(decode_pool);
+	decode_pool = NULL;
+	pthread_mutex_unlock(&decode_pool_lock);
+}
+
+/* Decode the data field of a range of lines, as the importer would do inline */
+static void decode_lines(decode_block_t * block, int first, int last)
+{
+	for (int i = first; i < last; i++)
+	{
+		block->r_size[i] = -1;
+		ldb_csv_line_t line = block->line[i];
+		line.data = block->text + block->offset[i];
+		if (line.read > MAX_CSV_LINE_LEN)
+			continue;
+
+		char * data = ldb_csv_field(&line, block->field);
+		if (!data)
+			continue;
+
+		block->r_size[i] = decode(DECODE_BASE64, NULL, NULL, data, ldb_csv_field_ln(&line, block->field),
+			block->out + (size_t) i * MAX_CSV_LINE_LEN);
+	}
+}
+
+static void decode_chunk_done(decode_block_t * block)
+{
+	pthread_mutex_lock(&block->lock);
+	if (!--block->pending)
+		pthread_cond_signal(&block->done);
+	pthread_mutex_unlock(&block->lock);
+}
+
+static void decode_task(void * arg)
+{
+	struct decode_chunk_t * chunk = arg;
+	decode_lines(chunk->block, chunk->first, chunk->last);
+	decode_chunk_done(chunk->block);
+}
+
+/* Read the next block of lines and hand it to the decode workers */
+static void decode_block_start(csv_reader_t * reader, decode_block_t * block)
+{
+	block->lines = 0;
+	block->text_ln = 0;
+
+	ldb_csv_line_t * line;
+	while (block->lines < DECODE_BLOCK_LINES && ldb_csv_read(&reader->input, (line = &block->line[block->lines])))
+	{
+		if (block->text_ln + line->ln + 1 > block->text_size)
+		{
+			block->text_size = (block->text_ln + line->ln + 1) * 2;
+			block->text = realloc(block->text, block->text_size);
+		}
+		memcpy(block->text + block->text_ln, line->data, line->ln + 1);
+		block->offset[block->lines] = block->text_ln;
+		block->text_ln += line->ln + 1;
+		block->lines++;
+	}
+
+	int chunks = (block->lines + DECODE_CHUNK_LINES - 1) / DECODE_CHUNK_LINES;
+	block->pending = chunks;
+	ldb_pool_t * pool = decode_pool_get();
+	for (int c = 0; c < chunks; c++)
+	{
+		struct decode_chunk_t * chunk = &block->chunks[c];
+		chunk->block = block;
+		chunk->first = c * DECODE_CHUNK_LINES;
+		chunk->last = chunk->first + DECODE_CHUNK_LINES < block->lines ? chunk->first + DECODE_CHUNK_LINES : block->lines;
+
+		/* Decode in this thread if the task cannot be queued */
+		if (!pool || !ldb_pool_submit(pool, decode_task, chunk))
+			decode_task(chunk);
+	}
+}
+
+static void decode_block_wait(decode_block_t * block)
+{
+	pthread_mutex_lock(&block->lock);
+	while (block->pending)
+		pthread_cond_wait(&block->done, &block->lock);
+	pthread_mutex_unlock(&block->lock);
+}
+
+/**
+ * @brief Start reading a CSV input
+ *
+ * @param reader reader
+ * @param fp input
+ * @param field csv field to be decoded, 0 if the lines are not decoded
+ */
+static void csv_reader_open(csv_reader_t * reader, FILE * fp, int field)
+{
+	memset(reader, 0, sizeof(csv_reader_t));
+	ldb_csv_reader_init(&reader->input, fp);
+	reader->decoding = field > 0;
+	if (!reader->decoding)
+		return;
+
+	for (int b = 0; b < 2; b++)
+	{
+		decode_block_t * block = &reader->block[b];
+		block->field = field;
+		block->offset = malloc(DECODE_BLOCK_LINES * sizeof(size_t));
+		block->line = malloc(DECODE_BLOCK_LINES * sizeof(ldb_csv_line_t));
+		block->r_size = malloc(DECODE_BLOCK_LINES * sizeof(int));
+		block->out = malloc((size_t) DECODE_BLOCK_LINES * MAX_CSV_LINE_LEN);
+		pthread_mutex_init(&block->lock, NULL);
+		pthread_cond_init(&block->done, NULL);
+	}
+
+	decode_block_start(reader, &reader->block[0]);
+	if (reader->block[0].lines == DECODE_BLOCK_LINES)
+		decode_block_start(reader, &reader->block[1]);
+	decode_block_wait(&reader->block[0]);
+}
+
+/**
+ * @brief Read the next CSV line. The line is valid until the next call
+ *
+ * @param reader reader
+ * @param line [out] tokenized line
+ * @param r_size [out] decoded record size, when the reader decodes
+ * @param data_bin [out] decoded record, NULL if the reader does not decode
+ * @return false at the end of the input
+ */
+static bool csv_reader_next(csv_reader_t * reader, ldb_csv_line_t * line, int * r_size, unsigned char ** data_bin)
+{
+	*data_bin = NULL;
+	if (!reader->decoding)
+		return ldb_csv_read(&reader->input, line);
+
+	decode_block_t * block = &reader->block[reader->current];
+	if (reader->next == block->lines)
+	{
+		/* The block was the last one */
+		if (block->lines < DECODE_BLOCK_LINES)
+			return false;
+
+		/* Switch to the block read ahead and refill this one */
+		reader->current ^= 1;
+		reader->next = 0;
+		decode_block_t * consumed = block;
+		block = &reader->block[reader->current];
+		decode_block_wait(block);
+		if (block->lines == DECODE_BLOCK_LINES)
+			decode_block_start(reader, consumed);
+		else
+			consumed->lines = 0;
+
+		if (!block->lines)
+			return false;
+	}
+
+	int i = reader->next++;
+	*line = block->line[i];
+	line->data = block->text + block->offset[i];
+	*r_size = block->r_size[i];
+	*data_bin = block->out + (size_t) i * MAX_CSV_LINE_LEN;
+	return true;
+}
+
+/* Release the reader, waiting for the decode tasks still running */
+static void csv_reader_close(csv_reader_t * reader)
+{
+	ldb_csv_reader_free(&reader->input);
+	if (!reader->decoding)
+		return;
+
+	for (int b = 0; b < 2; b++)
+	{
+		decode_block_t * block = &reader->block[b];
+		decode_block_wait(block);
+		free(block->text);
+		free(block->offset);
+		free(block->line);
+		free(block->r_size);
+		free(block->out);
+		pthread_mutex_destroy(&block->lock);
+		pthread_cond_destroy(&block->done);
+	}
+}
+
+/**
+ * @brief Open a sector for import. The first sector opened by a job gets the expected
+ * size of the imported data preallocated.
+ *
+ * @param table table
+ * @param key key of the sector
+ * @param expected [in/out] expected size of the data, zeroed once preallocated
+ * @return sector file
+ */
+static FILE *import_sector_open(struct ldb_table table, uint8_t *key, uint64_t *expected)
+{
+	FILE *sector = ldb_open(table, key, "r+");
+	if (sector && *expected)
+	{
+		ldb_sector_preallocate(sector, *expected);
+		*expected = 0;
+	}
+	return sector;
+}
+
 /**
  * @brief Import a CSV file into the LDB database
  *
@@ -565,7 +1003,8 @@ int ldb_import_csv(ldb_importation_config_t * job)
 	bool bin_mode = false;
 	bool is_compressed = false;
 	bool skip_csv_check = !job->opt.params.validate_fields;
-	bool sectors_modified[256] = {false};
+	bool *sectors_modified = job->sectors;
+	memset(sectors_modified, 0, sizeof(job->sectors));
 	if (job->opt.params.binary_mode || strstr(job->csv_path, ".enc"))
 	{
 		bin_mode = true;
@@ -574,7 +1013,22 @@ int ldb_import_csv(ldb_importation_config_t * job)
 			is_compressed = true;
 	}
 
-	FILE *fp = fopen(job->csv_path, "r");
+	/* Compressed files and stdin are decoded (and sorted) on the fly by a pipeline thread */
+	ldb_stream_t *stream = NULL;
+	FILE *fp = NULL;
+	if (ldb_stream_is_stream(job->csv_path))
+	{
+		stream = ldb_stream_open(job->csv_path, job->opt.params.sort, job->opt.params.tmp_path);
+		if (stream)
+			fp = stream->fp;
+	}
+	else
+	{
+		/* Sort before opening: csv_sort replaces the file */
+		csv_sort(job);
+		fp = fopen(job->csv_path, "r");
+	}
+
 	if (fp == NULL)
 	{
 		log_info("File does not exist %s\n", job->csv_path);
@@ -589,7 +1043,7 @@ int ldb_import_csv(ldb_importation_config_t * job)
 
 	uint8_t *itemid = calloc(MD5_LEN, 1);
 	uint8_t *field2 = calloc(MD5_LEN, 1);
-	uint8_t *item_buf = malloc(LDB_MAX_NODE_LN);
+	uint8_t *item_buf = ldb_pool_buffer(LDB_POOL_BUFFER_ITEM, LDB_MAX_NODE_LN);
 	uint8_t *item_lastid = calloc(MD5_LEN * 2 + 1, 1);
 	uint16_t item_ptr = 0;
 	FILE *item_sector = NULL;
@@ -603,7 +1057,7 @@ int ldb_import_csv(ldb_importation_config_t * job)
 	uint32_t skipped = 0;
 	uint32_t skipped_invalid = 0;
 
-	uint64_t totalbytes = ldb_file_size(job->csv_path);
+	uint64_t totalbytes = stream ? stream->total : ldb_file_size(job->csv_path);
 	size_t bytecounter = 0;
 
 	/* Get 1st byte of the item ID from csv filename (if available) */
@@ -613,10 +1067,9 @@ int ldb_import_csv(ldb_importation_config_t * job)
 		got_1st_byte = true;
 	ldb_hex_to_bin(basename(job->csv_path), 2, &first_byte);
 
-	/* Create table if it doesn't exist */
-	pthread_mutex_lock(&lock);
-	if (!ldb_database_exists(job->dbname))
-		ldb_create_database(job->dbname);
+	/* A sector CSV file is imported into a single sector, its binary form is smaller than the text */
+	uint64_t preallocate = got_1st_byte && !stream ? totalbytes : 0;
+	bool preallocated = preallocate > 0;
 
 	int table_definitions = LDB_TABLE_DEFINITION_STANDARD;
 
@@ -624,9 +1077,9 @@ int ldb_import_csv(ldb_importation_config_t * job)
 		table_definitions |= LDB_TABLE_DEFINITION_ENCRYPTED;
 	if (is_compressed)
 		table_definitions |= LDB_TABLE_DEFINITION_COMPRESSED;
-	if (!ldb_table_exists(job->dbname, job->table))
-		ldb_create_table_new(job->dbname, job->table, 16, 0, job->opt.params.keys_number, table_definitions);
-	pthread_mutex_unlock(&lock);
+
+	/* Create table if it doesn't exist */
+	import_table_create(job->dbname, job->table, 16, 0, job->opt.params.keys_number, table_definitions);
 
 	/* Create table structure for bulk import (32-bit key) */
 	char db_table[LDB_MAX_NAME];
@@ -643,7 +1096,7 @@ int ldb_import_csv(ldb_importation_config_t * job)
 	{
 		log_info("The existent table definitions do not match with the table being imported, the file %s will be skipped.\nVerify %s.cfg file and try again\n",
 		job->csv_path, job->table);
-		fclose(fp);
+		csv_input_close(fp, stream);
 		return LDB_ERROR_CSV_WRONG_ENCODING;
 	}
 /* NOTE: the ldb table MUST BE written with key_ln = 4, and read with key_ln=16. ODO: IMPROVE IT, is this a bug?*/
@@ -660,25 +1113,36 @@ int ldb_import_csv(ldb_importation_config_t * job)
 	sprintf(lock_file, "%s.%s",oss_bulk.db,oss_bulk.table);
 	//ldb_lock(lock_file);
 	
-	/*sort the csv*/
-	csv_sort(job);
+	/* Encrypted data is decoded by the decode workers, ahead of the node assembly */
+	int decode_field = 0;
+	if (bin_mode && decode)
+		decode_field = oss_bulk.keys > 1 ? (job->opt.params.csv_fields > 2 ? 3 : 0) : 2;
+	csv_reader_t reader;
+	csv_reader_open(&reader, fp, decode_field);
+
 	int line_number = 0;
 	bool first_record = true;
+	ldb_csv_line_t csv;
 	char *line = NULL;
-	size_t len = 0;
 	ssize_t lineln;
-	while ((lineln = getline(&line, &len, fp)) != -1)
+	int decoded_size = 0;
+	unsigned char *decoded_bin = NULL;
+	while (csv_reader_next(&reader, &csv, &decoded_size, &decoded_bin))
 	{
+		/* The line is tokenized: its length includes the LF, as read */
+		line = csv.data;
+		lineln = csv.read;
+
 		/* Check for thread error and excessive skipped lines every 10000 lines - lock-free atomic read */
 		if (line_number % 10000 == 0)
 		{
 			if (check_thread_error())
 			{
 				log_info("Aborting CSV import at line %d due to thread error\n", line_number);
-				fclose(fp);
-				if (line) free(line);
+				csv_reader_close(&reader);
+				csv_input_close(fp, stream);
 				free(itemid);
-				free(item_buf);
+				ldb_pool_buffer_release(item_buf);
 				free(item_lastid);
 				free(field2);
 				if (item_sector) ldb_close_unlock(item_sector);
@@ -688,10 +1152,10 @@ int ldb_import_csv(ldb_importation_config_t * job)
 			if (skipped_invalid > line_number / 2)
 			{
 				log_info("Aborting %s import at line %d due to excessive number of skipped lines\n", job->csv_path,line_number);
-				fclose(fp);
-				if (line) free(line);
+				csv_reader_close(&reader);
+				csv_input_close(fp, stream);
 				free(itemid);
-				free(item_buf);
+				ldb_pool_buffer_release(item_buf);
 				free(item_lastid);
 				free(field2);
 				if (item_sector) ldb_close_unlock(item_sector);
@@ -716,20 +1180,26 @@ int ldb_import_csv(ldb_importation_config_t * job)
 			continue;			
 		}
 		//skip keys with the incorrect lenght.
-		char * first_comma = strchr(line, ',');
-		if (!first_comma)
+		if (csv.fields < 2)
 		{
 			log_debug("%s: Line %d -- Skipped, wrong csv format on line %s .\n", job->csv_path, line_number, line);
 			skipped_invalid++;
 			continue;
 		}
-		int key_len = first_comma - line;
+		int key_len = ldb_csv_field_ln(&csv, 1);
 		if (key_len != MD5_LEN_HEX && key_len != MD5_LEN_HEX - 2)
 		{
 			log_debug("%s: Line %d -- Skipped, %d Incorrect key lenght.\n", job->csv_path, line_number, key_len);
 			skipped_invalid++;
 			continue;
 		}
+		if (!ldb_csv_hex(line, key_len) || (oss_bulk.keys > 1 &&
+			(ldb_csv_field_ln(&csv, 2) != MD5_LEN_HEX || !ldb_csv_hex(ldb_csv_field(&csv, 2), MD5_LEN_HEX))))
+		{
+			log_debug("%s: Line %d -- Skipped, invalid key.\n", job->csv_path, line_number);
+			skipped_invalid++;
+			continue;
+		}
 		/* Skip records with sizes out of range */
 		if (lineln > MAX_CSV_LINE_LEN || lineln < min_line_size)
 		{
@@ -750,11 +1220,6 @@ int ldb_import_csv(ldb_importation_config_t * job)
 			}
 		}
 
-		/* Trim trailing chr(10) */
-		if (line[lineln - 1] == 10)
-			lineln--;
-		line[lineln] = 0;
-
 		/* Check if this ID is the same as last */
 		bool dup_id = false;
 		if (!memcmp(last_id, line, MD5_LEN * 2 - 2)) //compare 30 chars of the md5
@@ -763,7 +1228,7 @@ int ldb_import_csv(ldb_importation_config_t * job)
 			memcpy(last_id, line, MD5_LEN * 2 - 2); //copy 30 chars of the md5
 
 		/* First CSV field is the data key. Data starts with the second CSV field */
-		char *data = field_n(2, line);
+		char *data = ldb_csv_field(&csv, 2);
 
 		if (!data)
 		{
@@ -789,7 +1254,7 @@ int ldb_import_csv(ldb_importation_config_t * job)
 			
 			if (job->opt.params.csv_fields > 2)
 			{
-				data = field_n(3, line);
+				data = ldb_csv_field(&csv, 3);
 				if (!data)
 				{
 					log_debug("%s: Error in line: %d, data is missing -- %s Skipped\n", job->csv_path, line_number, line);
@@ -804,11 +1269,23 @@ int ldb_import_csv(ldb_importation_config_t * job)
 		/* Calculate record size */
 		int r_size = 0;
 		unsigned char data_bin[MAX_CSV_LINE_LEN];
+		unsigned char *record_bin = data_bin;
 		if (data)
 		{
 			if (bin_mode)
 			{	
-				if (decode)
+				if (decoded_bin)
+				{
+					r_size = decoded_size;
+					record_bin = decoded_bin;
+					if (r_size <= 0)
+					{
+						log_debug("Error: failed to decode line %s. Skipping\n", line);
+						skipped_invalid++;
+						continue;
+					}
+				}
+				else if (decode)
 				{
 					r_size = decode(DECODE_BASE64,NULL, NULL, data, strlen(data), data_bin);
 					if (r_size <= 0)
@@ -823,10 +1300,10 @@ int ldb_import_csv(ldb_importation_config_t * job)
 			else
 			{
 				/* Calculate record size */
-				r_size = strlen(data);
+				r_size = csv.ln - (data - line);
 			}
 			/* Check if number of fields matches the expectation */
-			if (!skip_csv_check && (csv_fields(line) != job->opt.params.csv_fields))
+			if (!skip_csv_check && (csv.fields != job->opt.params.csv_fields))
 			{
 				log_debug("%s: Line %d -- Skipped, Missing CSV fields. Expected: %d.\n",job->csv_path, line_number, job->opt.params.csv_fields);
 				skipped_invalid++;
@@ -860,7 +1337,7 @@ int ldb_import_csv(ldb_importation_config_t * job)
 				{
 					if (!item_sector)
 					{
-						item_sector = ldb_open(oss_bulk, item_lastid, "r+");
+						item_sector = import_sector_open(oss_bulk, item_lastid, &preallocate);
 						sectors_modified[item_lastid[0]] = true;
 					}
 					else
@@ -875,10 +1352,10 @@ int ldb_import_csv(ldb_importation_config_t * job)
 							log_info("  Last processed line content: %s\n", line);
 							log_info("  Key: %02x%02x%02x%02x, Buffer ptr: %u\n",
 								item_lastid[0], item_lastid[1], item_lastid[2], item_lastid[3], item_ptr);
-							fclose(fp);
-							if (line) free(line);
+							csv_reader_close(&reader);
+							csv_input_close(fp, stream);
 							free(itemid);
-							free(item_buf);
+							ldb_pool_buffer_release(item_buf);
 							free(item_lastid);
 							free(field2);
 							if (item_sector) ldb_close_unlock(item_sector);
@@ -891,7 +1368,7 @@ int ldb_import_csv(ldb_importation_config_t * job)
 				{
 					if (item_sector)
 						ldb_close_unlock(item_sector);
-					item_sector = ldb_open(oss_bulk, itemid, "r+");
+					item_sector = import_sector_open(oss_bulk, itemid, &preallocate);
 					sectors_modified[itemid[0]] = true;
 				}
 
@@ -939,13 +1416,16 @@ int ldb_import_csv(ldb_importation_config_t * job)
 				if (!bin_mode)
 					memcpy(item_buf + item_ptr, data, r_size);
 				else
-					memcpy(item_buf + item_ptr, data_bin, r_size);
+					memcpy(item_buf + item_ptr, record_bin, r_size);
 				item_ptr += r_size;
 				item_rg_size += r_size;
 			}
 			imported++;
 		}
-		progress(job->csv_path, job->table, bytecounter, totalbytes, true);
+		if (stream)
+			progress(job->csv_path, job->table, ldb_stream_consumed(stream), totalbytes, totalbytes > 0);
+		else
+			progress(job->csv_path, job->table, bytecounter, totalbytes, true);
 	}
 
 	/* Flush buffer */
@@ -956,7 +1436,7 @@ int ldb_import_csv(ldb_importation_config_t * job)
 	{
 		if (!item_sector)
 		{
-			item_sector = ldb_open(oss_bulk, itemid, "r+");
+			item_sector = import_sector_open(oss_bulk, itemid, &preallocate);
 			sectors_modified[itemid[0]] = true;
 		}
 		
@@ -973,12 +1453,10 @@ int ldb_import_csv(ldb_importation_config_t * job)
 			fprintf(stderr, "Buffer size: %u bytes\n", item_ptr);
 			fprintf(stderr, "Error code: %d\n", error);
 			fprintf(stderr, "=================================\n");
-			int fd = fileno(fp);
-			if (fclose(fp))
-				fprintf(stderr,"error closing %d\n", fd);
-			if (line) free(line);
+			csv_reader_close(&reader);
+			csv_input_close(fp, stream);
 			free(itemid);
-			free(item_buf);
+			ldb_pool_buffer_release(item_buf);
 			free(item_lastid);
 			free(field2);
 			if (item_sector) ldb_close_unlock(item_sector);
@@ -987,27 +1465,33 @@ int ldb_import_csv(ldb_importation_config_t * job)
 	}
 	
 	if (item_sector)
+	{
+		if (preallocated)
+			ldb_sector_trim(item_sector);
 		ldb_close_unlock(item_sector);
+	}
 
 	log_info("%s: %u records imported, %u skipped\n", job->csv_path, imported, skipped+skipped_invalid);
 
-	int fd = fileno(fp);
-	if (fclose(fp))
-		fprintf(stderr,"error closing %d\n", fd);
+	csv_reader_close(&reader);
+	int result = LDB_ERROR_NOERROR;
+	if (csv_input_close(fp, stream))
+	{
+		log_info("%s: input stream could not be fully decoded\n", job->csv_path);
+		result = LDB_ERROR_STREAM_DECODE;
+	}
 	
-	if (job->opt.params.delete_after_import)
+	if (job->opt.params.delete_after_import && result == LDB_ERROR_NOERROR && strcmp(job->csv_path, LDB_STREAM_STDIN))
 		unlink(job->csv_path);
 
-	if (line)
-		free(line);
-
 	free(itemid);
-	free(item_buf);
+	ldb_pool_buffer_release(item_buf);
 	free(item_lastid);
 	free(field2);
 
 	
-	if (job->opt.params.overwrite)
+	/* A truncated stream must not replace the existing sectors */
+	if (job->opt.params.overwrite && result == LDB_ERROR_NOERROR)
 	{
 		for (int i=0; i < 256; i++)
 		{
@@ -1020,9 +1504,12 @@ int ldb_import_csv(ldb_importation_config_t * job)
 		}
 
 	}
+	/* Appended data is visible at once, even if the stream was truncated */
+	else if (!job->opt.params.overwrite)
+		ldb_table_publish(oss_bulk, sectors_modified);
 	/* Lock DB */
 //	ldb_unlock(lock_file);
-	return LDB_ERROR_NOERROR;
+	return result;
 }
 
 /**
@@ -1231,6 +1718,10 @@ const char * config_parameters[] = {
 									"COLLATE",
 									"MAX_RECORD",
 									"MAX_RAM_PERCENT",
+									"INCREMENTAL",
+									"PACE_WRITES",
+									"MIN_THREADS",
+									"MAX_THREADS",
 									"TMP_PATH",
 									};
 
@@ -1249,7 +1740,11 @@ const char * config_parameters[] = {
 										.threads = get_nprocs() / 2,\
 										.collate = 0,\
 										.collate_max_rec = 1024,\
-										.collate_max_ram_percent = 50}
+										.collate_max_ram_percent = 50,\
+										.incremental = 0,\
+										.pace_writes = 0,\
+										.min_threads = 1,\
+										.max_threads = 0}
 
 #define LDB_IMPORTATION_CONFIG_UNDEFINED {.delete_after_import = -1,\
 										.keys_number = -1,\
@@ -1265,7 +1760,11 @@ const char * config_parameters[] = {
 										.threads = -1,\
 										.collate = -1,\
 										.collate_max_rec = -1,\
-										.collate_max_ram_percent = 50}
+										.collate_max_ram_percent = 50,\
+										.incremental = -1,\
+										.pace_writes = -1,\
+										.min_threads = -1,\
+										.max_threads = -1}
 
 bool ldb_importation_config_parse(import_params_t * opt, char * line)
 {
@@ -1291,11 +1790,20 @@ bool ldb_importation_config_parse(import_params_t * opt, char * line)
 
 	for (int i = 0; i < CONFIG_PARAMETERS_NUMBER; i++)
 	{
-		char * param = strstr(normalized, config_parameters[i]);
+		/* A name can be part of another one (THREADS in MAX_THREADS): find the whole name,
+		   the previous char must be a comma or a parentesis and the next one an equal sign */
+		size_t name_ln = strlen(config_parameters[i]);
+		char * param = normalized;
+		while ((param = strstr(param, config_parameters[i])))
+		{
+			if (param > normalized && (*(param-1) == ',' || *(param-1) == '(') && param[name_ln] == '=')
+				break;
+			param++;
+		}
 		int val = 0;
-		if (!param || !(*(param-1) == ',' || *(param-1) == '(')) //the previous char must be a comma or a parentesis
+		if (!param)
 			continue;
-		param = strchr(param,'=');
+		param += name_ln;
 		
 		if (!strcmp(config_parameters[i], "TMP_PATH"))
 		{
@@ -1460,133 +1968,53 @@ static int load_import_config(ldb_importation_config_t * config, import_params_t
 		return -1;
 }
 
-/* Helper function to get memory stats from /proc/meminfo */
-static bool get_memory_stats(unsigned long *total_kb, unsigned long *available_kb, unsigned long *free_kb)
+/**
+ * @brief Read one import option of a table from the configuration of its database, for
+ * commands other than import. The table line overrides the GLOBAL one. The rest of the
+ * configuration is not validated.
+ *
+ * @param dbname database name
+ * @param table table name
+ * @param name option name (as in config_parameters)
+ * @param def value if the option is not configured, or if the configuration cannot be read
+ * @return option value
+ */
+int ldb_import_table_option(char *dbname, char *table, const char *name, int def)
 {
-	FILE* file = fopen("/proc/meminfo", "r");
-	if (file == NULL) {
-		perror("Error opening /proc/meminfo");
-		return false;
-	}
+	int option = -1;
+	for (int i = 0; i < CONFIG_PARAMETERS_NUMBER; i++)
+		if (!strcmp(config_parameters[i], name))
+			option = i;
 
-	char line[256];
-	*total_kb = 0;
-	*available_kb = 0;
-	*free_kb = 0;
+	char config_path[LDB_MAX_PATH];
+	snprintf(config_path, sizeof(config_path), "%s%s.conf", LDB_CFG_PATH, dbname);
+	FILE *cfg = option < 0 ? NULL : fopen(config_path, "r");
+	if (!cfg)
+		return def;
 
-	while (fgets(line, sizeof(line), file)) {
-		if (sscanf(line, "MemTotal: %lu", total_kb) == 1)
+	int value = def;
+	char *line = NULL;
+	size_t len = 0;
+	while (getline(&line, &len, cfg) != -1)
+	{
+		char *separator = strchr(line, ':');
+		if (!separator)
 			continue;
-		if (sscanf(line, "MemFree: %lu", free_kb) == 1)
+		*separator = 0;
+		bool global = !strcmp(line, "GLOBAL");
+		if (!global && strcmp(line, table))
 			continue;
-		if (sscanf(line, "MemAvailable: %lu", available_kb) == 1)
-			break;
-	}
-	fclose(file);
-
-	return (*total_kb > 0 && *available_kb > 0);
-}
-
-/* Check if there's enough RAM available for launching new threads */
-static bool check_memory_for_threading(int collate_max_ram_percent)
-{
-	unsigned long totalMemory, availableMemory, freeMemory;
-
-	if (!get_memory_stats(&totalMemory, &availableMemory, &freeMemory))
-		return true; // Cannot read, proceed anyway
-
-	if (collate_max_ram_percent <= 0 || collate_max_ram_percent > 100)
-		collate_max_ram_percent = 50;
-
-	/* Calculate minimum threshold based on policy */
-	unsigned long min_available_kb = (totalMemory * (100 - collate_max_ram_percent)) / 100;
-
-	/* Add safety buffer: require 500 MB more than threshold before launching threads */
-	unsigned long safety_buffer_kb = 500 * 1024; // 500 MB
-	unsigned long required_available_kb = min_available_kb + safety_buffer_kb;
-
-	if (availableMemory < required_available_kb) {
-		log_info("Memory throttling: Available RAM (%lu MB) below safe threshold (%lu MB + 500 MB buffer). Pausing thread creation...\n",
-		         availableMemory / 1024, min_available_kb / 1024);
-		return false;
-	}
 
-	return true;
-}
-
-static bool check_system_available_ram(struct ldb_table kb, uint8_t sector, int collate_max_ram_percent)
-{
-	unsigned long totalMemory, availableMemory, freeMemory;
-
-	if (!get_memory_stats(&totalMemory, &availableMemory, &freeMemory))
-		return false;
-
-	if (collate_max_ram_percent <= 0 || collate_max_ram_percent > 100)
-		collate_max_ram_percent = 50;
-
-	/* Get sector size on disk */
-	char * path = ldb_sector_path(kb, &sector, "r");
-	if (!path)
-	{
-		log_info("Failed to get path for sector %02x\n", sector);
-		return false;
-	}
-	uint64_t sector_size_kb = ldb_file_size(path) / 1024;
-	free(path);
-
-	/* Calculate memory requirements:
-	 * - sector_size_kb: the actual sector data
-	 * - collate_buffers: data + tmp_data buffers (~110 MB each thread)
-	 * - safety_margin: 20% overhead for OS and other allocations
-	 */
-	const unsigned long collate_buffers_kb = 120 * 1024; // ~120 MB buffers
-	unsigned long required_memory_kb = sector_size_kb + collate_buffers_kb;
-	unsigned long required_with_margin_kb = (required_memory_kb * 120) / 100; // 20% safety margin
-
-	/* Calculate thresholds based on RAM percentage policy:
-	 * We use availableMemory (not free) as it includes reclaimable cache
-	 */
-	unsigned long min_available_threshold_kb = (totalMemory * (100 - collate_max_ram_percent)) / 100;
-
-	log_info("RAM Check - Sector %02x: size=%lu MB, required=%lu MB (with margin), available=%lu MB, threshold=%lu MB\n",
-	         sector, sector_size_kb / 1024, required_with_margin_kb / 1024,
-	         availableMemory / 1024, min_available_threshold_kb / 1024);
-
-	/* Decision logic:
-	 * 1. Must have enough available memory for the sector + buffers + margin
-	 * 2. Must maintain minimum available RAM threshold after allocation
-	 * 3. Sector size should be reasonable (< 90% of available memory)
-	 */
-
-	/* Check 1: Is there enough memory for this sector? */
-	if (availableMemory < required_with_margin_kb)
-	{
-		log_info("Sector %02x too large for available RAM (%lu MB required > %lu MB available). Using disk mode.\n",
-		         sector, required_with_margin_kb / 1024, availableMemory / 1024);
-		return false;
-	}
-
-	/* Check 2: Would loading this sector violate our RAM policy threshold? */
-	unsigned long remaining_after_load_kb = availableMemory - required_memory_kb;
-	if (remaining_after_load_kb < min_available_threshold_kb)
-	{
-		log_info("Sector %02x would exceed RAM policy (%lu%% limit). Remaining after load: %lu MB < threshold: %lu MB. Using disk mode.\n",
-		         sector, collate_max_ram_percent, remaining_after_load_kb / 1024, min_available_threshold_kb / 1024);
-		return false;
-	}
-
-	/* Check 3: Sanity check - sector shouldn't consume > 90% of available RAM */
-	unsigned long max_sector_size_kb = (availableMemory * 90) / 100;
-	if (sector_size_kb > max_sector_size_kb)
-	{
-		log_info("Sector %02x extremely large (%lu MB > 90%% of available %lu MB). Using disk mode for safety.\n",
-		         sector, sector_size_kb / 1024, availableMemory / 1024);
-		return false;
+		import_params_t opt = {.params = LDB_IMPORTATION_CONFIG_UNDEFINED};
+		ldb_importation_config_parse(&opt, separator + 1);
+		if (opt.params_arr[option] > -1)
+			value = opt.params_arr[option];
+		if (!global)
+			break;
 	}
-
-	log_info("Sector %02x will be loaded in RAM (%lu MB). Available after load: ~%lu MB\n",
-	         sector, sector_size_kb / 1024, remaining_after_load_kb / 1024);
-	return true;
+	free(line);
+	fclose(cfg);
+	return value;
 }
 
 int import_collate_sector(ldb_importation_config_t *config)
@@ -1628,6 +2056,14 @@ int import_collate_sector(ldb_importation_config_t *config)
 
 		logger_basic("Collating - %s", dbtable);
 
+		/* A whole table CSV only needs its written sectors collated */
+		if (sector_number < 0 && !config->opt.params.is_mz_table && !config->opt.params.is_wfp_table)
+		{
+			log_info("Collating table %s - written sectors, Max record size: %d\n", dbtable, max_rec_len);
+			ldb_collate_sectors(ldbtable, tmptable, max_rec_len, false, config->sectors, 1, NULL);
+			return 0;
+		}
+
 		if (sector_number < 0)
 		{
 			log_info("Collating table %s - all sectors, Max record size: %d\n", dbtable, sector_number, max_rec_len);
@@ -1643,7 +2079,7 @@ int import_collate_sector(ldb_importation_config_t *config)
 		}
 		else if (sector_number >= 0)
 		{
-			pthread_mutex_lock(&lock);
+			/* The collate buffers were reserved with the job, the sector is loaded in RAM only if it fits in the memory budget */
 			struct ldb_collate_data collate;
 			uint8_t k0 = sector_number;
 			//uint8_t *sector_mem = NULL;
@@ -1653,11 +2089,9 @@ int import_collate_sector(ldb_importation_config_t *config)
 			if (!init_ok)
 				log_info("Collate init failed for sector %d\n", k0);
 
-			if (init_ok && check_system_available_ram(ldbtable, k0, config->opt.params.collate_max_ram_percent))
-				//sector_mem = ldb_load_sector(ldbtable, &k0);
-				sector = ldb_load_sector_v2(ldbtable, &k0);
+			if (init_ok)
+				sector = ldb_collate_load_sector(ldbtable, k0);
 
-			pthread_mutex_unlock(&lock);
 			if (init_ok)
 				ldb_collate_sector(&collate, &sector);
 			else
@@ -1691,14 +2125,15 @@ int ldb_import(ldb_importation_config_t * job)
 	else
 		config.opt.params.is_wfp_table = false;
 
-	if (config.opt.params.binary_mode)
+	if (ldb_stream_is_stream(config.csv_path) && (config.opt.params.is_mz_table || config.opt.params.is_wfp_table))
 	{
-		pthread_mutex_lock(&lock);
-		if(!decode)
-			ldb_decoder_lib_load();
-		pthread_mutex_unlock(&lock);
+		log_info("%s: streaming import is only supported for csv files\n", config.csv_path);
+		return LDB_ERROR_STREAM_UNSUPPORTED;
 	}
 
+	if (config.opt.params.binary_mode)
+		ldb_decoder_lib_load();
+
 	if (config.opt.params.tmp_path[0] == '\0')
 	{
 		sprintf(config.opt.params.tmp_path, DEFAULT_TMP_PATH);
@@ -1845,8 +2280,6 @@ static void recurse_directory(struct ldb_importation_jobs_s * jobs, char *name,
 }
 
 
-volatile int num_threads = 0;
-
 /* Set thread error flag and message */
 void set_thread_error(int error_code, const char *format, ...) {
 	pthread_mutex_lock(&error_lock);
@@ -1874,96 +2307,136 @@ bool check_thread_error(void) {
 	return atomic_load(&thread_error_flag);
 }
 
-void * thread_process_sector(void * arg)
+/**
+ * @brief Memory a job is expected to hold on top of the sector itself:
+ * the import buffers and, when the table is collated, the collate buffers.
+ * The sector is reserved separately when it is loaded for collation.
+ *
+ * @param job import job
+ * @return footprint in bytes
+ */
+static uint64_t import_job_footprint(ldb_importation_config_t * job)
 {
-	ldb_importation_config_t * job = arg;
-	int result = ldb_import(job);
+	bool wfp = strstr(job->csv_path, ".bin");
+	uint64_t footprint = LDB_MAX_NODE_LN;
+
+	/* Node batches, the input file is mapped */
+	if (wfp)
+		footprint = 2 * WFP_BATCH_LN;
 
-	if (result != LDB_ERROR_NOERROR && result != 0) {
-		set_thread_error(result, "Import failed for %s/%s: %s",
-			job->dbname, job->table, job->csv_path);
+	/* Blocks of the decode stage */
+	if (strstr(job->csv_path, ".enc"))
+		footprint += 2 * (uint64_t) DECODE_BLOCK_LINES * MAX_CSV_LINE_LEN;
+
+	if (job->opt.params.collate && !strstr(job->csv_path, ".mz"))
+	{
+		struct ldb_table table = {.key_ln = wfp ? LDB_KEY_LN : MD5_LEN, .rec_ln = wfp ? WFP_REC_LN : 0};
+		footprint += ldb_collate_buffer_size(table, wfp ? WFP_REC_LN : job->opt.params.collate_max_rec);
 	}
+	return footprint;
+}
 
-	free(job);
-	pthread_exit(NULL);
+/**
+ * @brief Apply the options of a job to the thread running it. Jobs of tables with
+ * different options may run on the same workers at the same time.
+ *
+ * @param job import job
+ */
+static void import_job_thread(ldb_importation_config_t * job)
+{
+	ldb_writeback_enable(job->opt.params.pace_writes > 0);
+	ldb_memory_init(job->opt.params.collate_max_ram_percent);
+	ldb_collate_tmp_path(job->opt.params.tmp_path);
 }
-void threads_end(pthread_t * tlist)
+
+/**
+ * @brief Import a job, recording its start and completion in the import journal,
+ * and the imported file in the manifest for incremental imports
+ *
+ * @param job import job
+ * @return LDB_ERROR_NOERROR on success
+ */
+static int import_job(ldb_importation_config_t * job)
 {
-	
-	for (int j =0; j < max_threads; j++)
+	import_job_thread(job);
+	ldb_journal_begin(job->table, job->csv_path);
+
+	/* The identity is taken before the input is sorted in place */
+	ldb_manifest_id_t source;
+	bool identified = job->opt.params.incremental > 0 && ldb_manifest_identify(job->csv_path, &source);
+
+	int result = ldb_import(job);
+	if (result == LDB_ERROR_NOERROR)
 	{
-		if (!tlist[j])
-			continue;
-		if (pthread_join(tlist[j], NULL) == 0)
-		{
-			pthread_mutex_lock(&lock);
-			num_threads--;
-			pthread_mutex_unlock(&lock);
-		}
-	
-		tlist[j] = 0;
+		ldb_journal_file(job->table, job->csv_path);
+		if (identified)
+			ldb_manifest_record(job->table, job->csv_path, &source);
 	}
+	return result;
 }
 
-int thread_request_or_wait(pthread_t * tlist, int collate_max_ram_percent)
+static void import_task(void * arg)
 {
-	/* Check for thread error before allocating new threads - lock-free atomic read */
-	if (check_thread_error())
-		return -1;
-
-	/* Memory-aware throttling: check if we have enough RAM before launching threads */
-	int memory_check_count = 0;
-	const int MAX_MEMORY_CHECKS = 12; // Wait up to 60 seconds (60 × 1 second)
+	ldb_importation_config_t * job = arg;
 
-	while (!check_memory_for_threading(collate_max_ram_percent * 1.2)) {
-		if (check_thread_error())
-			return -1;
+	/* Jobs still queued when an error is raised are discarded */
+	if (!check_thread_error())
+	{
+		/* Hold the job until its footprint fits in the memory budget of its table */
+		import_job_thread(job);
+		uint64_t footprint = import_job_footprint(job);
+		ldb_memory_reserve(footprint, true);
 
-		memory_check_count++;
-		if (memory_check_count >= MAX_MEMORY_CHECKS) {
-			log_info("Memory throttling: Waited %d seconds, but RAM still insufficient. Proceeding anyway.\n", MAX_MEMORY_CHECKS);
-			break;
-		}
+		if (!check_thread_error())
+		{
+			int result = import_job(job);
 
-		/* Wait 1 second and check again */
-		sleep(5);
-
-		/* Meanwhile, try to join finished threads to free up resources */
-		for (int j = 0; j < max_threads; j++) {
-			if (tlist[j] && pthread_tryjoin_np(tlist[j], NULL) == 0) {
-				pthread_mutex_lock(&lock);
-				num_threads--;
-				pthread_mutex_unlock(&lock);
-				tlist[j] = 0;
-				log_info("Thread completed during memory wait. Active threads: %d\n", num_threads);
+			if (result != LDB_ERROR_NOERROR && result != 0) {
+				set_thread_error(result, "Import failed for %s/%s: %s",
+					job->dbname, job->table, job->csv_path);
 			}
 		}
+		ldb_memory_release(footprint);
 	}
+	free(job);
+}
 
-	if (num_threads < max_threads)
-		return num_threads;
+/* Workers needed by a table: its THREADS, or MAX_THREADS when the count is adaptive */
+static int import_workers(import_params_t * opt)
+{
+	return opt->params.max_threads > opt->params.threads ? opt->params.max_threads : opt->params.threads;
+}
 
-	while(num_threads >= max_threads)
-	{
-		/* Check for errors while waiting - lock-free atomic read */
-		if (check_thread_error())
-			return -1;
+/* Tables whose jobs can share the worker pool at the same time */
+static bool import_threads_compatible(import_params_t * a, import_params_t * b)
+{
+	return a->params.threads == b->params.threads && a->params.min_threads == b->params.min_threads
+		&& a->params.max_threads == b->params.max_threads;
+}
 
-		for (int j =0; j < max_threads; j++)
-		{
-			if (!tlist[j])
-				continue;
-			if (pthread_tryjoin_np(tlist[j], NULL) == 0)
-			{
-				pthread_mutex_lock(&lock);
-				num_threads--;
-				pthread_mutex_unlock(&lock);
-				tlist[j] = 0;
-				return j;
-			}
-		}
+static ldb_autotune_t import_autotune;
+
+/* Activate the workers of a table before its jobs are queued */
+static void threads_begin(import_params_t * opt)
+{
+	int active = opt->params.threads;
+	if (opt->params.max_threads > 0)
+	{
+		ldb_autotune_start(&import_autotune, opt->params.min_threads, opt->params.max_threads);
+		active = ldb_autotune_clamp(&import_autotune, active);
 	}
-	return -1;
+	ldb_pool_set_active(import_pool, active);
+}
+
+/* Wait for the queued jobs, adapting the active workers if the table has MAX_THREADS, and release the workers' buffers */
+void threads_end(import_params_t * opt)
+{
+	if (opt->params.max_threads > 0)
+		while (!ldb_pool_wait_timeout(import_pool, LDB_AUTOTUNE_INTERVAL_MS))
+			ldb_pool_set_active(import_pool, ldb_autotune_step(&import_autotune, ldb_pool_active(import_pool), ldb_pool_queued(import_pool) > 0));
+
+	ldb_pool_wait(import_pool);
+	ldb_pool_trim(import_pool);
 }
 
 volatile bool aborting = false;
@@ -1977,119 +2450,286 @@ void signalHandler(int signal) {
 	{
         system("clear");
 		printf("\n\n Safe abort, waiting threads to finish\n");
-        threads_end(threads_list);
+		ldb_pool_cancel(import_pool);
+		ldb_pool_wait(import_pool);
 		exit(EXIT_FAILURE);
     }
 }
 
-pthread_t thread_start(ldb_importation_config_t * job, pthread_t * tlist)
+/**
+ * @brief Prepare a table left half imported by an interrupted run. Its .tmp sectors
+ * (overwrite staging or collate output not yet promoted) are discarded, the unfinished
+ * files are imported again from the .ldb sectors.
+ *
+ * @param job table job
+ */
+static void import_discard_partial(ldb_importation_config_t * job)
 {
-	pthread_t tid;
+	char table_path[LDB_MAX_PATH];
+	snprintf(table_path, sizeof(table_path), "%s/%s/%s", ldb_root, job->dbname, job->table);
 
-	int t = thread_request_or_wait(tlist, job->opt.params.collate_max_ram_percent);
+	DIR *dir = opendir(table_path);
+	if (dir)
+	{
+		struct dirent *ent;
+		while ((ent = readdir(dir)))
+		{
+			if (strlen(ent->d_name) != 6 || strcmp(ent->d_name + 2, ".tmp"))
+				continue;
 
-	/* If error detected, abort thread creation */
-	if (t < 0) {
-		log_info("Aborting thread creation due to error flag\n");
-		return 0;
+			char sector_path[LDB_MAX_PATH * 2];
+			snprintf(sector_path, sizeof(sector_path), "%s/%s", table_path, ent->d_name);
+			log_info("Discarding partial sector %s\n", sector_path);
+			unlink(sector_path);
+		}
+		closedir(dir);
 	}
+}
 
-	pthread_mutex_lock(&lock);
-	ldb_importation_config_t * job_cpy = malloc(sizeof(ldb_importation_config_t));
-	memcpy(job_cpy,job,sizeof(ldb_importation_config_t));
-
-	int result = pthread_create(&tid, NULL, thread_process_sector, (void*) job_cpy);
-	pthread_mutex_unlock(&lock);
+/**
+ * @brief Check if an input file can be skipped: it was imported by an interrupted run
+ * being resumed or, on incremental imports, it did not change since it was last imported
+ *
+ * @param job import job
+ * @return true to skip the file
+ */
+static bool import_skip(ldb_importation_config_t * job)
+{
+	if (ldb_journal_done(job->table, job->csv_path))
+	{
+		log_info("%s was already imported, skipping\n", job->csv_path);
+		return true;
+	}
 
-	if (result != 0)
+	if (job->opt.params.incremental > 0 && ldb_manifest_unchanged(job->table, job->csv_path))
 	{
-		printf("<<<<pthread failed %d>>>\n", result);
-		free(job_cpy);
-		return 0;
+		log_debug("%s did not change since the last import, skipping\n", job->csv_path);
+		return true;
 	}
+	return false;
+}
+
+/**
+ * @brief INCREMENTAL=2: print the sectors a changed input file would write, instead of importing it.
+ * Sector files are named after their sector, whole table CSV files are scanned.
+ *
+ * @param job import job
+ */
+static void import_report(ldb_importation_config_t * job)
+{
+	bool sectors[256] = {false};
+	int sector = sector_from_path(job->csv_path);
+
+	if (strstr(job->csv_path, ".mz"))
+		sector = -1;
+	else if (sector >= 0 && sector < 256)
+		sectors[sector] = true;
 	else
 	{
-		tlist[t] = tid;
-		num_threads++;
+		ldb_stream_t *stream = NULL;
+		FILE *fp = NULL;
+		if (ldb_stream_is_stream(job->csv_path))
+		{
+			stream = ldb_stream_open(job->csv_path, false, job->opt.params.tmp_path);
+			if (stream)
+				fp = stream->fp;
+		}
+		else
+			fp = fopen(job->csv_path, "r");
+
+		if (!fp)
+			return;
+
+		char *line = NULL;
+		size_t len = 0;
+		while (getline(&line, &len, fp) > 2)
+		{
+			uint8_t k = 0;
+			if (valid_hex(line, 2))
+			{
+				ldb_hex_to_bin(line, 2, &k);
+				sectors[k] = true;
+			}
+		}
+		free(line);
+		csv_input_close(fp, stream);
 	}
 
-	return tid;
+	printf("%s/%s %s:", job->dbname, job->table, job->csv_path);
+	for (int i = 0; i < 256; i++)
+		if (sectors[i])
+			printf(" %02x", i);
+	printf("%s\n", strstr(job->csv_path, ".mz") ? " mz" : "");
+}
+
+/* Import jobs collected before dispatch */
+typedef struct import_queue_t
+{
+	struct import_queue_entry_t
+	{
+		ldb_importation_config_t * job;
+		uint64_t size;
+	} * entries;
+	int number;
+} import_queue_t;
+
+/* Queue a copy of a job, with the size of its input file */
+static void import_queue_add(import_queue_t * queue, ldb_importation_config_t * job)
+{
+	ldb_importation_config_t * job_cpy = malloc(sizeof(ldb_importation_config_t));
+	memcpy(job_cpy, job, sizeof(ldb_importation_config_t));
+
+	/* A file interrupted while appending left part of its records in the table: the sectors
+	   it writes are collated once it is imported again, dropping the records appended twice */
+	if (ldb_journal_interrupted(job->table, job->csv_path) && !job_cpy->opt.params.overwrite && !job_cpy->opt.params.collate)
+	{
+		log_info("%s was interrupted while appending records, its sectors are collated after the import\n", job->csv_path);
+		job_cpy->opt.params.collate = 1;
+
+		/* Records of fixed length tables are collated at their length */
+		char dbtable[LDB_MAX_NAME * 2 + 1];
+		snprintf(dbtable, sizeof(dbtable), "%s/%s", job->dbname, job->table);
+		struct ldb_table table = ldb_valid_table(dbtable) ? ldb_read_cfg(dbtable) : (struct ldb_table) {0};
+		if (table.rec_ln)
+			job_cpy->opt.params.collate_max_rec = table.rec_ln;
+		else if (job_cpy->opt.params.collate_max_rec < LDB_KEY_LN)
+			job_cpy->opt.params.collate_max_rec = LDB_MAX_REC_LN;
+	}
+
+	queue->entries = realloc(queue->entries, (queue->number + 1) * sizeof(struct import_queue_entry_t));
+	queue->entries[queue->number].job = job_cpy;
+	queue->entries[queue->number].size = strcmp(job->csv_path, LDB_STREAM_STDIN) ? ldb_file_size(job->csv_path) : 0;
+	queue->number++;
 }
 
-bool process_sectors(ldb_importation_config_t * job, pthread_t * tlist) {
-    DIR *dir;
-    struct dirent *ent;
+static int import_queue_cmp(const void * a, const void * b)
+{
+	const struct import_queue_entry_t * x = a, * y = b;
+	return (x->size < y->size) - (x->size > y->size);
+}
+
+/**
+ * @brief Collect the import jobs of a table: the input files that are not skipped
+ *
+ * @param job table job
+ * @param queue [out] queue where the jobs are added
+ * @return false if the input cannot be read
+ */
+static bool import_queue_table(ldb_importation_config_t * job, import_queue_t * queue)
+{
+	DIR *dir;
+	struct dirent *ent;
+
+	/* An interrupted import left this table half done */
+	if (ldb_journal_partial(job->table))
+		import_discard_partial(job);
 
 	/*Process one file with multiples sectors inside*/
 	if (*job->csv_path)
 	{
-		if (ldb_file_exists(job->csv_path))
+		if (import_skip(job))
+			return true;
+
+		if (job->opt.params.incremental > 1)
 		{
-			pthread_t pid = thread_start(job, tlist);
-			if (pid == 0) {
-				/* Check if we failed due to error flag or just thread limit */
-				if (check_thread_error()) {
-					log_info("Aborting sector processing due to thread error\n");
-					return false;
-				}
-				/* Execute in main thread if we couldn't start a worker thread */
-				int result = ldb_import(job);
-				if (result != LDB_ERROR_NOERROR && result != 0) {
-					set_thread_error(result, "Import failed for %s/%s: %s",
-						job->dbname, job->table, job->csv_path);
-					return false;
-				}
-				return true;
-			}
-			else
-				return true;
+			import_report(job);
+			return true;
 		}
-		else
+
+		if (ldb_file_exists(job->csv_path) || !strcmp(job->csv_path, LDB_STREAM_STDIN))
 		{
-			log_info("Could not be able to find the file: %s\n", job->csv_path);
-			return false;
+			import_queue_add(queue, job);
+			return true;
 		}
+
+		log_info("Could not be able to find the file: %s\n", job->csv_path);
+		return false;
 	}
 
 	/*Process a directory with one sector per file*/
-    if ((dir = opendir(job->path)) != NULL)
+	if ((dir = opendir(job->path)) == NULL)
+	{
+		log_info("Cannot open directory: %s\n", job->path);
+		return false;
+	}
+
+	while ((ent = readdir(dir)) != NULL)
 	{
-		while ((ent = readdir(dir)) != NULL)
+		if (!strcmp(ent->d_name,".") || !strcmp(ent->d_name,"..") || ent->d_type != DT_REG)
+			continue;
+
+		snprintf(job->csv_path, LDB_MAX_PATH, "%s/%s", job->path, ent->d_name);
+		if (import_skip(job))
+			continue;
+
+		if (job->opt.params.incremental > 1)
 		{
-            if (!strcmp(ent->d_name,".") || !strcmp(ent->d_name,".."))
-				continue;
+			import_report(job);
+			continue;
+		}
 
-			if (ent->d_type == DT_REG)
-			{
-				snprintf(job->csv_path, LDB_MAX_PATH, "%s/%s", job->path, ent->d_name);
-				pthread_t tid = thread_start(job, tlist);
-				if (tid == 0) {
-					/* Check if we failed due to error flag or just thread limit */
-					if (check_thread_error()) {
-						log_info("Aborting directory processing due to thread error\n");
-						break;
-					}
-					/* Execute in main thread if we couldn't start a worker thread */
-					int result = ldb_import(job);
-					if (result != LDB_ERROR_NOERROR && result != 0) {
-						set_thread_error(result, "Import failed for %s/%s: %s",
-							job->dbname, job->table, job->csv_path);
-						break;
-					}
-				}
-            }
-        }
+		import_queue_add(queue, job);
+	}
+	closedir(dir);
+	*job->csv_path = 0;
+	return true;
+}
 
-        closedir(dir);
-    }
-	else
+/**
+ * @brief Dispatch the queued jobs to the worker pool, largest input first (LPT), so the
+ * biggest files do not start last and leave the other workers idle at the end.
+ * Jobs that cannot be queued are run in the calling thread.
+ *
+ * @param queue jobs, released by the call
+ * @return false if an error was raised
+ */
+static bool import_queue_run(import_queue_t * queue)
+{
+	qsort(queue->entries, queue->number, sizeof(struct import_queue_entry_t), import_queue_cmp);
+
+	int i = 0;
+	for (; i < queue->number; i++)
 	{
-       	log_info("Cannot open directory: %s\n", job->path);
-		return false;
-    }
+		ldb_importation_config_t * job = queue->entries[i].job;
+
+		/* If error detected, abort job submission */
+		if (check_thread_error())
+		{
+			log_info("Aborting job submission due to error flag\n");
+			break;
+		}
+
+		if (ldb_pool_submit(import_pool, import_task, job))
+			continue;
+
+		/* Execute in main thread if we couldn't queue the job */
+		int result = import_job(job);
+		if (result != LDB_ERROR_NOERROR && result != 0)
+			set_thread_error(result, "Import failed for %s/%s: %s", job->dbname, job->table, job->csv_path);
+		free(job);
+	}
+
+	for (; i < queue->number; i++)
+		free(queue->entries[i].job);
+	free(queue->entries);
+	queue->entries = NULL;
+	queue->number = 0;
 	return !check_thread_error();
 }
 
+/**
+ * @brief Import the files of a table
+ *
+ * @param job table job
+ * @return false on error
+ */
+bool process_sectors(ldb_importation_config_t * job)
+{
+	import_queue_t queue = {.entries = NULL, .number = 0};
+	bool result = import_queue_table(job, &queue);
+	return import_queue_run(&queue) && result;
+}
+
 void print_jobs(struct ldb_importation_jobs_s * jobs)
 {
 	log_info("\n Tables to be processed:\n");
@@ -2115,7 +2755,13 @@ void print_jobs(struct ldb_importation_jobs_s * jobs)
 
 bool ldb_import_command(char * dbtable, char * path, char * config)
 {
-	if (!ldb_file_exists(path) && !ldb_dir_exists(path))
+	if (!strcmp(path, LDB_STREAM_STDIN) && !strchr(dbtable, '/'))
+	{
+		fprintf(stderr, "Error: a destination table is required to import from stdin\n");
+		return false;
+	}
+
+	if (strcmp(path, LDB_STREAM_STDIN) && !ldb_file_exists(path) && !ldb_dir_exists(path))
 	{
 		fprintf(stderr, "Error: file or directory %s not exist\n", path);
 		return false;
@@ -2175,11 +2821,14 @@ bool ldb_import_command(char * dbtable, char * path, char * config)
 		opt_add(jobs.global_opt, jobs.user_opt);
 
 		print_jobs(&jobs);
-		max_threads = jobs.user_opt->params.threads;
+		int workers = import_workers(jobs.user_opt);
+		for (int i = 0; i < jobs.number; i++)
+			if (import_workers(&jobs.job[i]->opt) > workers)
+				workers = import_workers(&jobs.job[i]->opt);
+		import_pool = ldb_pool_create(workers);
+		max_threads = ldb_pool_workers(import_pool);
 		fprintf(stderr, "Max threads set to: %d\n", max_threads);
-		pthread_mutex_init(&lock, NULL);
-		threads_list = calloc(max_threads, sizeof(pthread_t));
-		logger_init(job.dbname, max_threads, threads_list);
+		logger_init(job.dbname, max_threads, ldb_pool_threads(import_pool));
 		log_table_config("GLOBAL", jobs.user_opt);
 				//abort the job if VERSION_VALIDATION is active and the json file is not present
 		if (jobs.user_opt->params.version_validation && !version_present)
@@ -2188,6 +2837,9 @@ bool ldb_import_command(char * dbtable, char * path, char * config)
 			fprintf(stderr, "You can avoid this error by setting \"VALIDATE_VERSION = 0\" in the import configuration options\n");
 			exit(EXIT_FAILURE);
 		}
+		ldb_journal_open(job.dbname);
+		ldb_manifest_open(job.dbname);
+		ldb_wfp_ignore_load(job.dbname);
 		/* Process jobs*/
 		/* Process sorted tables */
 		for (int i=0; i < LDB_DEFAULT_TABLES_NUMBER; i++)
@@ -2208,45 +2860,57 @@ bool ldb_import_command(char * dbtable, char * path, char * config)
 				log_table_config(jobs.job[jobs.sorted[i]]->table, &jobs.job[jobs.sorted[i]]->opt);
 				logger_set_level(jobs.job[jobs.sorted[i]]->opt.params.verbose);
 				logger_basic("%s",jobs.job[jobs.sorted[i]]->table);
-				if (!process_sectors(jobs.job[jobs.sorted[i]], threads_list)) {
+				threads_begin(&jobs.job[jobs.sorted[i]]->opt);
+				if (!process_sectors(jobs.job[jobs.sorted[i]])) {
 					log_info("Error processing sectors for table %s\n", jobs.job[jobs.sorted[i]]->table);
 				}
+				//wait for each table to finish
+				threads_end(&jobs.job[jobs.sorted[i]]->opt);
 				free(jobs.job[jobs.sorted[i]]);
 				jobs.job[jobs.sorted[i]] = NULL;
-				//wait for each table to finish
-				threads_end(threads_list);
 				logger_offset_increase(lines_to_add);
 			}
 		}
 
-		/* Process unsorted tables */
-		for (int i=0; i < LDB_DEFAULT_TABLES_NUMBER; i++)
+		/* Process unsorted tables: they do not depend on each other. The files of the tables
+		sharing the same thread settings are queued together, so the largest ones start first
+		and the tables overlap. Each job runs with the options of its own table */
+		bool queued[LDB_DEFAULT_TABLES_NUMBER] = {false};
+		for (int g=0; g < LDB_DEFAULT_TABLES_NUMBER && !check_thread_error(); g++)
 		{
-			if (check_thread_error()) {
-				log_info("\nAborting import process due to thread error\n");
-				break;
-			}
+			if (jobs.unsorted[g] == -1 || queued[g])
+				continue;
 
+			import_params_t * group_opt = &jobs.job[jobs.unsorted[g]]->opt;
+			import_queue_t queue = {.entries = NULL, .number = 0};
 			int lines_to_add = 0;
-			if (jobs.unsorted[i] != -1)
+			for (int i=g; i < LDB_DEFAULT_TABLES_NUMBER && !check_thread_error(); i++)
 			{
-				if (*jobs.job[jobs.unsorted[i]]->csv_path)
-					lines_to_add = 1;
-				else
-					lines_to_add = max_threads;
+				if (jobs.unsorted[i] == -1 || queued[i] || !import_threads_compatible(group_opt, &jobs.job[jobs.unsorted[i]]->opt))
+					continue;
+				queued[i] = true;
 
-				log_table_config(jobs.job[jobs.unsorted[i]]->table, &jobs.job[jobs.unsorted[i]]->opt);
-				logger_set_level(jobs.job[jobs.unsorted[i]]->opt.params.verbose);
-				logger_basic("%s",jobs.job[jobs.unsorted[i]]->table);
-				if (!process_sectors(jobs.job[jobs.unsorted[i]], threads_list)) {
-					log_info("Error processing sectors for table %s\n", jobs.job[jobs.unsorted[i]]->table);
+				ldb_importation_config_t * table_job = jobs.job[jobs.unsorted[i]];
+				lines_to_add += *table_job->csv_path ? 1 : max_threads;
+
+				log_table_config(table_job->table, &table_job->opt);
+				logger_set_level(table_job->opt.params.verbose);
+				logger_basic("%s",table_job->table);
+				if (!import_queue_table(table_job, &queue)) {
+					log_info("Error processing sectors for table %s\n", table_job->table);
 				}
-				free(jobs.job[jobs.unsorted[i]]);
-				jobs.job[jobs.unsorted[i]] = NULL;
-				//wait for each table to finish
-				threads_end(threads_list);
-				logger_offset_increase(lines_to_add);
 			}
+
+			if (queue.number)
+			{
+				threads_begin(group_opt);
+				if (!import_queue_run(&queue))
+					log_info("\nAborting import process due to thread error\n");
+				threads_end(group_opt);
+			}
+			else
+				import_queue_run(&queue);
+			logger_offset_increase(lines_to_add);
 		}
 
 		/* Cleanup: free any remaining jobs that weren't processed */
@@ -2256,11 +2920,17 @@ bool ldb_import_command(char * dbtable, char * path, char * config)
 				free(jobs.job[i]);
 		}
 		free(jobs.job);
+		ldb_pool_destroy(import_pool);
+		import_pool = NULL;
+		ldb_journal_close(!check_thread_error());
+		ldb_manifest_close();
+		import_tables_free();
+		decode_pool_destroy();
 	}
 	else if (table)
 	{
 		strcpy(job.table, table + 1);
-		if (ldb_file_exists(path))
+		if (ldb_file_exists(path) || !strcmp(path, LDB_STREAM_STDIN))
 		{
 			strcpy(job.csv_path,path);
 			strcpy(job.path, dirname(path));
@@ -2276,11 +2946,10 @@ bool ldb_import_command(char * dbtable, char * path, char * config)
 
 		bool version_present = version_import(&job);
 
-		max_threads = job.opt.params.threads;
+		import_pool = ldb_pool_create(import_workers(&job.opt));
+		max_threads = ldb_pool_workers(import_pool);
 		fprintf(stderr, "Max threads set to: %d\n", max_threads);
-		pthread_mutex_init(&lock, NULL);
-		threads_list = calloc(max_threads, sizeof(pthread_t));
-		logger_init(job.dbname, max_threads, threads_list);
+		logger_init(job.dbname, max_threads, ldb_pool_threads(import_pool));
 		log_table_config(job.table, &job.opt);
 
 		//abort the job if VERSION_VALIDATION is active and the json file is not present
@@ -2290,15 +2959,23 @@ bool ldb_import_command(char * dbtable, char * path, char * config)
 			fprintf(stderr, "You can avoid this error by setting \"VALIDATE_VERSION = 0\" in the import configuration options\n");
 			exit(EXIT_FAILURE);
 		}
+		ldb_journal_open(job.dbname);
+		ldb_manifest_open(job.dbname);
+		ldb_wfp_ignore_load(job.dbname);
 
-		if (!process_sectors(&job, threads_list)) {
+		threads_begin(&job.opt);
+		if (!process_sectors(&job)) {
 			log_info("Error processing sectors for table %s\n", job.table);
 		}
 
 		/* Wait for all threads to complete */
-		threads_end(threads_list);
-		free(threads_list);
-		pthread_mutex_destroy(&lock);
+		threads_end(&job.opt);
+		ldb_pool_destroy(import_pool);
+		import_pool = NULL;
+		ldb_journal_close(!check_thread_error());
+		ldb_manifest_close();
+		import_tables_free();
+		decode_pool_destroy();
 		pthread_mutex_destroy(&error_lock);
 
 		/* Check if there was any error */
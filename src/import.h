@@ -3,7 +3,7 @@
 #include <stdbool.h>
 #include "ldb.h"
  
-#define IMPORT_PARAMS_NUMBER 15
+#define IMPORT_PARAMS_NUMBER 19
 typedef union import_params {
 	struct __attribute__((__packed__)) params
 	{
@@ -22,6 +22,10 @@ typedef union import_params {
 		int collate;
 		int collate_max_rec;
 		int collate_max_ram_percent;
+		int incremental;
+		int pace_writes;
+		int min_threads;
+		int max_threads;
 		char tmp_path[LDB_MAX_PATH];
 	} params;
 	int params_arr[IMPORT_PARAMS_NUMBER];
@@ -34,11 +38,13 @@ typedef struct ldb_importation_config_t
     char table[LDB_MAX_NAME];
     char csv_path[LDB_MAX_PATH];
 	import_params_t opt;
+	bool sectors[256]; // Sectors written by the import
 } ldb_importation_config_t;
 
 
 bool ldb_importation_config_parse(import_params_t * opt, char * line);
 bool ldb_create_db_config_default(char * dbname);
+int ldb_import_table_option(char *dbname, char *table, const char *name, int def);
 int ldb_import(ldb_importation_config_t * job);
 uint64_t ldb_file_size(char *path);
 
@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/iterator.c
+ *
+ * Sector map iterator
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file iterator.c
+ * @date 18 October 2026
+ * @brief Iterator over the keys of a sector that have a list.
+ *
+ * Full table operations (collate, dump, dump keys) used to fetch each one of the 256^3
+ * keys of a sector, most of them with an empty map pointer. The iterator scans the map
+ * instead, testing groups of 16 pointers (80 bytes) for zero at once with SSE2 (64-bit
+ * words elsewhere), and yields only the populated keys.
+ *
+ * A sector in memory is visited in key order. A sector on disk has its map read in large
+ * blocks and its keys visited in ascending list offset, so the lists are read forwards
+ * through the file instead of seeking back and forth.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ldb.h"
+#include "logger.h"
+
+#define MAP_KEYS (256 * 256 * 256)
+#define MAP_GROUP 16                                  // pointers tested at once
+#define MAP_GROUP_LN (MAP_GROUP * LDB_PTR_LN)         // 80 bytes
+#define MAP_BLOCK_LN (MAP_GROUP_LN * 65536)           // map read from disk per block (5MB)
+
+/* Check if a group of 16 map pointers is all zero */
+static inline bool map_group_empty(const uint8_t *map)
+{
+#ifdef __SSE2__
+	__m128i v = _mm_loadu_si128((const __m128i *) map);
+	v = _mm_or_si128(v, _mm_loadu_si128((const __m128i *) (map + 16)));
+	v = _mm_or_si128(v, _mm_loadu_si128((const __m128i *) (map + 32)));
+	v = _mm_or_si128(v, _mm_loadu_si128((const __m128i *) (map + 48)));
+	v = _mm_or_si128(v, _mm_loadu_si128((const __m128i *) (map + 64)));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xFFFF;
+#else
+	uint64_t w[MAP_GROUP_LN / 8];
+	memcpy(w, map, MAP_GROUP_LN);
+	return !(w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7] | w[8] | w[9]);
+#endif
+}
+
+static int map_entry_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+/* Disk mode: list the populated keys as (list offset << 24 | map position), in offset order */
+static bool map_list_from_disk(ldb_sector_iterator_t *it, FILE *file)
+{
+	uint8_t *block = malloc(MAP_BLOCK_LN);
+	size_t capacity = 65536;
+	it->list = malloc(capacity * sizeof(uint64_t));
+	if (!block || !it->list)
+	{
+		free(block);
+		return false;
+	}
+
+	bool result = true;
+	fseeko64(file, 0, SEEK_SET);
+	for (uint32_t base = 0; base < MAP_KEYS && result; base += MAP_BLOCK_LN / LDB_PTR_LN)
+	{
+		if (fread(block, 1, MAP_BLOCK_LN, file) != MAP_BLOCK_LN)
+		{
+			log_info("Error reading the map of sector %02x\n", it->id);
+			result = false;
+			break;
+		}
+
+		for (uint32_t g = 0; g < MAP_BLOCK_LN; g += MAP_GROUP_LN)
+		{
+			if (map_group_empty(block + g))
+				continue;
+
+			for (uint32_t p = g; p < g + MAP_GROUP_LN; p += LDB_PTR_LN)
+			{
+				uint64_t offset = uint40_read(block + p);
+				if (!offset)
+					continue;
+
+				if (it->number == capacity)
+				{
+					capacity *= 2;
+					uint64_t *list = realloc(it->list, capacity * sizeof(uint64_t));
+					if (!list)
+					{
+						result = false;
+						break;
+					}
+					it->list = list;
+				}
+				it->list[it->number++] = offset << 24 | (base + p / LDB_PTR_LN);
+			}
+		}
+	}
+	free(block);
+
+	if (result)
+		qsort(it->list, it->number, sizeof(uint64_t), map_entry_cmp);
+	return result;
+}
+
+/**
+ * @brief Start iterating over the populated keys of a sector
+ *
+ * @param it iterator
+ * @param id sector number
+ * @param map sector in memory (it starts with the map), NULL to read the map from file
+ * @param file open sector, used when map is NULL
+ * @return false if the map cannot be read
+ */
+bool ldb_sector_iterator_init(ldb_sector_iterator_t *it, uint8_t id, uint8_t *map, FILE *file)
+{
+	memset(it, 0, sizeof(ldb_sector_iterator_t));
+	it->id = id;
+	it->map = map;
+	if (map)
+		return true;
+
+	if (file && map_list_from_disk(it, file))
+		return true;
+
+	ldb_sector_iterator_free(it);
+	return false;
+}
+
+/**
+ * @brief Get the next populated key
+ *
+ * @param it iterator
+ * @param key [out] key (LDB_KEY_LN bytes)
+ * @return false when there are no more keys
+ */
+bool ldb_sector_iterator_next(ldb_sector_iterator_t *it, uint8_t *key)
+{
+	uint32_t position;
+
+	if (it->map)
+	{
+		while (true)
+		{
+			if (it->position >= MAP_KEYS)
+				return false;
+
+			/* Skip empty groups */
+			if (!(it->position % MAP_GROUP) && map_group_empty(it->map + (uint64_t) it->position * LDB_PTR_LN))
+			{
+				it->position += MAP_GROUP;
+				continue;
+			}
+
+			position = it->position++;
+			if (uint40_read(it->map + (uint64_t) position * LDB_PTR_LN))
+				break;
+		}
+	}
+	else
+	{
+		if (it->position >= it->number)
+			return false;
+		position = it->list[it->position++] & 0xFFFFFF;
+	}
+
+	key[0] = it->id;
+	key[1] = position >> 16;
+	key[2] = position >> 8;
+	key[3] = position;
+	return true;
+}
+
+/* Disk mode entries compared by map position */
+static int map_position_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint64_t *) a & 0xFFFFFF, y = *(const uint64_t *) b & 0xFFFFFF;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief Iterate the remaining keys of a disk mode iterator in key (map) order instead of
+ * list offset order. The list is no longer usable by ldb_sector_scan.
+ *
+ * @param it iterator
+ */
+void ldb_sector_iterator_key_order(ldb_sector_iterator_t *it)
+{
+	if (!it->map && it->position < it->number)
+		qsort(it->list + it->position, it->number - it->position, sizeof(uint64_t), map_position_cmp);
+}
+
+/**
+ * @brief Release an iterator
+ *
+ * @param it iterator
+ */
+void ldb_sector_iterator_free(ldb_sector_iterator_t *it)
+{
+	free(it->list);
+	it->list = NULL;
+	it->number = 0;
+}
@@ -10,7 +10,11 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
 #include <libgen.h>
 #include "ldb.h"
 #include "import.h"
@@ -43,54 +47,119 @@ void mkdir_if_not_exist(char *destination)
 	free(dst_dir);
 }
 
+#define JOIN_COPY_BUFFER_LN (4 * 1024 * 1024)
+
+/**
+ * @brief Copy size bytes from the start of in into out at out_off. The kernel copies
+ * without going through user space when it can: copy_file_range (which may share or
+ * reflink extents on the same file system), then sendfile. Otherwise the data goes
+ * through a large buffer. Each method continues where the previous one stopped.
+ *
+ * @param in source descriptor
+ * @param out destination descriptor
+ * @param out_off destination offset
+ * @param size bytes to copy
+ * @return true on success
+ */
+static bool join_copy(int in, int out, off_t out_off, off_t size)
+{
+	off_t in_off = 0;
+
+	while (in_off < size)
+	{
+		ssize_t n = copy_file_range(in, &in_off, out, &out_off, size - in_off, 0);
+		if (n <= 0)
+			break;
+	}
+
+	if (in_off < size && lseek(out, out_off, SEEK_SET) == out_off)
+	{
+		while (in_off < size)
+		{
+			ssize_t n = sendfile(out, in, &in_off, size - in_off);
+			if (n <= 0)
+				break;
+			out_off += n;
+		}
+	}
+
+	if (in_off < size)
+	{
+		uint8_t *buffer = malloc(JOIN_COPY_BUFFER_LN);
+		while (buffer && in_off < size)
+		{
+			ssize_t n = pread(in, buffer, JOIN_COPY_BUFFER_LN, in_off);
+			if (n <= 0 || pwrite(out, buffer, n, out_off) != n)
+				break;
+			in_off += n;
+			out_off += n;
+		}
+		free(buffer);
+	}
+
+	return in_off == size;
+}
+
 /**
- * @brief Move a file to a new location by copying byte by byte.
- * If the file already exist it is overwritten.
+ * @brief Write a file into a new location, or append it to an existing one.
+ * A file that is moved is renamed when source and destination are on the same file
+ * system. Otherwise a new file is first cloned (FICLONE), so both share their extents,
+ * and then copied with join_copy. Appends are copied at the destination EOF.
+ * If the destination already exists and it is not an append, it is overwritten.
  * 
  * @param src src path
  * @param dst dst path 
- * @param skip_delete if true the src file is not deleted after the copy is done.
+ * @param append true to append src to dst
+ * @param mkdir true to create the destination directory if needed
+ * @param delete true to delete src once it is written
  * @return true success. False otherwise.
  */
-static bool write_file(char *src, char *dst, char * mode, bool mkdir, bool delete) {
+static bool write_file(char *src, char *dst, bool append, bool mkdir, bool delete) {
 		
 	if (mkdir)
 	{
 		mkdir_if_not_exist(dst);
 	}
-		
-	FILE *srcf = fopen(src, "rb");
-	if (!srcf)
+
+	if (!append && delete && !rename(src, dst))
+		return true;
+
+	int srcf = open(src, O_RDONLY | O_CLOEXEC);
+	if (srcf < 0)
 	{	
 		printf("Cannot open source file %s\n", src);
 		exit(EXIT_FAILURE);
 	}
 
-	FILE *dstf = fopen(dst, mode);
-	if (!dstf)
+	int dstf = open(dst, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? 0 : O_TRUNC), 0666);
+	if (dstf < 0)
 	{	
 		printf("Cannot open destinstion file %s\n", dst);
 		exit(EXIT_FAILURE);
 	}
 
-	/* Copy byte by byte */
-	int byte = 0;
-	while (!feof(srcf))
+	struct stat src_st, dst_st;
+	bool result = !fstat(srcf, &src_st) && !fstat(dstf, &dst_st);
+	if (result && (append || ioctl(dstf, FICLONE, srcf)))
+		result = join_copy(srcf, dstf, append ? dst_st.st_size : 0, src_st.st_size);
+
+	close(srcf);
+	if (close(dstf))
+		result = false;
+
+	if (!result)
 	{
-		byte = fgetc(srcf);
-		if (feof(srcf)) break;
-		fputc(byte, dstf);
+		printf("Cannot write %s into %s\n", src, dst);
+		return false;
 	}
 
-	fclose(srcf);
-	fclose(dstf);
 	if (delete) unlink(src);
 	return true;
 }
 
 bool move_file(char *src, char *dst, bool delete)
 {
-	return write_file(src,dst, "wb", true, delete);
+	return write_file(src, dst, false, true, delete);
 }
 /**
  * @brief Append the contents of a file to the end of another file.
@@ -101,7 +170,7 @@ bool move_file(char *src, char *dst, bool delete)
 
 bool file_append(char *file, char *destination, bool delete)
 {
-	return write_file(file,destination, "ab", false, delete);
+	return write_file(file, destination, true, false, delete);
 }
 
 
@@ -146,8 +215,8 @@ int ldb_bin_join(char *source, char *destination, bool overwrite, bool snippets,
 	}
 
 	log_info("Joining into %s\n", destination);
-	file_append(source, destination, delete);
-	if (delete) unlink(source);
+	if (!file_append(source, destination, delete))
+		return -1;
 
 	return LDB_ERROR_NOERROR;
 }
@@ -0,0 +1,329 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/journal.c
+ *
+ * Import checkpoint journal
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file journal.c
+ * @date 18 October 2026
+ * @brief Checkpoint journal that makes bulk imports resumable.
+ *
+ * The journal lives in the db directory (LDB_JOURNAL_NAME) while an import is running.
+ * Each entry is a tab separated line, appended and flushed to disk before the import
+ * moves on:
+ *
+ *   B <table> <size> <mtime> <path>   an input file started
+ *   F <table> <size> <mtime> <path>   an input file was fully imported (and collated)
+ *
+ * The journal is removed when the import finishes without errors. If it is still there
+ * when the next import starts, the files recorded as finished (with the same size and
+ * mtime) are skipped and only the remaining work is done again. The unit of work is the
+ * input file: a file that did not finish is imported (and collated) again as a whole. A file
+ * interrupted while appending to the table is collated when imported again, which drops the
+ * records it appended twice.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "journal.h"
+#include "logger.h"
+
+typedef struct journal_entry_t
+{
+	char *table;
+	char *path;
+	uint64_t size;
+	int64_t mtime;
+} journal_entry_t;
+
+static struct
+{
+	pthread_mutex_t lock;
+	int fd;
+	char path[LDB_MAX_PATH];
+	journal_entry_t *done;   // files finished by a previous run, sorted by table and path
+	int done_number;
+	char **partial;          // tables with files started but not finished by a previous run
+	int partial_number;
+	journal_entry_t *interrupted;   // files started but not finished by a previous run, sorted
+	int interrupted_number;
+} journal = {.lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1};
+
+static int journal_entry_cmp(const void *a, const void *b)
+{
+	const journal_entry_t *x = a, *y = b;
+	int r = strcmp(x->table, y->table);
+	return r ? r : strcmp(x->path, y->path);
+}
+
+/* Streams (stdin) cannot be identified again, they are not journaled */
+static bool journal_file_stat(char *path, uint64_t *size, int64_t *mtime)
+{
+	struct stat st;
+	if (!strcmp(path, "-") || stat(path, &st))
+		return false;
+	*size = st.st_size;
+	*mtime = st.st_mtime;
+	return true;
+}
+
+static void journal_write(char *entry)
+{
+	pthread_mutex_lock(&journal.lock);
+	if (journal.fd >= 0)
+	{
+		size_t ln = strlen(entry);
+		if (write(journal.fd, entry, ln) != (ssize_t) ln || fdatasync(journal.fd))
+			log_info("Warning: cannot write the import journal %s\n", journal.path);
+	}
+	pthread_mutex_unlock(&journal.lock);
+}
+
+static void journal_file_entry(char kind, char *table, char *path)
+{
+	uint64_t size = 0;
+	int64_t mtime = 0;
+	if (journal.fd < 0 || !strcmp(path, "-"))
+		return;
+
+	/* A file deleted after import (FILE_DEL) is still recorded, so it does not look partial */
+	if (!journal_file_stat(path, &size, &mtime) && kind == 'B')
+		return;
+
+	char entry[LDB_MAX_PATH + LDB_MAX_NAME + 64];
+	snprintf(entry, sizeof(entry), "%c\t%s\t%lu\t%ld\t%s\n", kind, table, size, mtime, path);
+	journal_write(entry);
+}
+
+/* Load the entries left by an interrupted import */
+static void journal_load(FILE *fp)
+{
+	journal_entry_t *started = NULL;
+	int started_number = 0;
+	char line[LDB_MAX_PATH + LDB_MAX_NAME + 64];
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		line[strcspn(line, "\n")] = 0;
+		char kind = line[0];
+		if ((kind != 'B' && kind != 'F') || line[1] != '\t')
+			continue;
+
+		char *table = strtok(line + 2, "\t");
+		char *size = strtok(NULL, "\t");
+		char *mtime = strtok(NULL, "\t");
+		char *path = strtok(NULL, "");
+		if (!table || !size || !mtime || !path)
+			continue;
+
+		journal_entry_t entry = {.table = strdup(table), .path = strdup(path),
+			.size = strtoull(size, NULL, 10), .mtime = strtoll(mtime, NULL, 10)};
+
+		if (kind == 'F')
+		{
+			journal.done = realloc(journal.done, (journal.done_number + 1) * sizeof(journal_entry_t));
+			journal.done[journal.done_number++] = entry;
+		}
+		else
+		{
+			started = realloc(started, (started_number + 1) * sizeof(journal_entry_t));
+			started[started_number++] = entry;
+		}
+	}
+
+	if (journal.done_number)
+		qsort(journal.done, journal.done_number, sizeof(journal_entry_t), journal_entry_cmp);
+
+	/* Files started that did not finish, and their tables */
+	for (int i = 0; i < started_number; i++)
+	{
+		if (bsearch(&started[i], journal.done, journal.done_number, sizeof(journal_entry_t), journal_entry_cmp))
+		{
+			free(started[i].table);
+			free(started[i].path);
+			continue;
+		}
+
+		if (!ldb_journal_partial(started[i].table))
+		{
+			journal.partial = realloc(journal.partial, (journal.partial_number + 1) * sizeof(char *));
+			journal.partial[journal.partial_number++] = strdup(started[i].table);
+		}
+		journal.interrupted = realloc(journal.interrupted, (journal.interrupted_number + 1) * sizeof(journal_entry_t));
+		journal.interrupted[journal.interrupted_number++] = started[i];
+	}
+	free(started);
+
+	if (journal.interrupted_number)
+		qsort(journal.interrupted, journal.interrupted_number, sizeof(journal_entry_t), journal_entry_cmp);
+}
+
+/**
+ * @brief Open the import journal of a database. If a journal was left by an interrupted
+ * import, its entries are loaded and the import is resumed.
+ *
+ * @param dbname database name
+ * @return true if an interrupted import is being resumed
+ */
+bool ldb_journal_open(char *dbname)
+{
+	ldb_journal_close(false);
+
+	snprintf(journal.path, sizeof(journal.path), "%s/%s/%s", ldb_root, dbname, LDB_JOURNAL_NAME);
+
+	bool resume = false;
+	FILE *fp = fopen(journal.path, "r");
+	if (fp)
+	{
+		journal_load(fp);
+		fclose(fp);
+		resume = true;
+		log_info("Resuming the import of %s: %d files were already imported\n", dbname, journal.done_number);
+	}
+
+	journal.fd = open(journal.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (journal.fd < 0)
+	{
+		log_info("Warning: cannot create the import journal %s, the import will not be resumable\n", journal.path);
+		return resume;
+	}
+
+	/* Make the journal itself durable */
+	if (!resume)
+	{
+		char dir[LDB_MAX_PATH];
+		snprintf(dir, sizeof(dir), "%s/%s", ldb_root, dbname);
+		int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd >= 0)
+		{
+			fsync(dir_fd);
+			close(dir_fd);
+		}
+	}
+	return resume;
+}
+
+/**
+ * @brief Check if an input file was fully imported by a previous (interrupted) run
+ *
+ * @param table table name
+ * @param path input file
+ * @return true if the file is unchanged since it was imported
+ */
+bool ldb_journal_done(char *table, char *path)
+{
+	journal_entry_t key = {.table = table, .path = path};
+	if (!journal.done_number || !journal_file_stat(path, &key.size, &key.mtime))
+		return false;
+
+	journal_entry_t *entry = bsearch(&key, journal.done, journal.done_number, sizeof(journal_entry_t), journal_entry_cmp);
+	return entry && entry->size == key.size && entry->mtime == key.mtime;
+}
+
+/**
+ * @brief Check if a previous (interrupted) run left a file of this table half imported
+ *
+ * @param table table name
+ * @return true if the table has partial work
+ */
+bool ldb_journal_partial(char *table)
+{
+	for (int i = 0; i < journal.partial_number; i++)
+		if (!strcmp(journal.partial[i], table))
+			return true;
+	return false;
+}
+
+/**
+ * @brief Check if a previous (interrupted) run started the import of a file and did not
+ * finish it, whatever the file is now
+ *
+ * @param table table name
+ * @param path input file
+ * @return true if the file was interrupted
+ */
+bool ldb_journal_interrupted(char *table, char *path)
+{
+	journal_entry_t key = {.table = table, .path = path};
+	return journal.interrupted_number &&
+		bsearch(&key, journal.interrupted, journal.interrupted_number, sizeof(journal_entry_t), journal_entry_cmp);
+}
+
+/**
+ * @brief Record that the import of a file has started
+ */
+void ldb_journal_begin(char *table, char *path)
+{
+	journal_file_entry('B', table, path);
+}
+
+/**
+ * @brief Record that a file was fully imported
+ */
+void ldb_journal_file(char *table, char *path)
+{
+	journal_file_entry('F', table, path);
+}
+
+/**
+ * @brief Close the journal
+ *
+ * @param completed true if the import finished without errors: the journal is removed
+ */
+void ldb_journal_close(bool completed)
+{
+	pthread_mutex_lock(&journal.lock);
+	if (journal.fd >= 0)
+	{
+		close(journal.fd);
+		journal.fd = -1;
+		if (completed)
+			unlink(journal.path);
+	}
+
+	for (int i = 0; i < journal.done_number; i++)
+	{
+		free(journal.done[i].table);
+		free(journal.done[i].path);
+	}
+	free(journal.done);
+	journal.done = NULL;
+	journal.done_number = 0;
+
+	for (int i = 0; i < journal.interrupted_number; i++)
+	{
+		free(journal.interrupted[i].table);
+		free(journal.interrupted[i].path);
+	}
+	free(journal.interrupted);
+	journal.interrupted = NULL;
+	journal.interrupted_number = 0;
+
+	for (int i = 0; i < journal.partial_number; i++)
+		free(journal.partial[i]);
+	free(journal.partial);
+	journal.partial = NULL;
+	journal.partial_number = 0;
+	pthread_mutex_unlock(&journal.lock);
+}
@@ -0,0 +1,16 @@
+#ifndef __JOURNAL_H
+#define __JOURNAL_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "ldb.h"
+
+#define LDB_JOURNAL_NAME "import.journal"
+
+bool ldb_journal_open(char *dbname);
+bool ldb_journal_done(char *table, char *path);
+bool ldb_journal_partial(char *table);
+bool ldb_journal_interrupted(char *table, char *path);
+void ldb_journal_begin(char *table, char *path);
+void ldb_journal_file(char *table, char *path);
+void ldb_journal_close(bool completed);
+#endif
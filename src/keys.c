@@ -80,21 +80,13 @@ void ldb_dump_keys(struct ldb_table table, int s)
 		uint8_t *sector = ldb_load_sector(table, &k0);
 		if (sector)
 		{
-			/* Read each one of the (256 ^ 3) list pointers from the map */
+			/* Read the lists of the keys present in the map */
 			uint8_t k[LDB_KEY_LN];
-			k[0] = k0;
-			for (int k1 = 0; k1 < 256; k1++)
-				for (int k2 = 0; k2 < 256; k2++)
-					for (int k3 = 0; k3 < 256; k3++)
-					{
-						k[1] = k1;
-						k[2] = k2;
-						k[3] = k3;
-						
-						/* Process records */
-						ldb_fetch_recordset(sector, table, k, true, ldb_dump_keys_handler, &table);
-						
-					}
+			ldb_sector_iterator_t it;
+			ldb_sector_iterator_init(&it, k0, sector, NULL);
+			while (ldb_sector_iterator_next(&it, k))
+				ldb_fetch_recordset(sector, table, k, true, ldb_dump_keys_handler, &table);
+			ldb_sector_iterator_free(&it);
 			free(sector);
 			if (s >=0)
 				break;
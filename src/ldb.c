@@ -46,7 +46,6 @@
 /* Global */
 char ldb_root[] = "/var/lib/ldb";
 char ldb_lock_path[] = "/dev/shm/ldb.lock";
-int ldb_cmp_width = 0;
 
 bool ldb_read_failure = false;
 /**
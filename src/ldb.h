@@ -39,12 +39,15 @@ extern bool ldb_read_failure;
 
 bool ldb_file_exists(char *path);
 bool ldb_dir_exists(char *path);
+uint64_t ldb_file_size(char *path);
 bool ldb_locked();
 void ldb_error (char *txt);
 void ldb_prepare_dir(char *path);
 void ldb_lock(char * db_table);
 void ldb_unlock(char * db_table);
 void ldb_create_sector(char *sector_path);
+void ldb_sector_preallocate(FILE *sector, uint64_t bytes);
+void ldb_sector_trim(FILE *sector);
 void ldb_uint40_write(FILE *ldb_sector, uint64_t value);
 void ldb_uint32_write(FILE *ldb_sector, uint32_t value);
 uint32_t ldb_uint32_read(FILE *ldb_sector);
@@ -98,6 +101,40 @@ void ldb_sector_erase(struct ldb_table table, uint8_t *key);
 void ldb_dump(struct ldb_table table, int hex_bytes, int sector);
 void ldb_dump_keys(struct ldb_table table, int s);
 
+/* Sector map iterator (iterator.c) */
+typedef struct ldb_sector_iterator_t
+{
+	uint8_t id;          // sector number
+	uint8_t *map;        // map of a sector in memory, NULL in disk mode
+	uint64_t *list;      // disk mode: list offset << 24 | map position, in offset order (or key order)
+	uint32_t number;     // disk mode: populated keys
+	uint32_t position;   // next map position (memory) or list entry (disk)
+} ldb_sector_iterator_t;
+bool ldb_sector_iterator_init(ldb_sector_iterator_t *it, uint8_t id, uint8_t *map, FILE *file);
+bool ldb_sector_iterator_next(ldb_sector_iterator_t *it, uint8_t *key);
+void ldb_sector_iterator_key_order(ldb_sector_iterator_t *it);
+void ldb_sector_iterator_free(ldb_sector_iterator_t *it);
+
+/* Sequential sector scan (scan.c) */
+#define LDB_SCAN_BLOCK (8 * 1048576) // sector bytes read at once
+bool ldb_sector_scan(struct ldb_table table, FILE *file, ldb_sector_iterator_t *it, bool (*handler) (uint8_t *, uint8_t *, int, uint8_t *, uint32_t, int, void *), void *ptr);
+
+/* Sector generations (generation.c) */
+#define LDB_GENERATION_NAME "sectors.manifest" // generation of the table and of its sectors, in the table directory
+uint64_t ldb_table_generation(struct ldb_table table);
+uint64_t ldb_sector_generation(struct ldb_table table, uint8_t k0);
+bool ldb_sector_current(struct ldb_table table, ldb_sector_t *sector);
+uint64_t ldb_table_publish(struct ldb_table table, bool *published);
+uint64_t ldb_sector_publish(struct ldb_table table, uint8_t k0);
+
+/* Bulk writer (bulk.c) */
+#define LDB_BULK_BUFFER (256 * 1024 * 1024) // records held in memory before writing the largest sector
+typedef struct ldb_bulk_writer_t ldb_bulk_writer_t;
+ldb_bulk_writer_t *ldb_bulk_writer_open(struct ldb_table table);
+int ldb_bulk_put(ldb_bulk_writer_t *writer, uint8_t *key, uint8_t *data, uint16_t len);
+int ldb_bulk_commit(ldb_bulk_writer_t *writer);
+void ldb_bulk_abort(ldb_bulk_writer_t *writer);
+
 char * ldb_file_extension(char * path);
 bool ldb_create_dir(char *path);
 bool ldb_reverse_memcmp(uint8_t *a, uint8_t *b, int bytes);
@@ -1,17 +1,49 @@
 #ifndef __COLLATE_H
 #define __COLLATE_H
+#include <stdatomic.h>
 #include "../ldb.h"
 struct ldb_collate_data;
+struct ldb_sector_iterator_t;
 typedef bool (*collate_handler)(struct ldb_collate_data *collate, uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t *data, uint32_t size);
 
 
+/* CSV field of the data of a delete tuple */
+typedef struct tuple_field_t
+{
+	uint32_t offset;
+	uint32_t ln;
+	bool wildcard;       // short field with a '*', matches any value
+} tuple_field_t;
+
+/* Secondary key of a delete tuple */
+typedef struct tuple_key_t
+{
+	uint8_t key[MD5_LEN];
+	bool wildcard;
+} tuple_key_t;
+
 typedef struct tuple_t
 {
 	uint8_t key[MD5_LEN];
 	int keys;
 	char * data;
+	/* Data compiled when the tuples are loaded */
+	tuple_field_t *fields;
+	int fields_number;
+	tuple_key_t *sec_keys;
+	int sec_keys_number;
+	uint8_t *bin;        // fixed records: data in binary
+	int bin_ln;
 } tuple_t;
 
+/* Delete index slot: the tuples sharing a main key */
+typedef struct delete_index_t
+{
+	uint32_t key;
+	int first;
+	int number;
+} delete_index_t;
+
 typedef struct job_delete_tuples_t
 {
 	tuple_t ** tuples;
@@ -19,13 +51,74 @@ typedef struct job_delete_tuples_t
 	int key_ln;
 	int keys_number;
 	collate_handler handler;
+	delete_index_t *index; // open addressing, by main key
+	uint32_t index_size;
 } job_delete_tuples_t;
 
+#define LDB_COLLATE_ARENA (16 * 1048576) // initial arena of variable length records
+#define LDB_COLLATE_HASH_SLOTS (1 << 20) // duplicate detection slots, over twice LDB_MAX_RECORDS
+#define LDB_COLLATE_RUN (256 * 1048576) // out-of-core collate: records sorted in memory before spilling a run
+#define LDB_COLLATE_RUN_MIN (16 * 1048576) // smallest run, when the memory budget is exhausted
+#define LDB_COLLATE_RUN_BUFFER (1048576) // I/O buffer of each spilled run
+#define LDB_COLLATE_NODE_MAX 64800 // data passed to the handler per node of fixed records
+#define LDB_COLLATE_TMP_PATH "/tmp"
+#define LDB_COLLATE_STATE_NAME "collate.state" // collated extent of each sector, in the table directory
+#define LDB_COLLATE_DEAD_MAX 25 // percent of a sector left dead by incremental collates before a full one
+#define LDB_TOMBSTONE_NAME "tombstones" // delete log, in the table directory
+#define LDB_TOMBSTONE_CHECK 1 // seconds between checks of the delete log by a reader
+#define LDB_TOMBSTONE_TABLES 64 // tables whose delete log is cached by a process
+
+/* Collate state of a sector, recorded when it is collated */
+typedef struct ldb_collate_state_t
+{
+	uint64_t inode;     // sector file collated, 0 if unknown
+	uint64_t extent;    // sector size after the collate: nodes past it were added later
+	uint64_t dead;      // bytes of the lists replaced by incremental collates
+	int max_rec_ln;     // maximum record length the sector was collated with, 0 if unknown
+} ldb_collate_state_t;
+
+/* List written in memory by an incremental collate, to be appended to the sector at "base" */
+typedef struct ldb_collate_list_t
+{
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+	uint64_t base;      // sector offset of the list header
+	size_t last;        // last node in data
+} ldb_collate_list_t;
+
+/* Delete log of a table loaded in memory */
+typedef struct ldb_tombstones_t
+{
+	job_delete_tuples_t job;  // tombstones, indexed by main key
+	struct ldb_table table;   // table configuration the tombstones are compiled with
+	bool sectors[256];        // sectors with tombstones
+	uint64_t inode;           // delete log loaded
+	uint64_t size;            // bytes of the delete log loaded
+	atomic_long refs;         // references released (negative) or owned, freed when the last is released
+	int cached;               // cache entry publishing the tombstones, -1 if private to a reader
+} ldb_tombstones_t;
+
+/* Variable length record held in the collate arena */
+typedef struct ldb_collate_entry_t
+{
+	uint8_t prefix[8];  // first 8 bytes of subkey and data, radix sorted
+	uint64_t hash;      // hash of subkey and data, for duplicate detection
+	uint32_t offset;    // record (key, subkey and data) in the arena
+	uint32_t size;      // data size
+} ldb_collate_entry_t;
+
 struct ldb_collate_data
 {
 	void *data; 
 	void *tmp_data;
 	long data_ptr;
+	size_t data_size;                // variable records: arena size
+	size_t data_reserved;            // variable records: arena growth reserved from the memory budget
+	ldb_collate_entry_t *entries;    // variable records: records in the arena
+	long entries_number;
+	uint64_t *hash;                  // variable records: generation << 32 | entry + 1
+	uint32_t hash_generation;
 	int table_key_ln;
 	int table_rec_ln;
 	int max_rec_ln;
@@ -41,12 +134,39 @@ struct ldb_collate_data
 	long key_rec_count;
 	job_delete_tuples_t * del_tuples;
 	collate_handler handler;
+	ldb_collate_list_t *list;        // incremental collate: lists are written here instead of out_sector
 };
+size_t ldb_collate_buffer_size(struct ldb_table table, int max_rec_ln);
+ldb_sector_t ldb_collate_load_sector(struct ldb_table table, uint8_t k0);
 bool ldb_collate_init(struct ldb_collate_data * collate, struct ldb_table table, struct ldb_table out_table, int max_rec_ln, bool merge, uint8_t sector);
+bool ldb_collate_list_init(struct ldb_collate_data * collate, struct ldb_table table, struct ldb_table out_table, int max_rec_ln, ldb_collate_list_t *list);
 void ldb_collate_cleanup(struct ldb_collate_data *collate);
-void ldb_collate_sector(struct ldb_collate_data *collate, ldb_sector_t * sector);
+bool ldb_collate_sector(struct ldb_collate_data *collate, ldb_sector_t * sector);
+void ldb_collate_sort(struct ldb_collate_data *collate);
+bool ldb_import_list(struct ldb_collate_data *collate);
 int ldb_collate_load_tuples_to_delete(job_delete_tuples_t* job, char * buffer, char * d, struct ldb_table table);
+void ldb_collate_delete_free(job_delete_tuples_t *job);
+void ldb_collate_sectors(struct ldb_table table, struct ldb_table out_table, int max_rec_ln, bool merge, bool *sectors, int workers, collate_handler handler);
 void ldb_collate(struct ldb_table table, struct ldb_table out_table, int max_rec_ln, bool merge, int p_sector, collate_handler handler);
+bool ldb_collate_handler(uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t *data, uint32_t size, int iteration, void *ptr);
+void ldb_collate_tmp_path(char *path);
+char *ldb_collate_tmp_path_get(void);
+bool ldb_collate_external(struct ldb_collate_data *collate, ldb_sector_t *sector, struct ldb_sector_iterator_t *it);
+void ldb_collate_state_load(struct ldb_table table, ldb_collate_state_t *state);
+void ldb_collate_state_save(struct ldb_table table, uint8_t k0, ldb_collate_state_t *state);
+void ldb_collate_state_record(struct ldb_table table, uint8_t k0, int max_rec_ln);
+int ldb_collate_list_node(ldb_collate_list_t *list, struct ldb_table table, uint8_t *key, uint8_t *data, uint32_t dataln, uint16_t records);
+bool ldb_collate_incremental(struct ldb_table table, struct ldb_table out_table, int max_rec_ln, uint8_t k0, ldb_collate_state_t *state, uint64_t size, ldb_tombstones_t *tombstones);
 void ldb_collate_delete(struct ldb_table table, struct ldb_table out_table, job_delete_tuples_t * delete, collate_handler handler);
+int ldb_delete_tuples_load(job_delete_tuples_t * job, char * buffer, char * d, struct ldb_table table);
+bool ldb_delete_key_listed(job_delete_tuples_t *job, const uint8_t *key);
+bool ldb_delete_match(job_delete_tuples_t *job, struct ldb_table table, uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t *data, uint32_t size, long *deleted);
+int ldb_tombstone_add(struct ldb_table table, char *buffer, char *d);
+ldb_tombstones_t *ldb_tombstones_get(struct ldb_table table, uint8_t *key);
+void ldb_tombstones_release(ldb_tombstones_t *tombstones);
+bool ldb_tombstones_listed(ldb_tombstones_t *tombstones, uint8_t *key);
+bool ldb_tombstones_record(ldb_tombstones_t *tombstones, uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t *data, uint32_t size);
+uint32_t ldb_tombstones_fixed(ldb_tombstones_t *tombstones, uint8_t *key, uint8_t *node, uint32_t size, uint8_t *out);
+void ldb_tombstones_purge(struct ldb_table table, ldb_tombstones_t *tombstones, bool *sectors);
 
 #endif
\ No newline at end of file
@@ -22,6 +22,5 @@ extern char ldb_root[];
 extern char ldb_lock_path[];
 extern char *ldb_commands[];
 extern int ldb_commands_count;
-extern int ldb_cmp_width;
 
 #endif
\ No newline at end of file
@@ -54,6 +54,7 @@ typedef struct ldb_sector_t
 	uint8_t * data;
 	FILE * file;
 	bool failure;
+	uint64_t generation; // generation of the sector when it was loaded
 } ldb_sector_t;
 
 typedef bool (*ldb_record_handler) (uint8_t *, uint8_t *, int, uint8_t *, uint32_t, int, void *);
@@ -10,6 +10,8 @@
 #define LDB_ERROR_RECORD_LENGHT_INVAID -76 //E076 Max record length should equal fixed record length
 #define LDB_ERROR_CSV_WRONG_ENCODING -80 // E080 the csv file has an incorrect encoding
 #define LDB_ERROR_CSV_TOO_MANY_SKIPPED -81 // E081 too many lines skipped in the csv file
+#define LDB_ERROR_STREAM_DECODE -82 // E082 the input stream could not be fully decoded
+#define LDB_ERROR_STREAM_UNSUPPORTED -83 // E083 streaming import is not supported for this file type
 #define LDB_ERROR_MEM_NOMEM -200 //no memory available
 #define LDB_ERROR_THREAD_ABORT -300 // Thread aborted due to error in another thread
 #endif
\ No newline at end of file
@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/manifest.c
+ *
+ * Manifest of imported input files
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file manifest.c
+ * @date 18 October 2026
+ * @brief Manifest of the input files imported into a database, used by incremental imports.
+ *
+ * The manifest (LDB_MANIFEST_NAME in the db directory) has one tab separated line per
+ * imported file: table, size, mtime and md5 of the input as it was before the import,
+ * size and mtime of the file left by the import (the importer sorts input files in
+ * place), and path.
+ *
+ * A file is unchanged when its size and mtime match either identity. If only the mtime
+ * differs (the file was rewritten, e.g. generated again unsorted) the md5 of the source
+ * is compared before deciding. The manifest is rewritten atomically when the import ends.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "manifest.h"
+#include "ldb.h"
+#include "logger.h"
+
+typedef struct manifest_entry_t
+{
+	char *table;
+	char *path;
+	ldb_manifest_id_t source;    // input before the import
+	uint64_t size;               // file left by the import
+	int64_t mtime;
+} manifest_entry_t;
+
+static struct
+{
+	pthread_mutex_t lock;
+	char path[LDB_MAX_PATH];
+	manifest_entry_t *entries;   // loaded manifest, sorted by table and path
+	int entries_number;
+	manifest_entry_t *updates;   // files imported by this run
+	int updates_number;
+	bool open;
+} manifest = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int manifest_entry_cmp(const void *a, const void *b)
+{
+	const manifest_entry_t *x = a, *y = b;
+	int r = strcmp(x->table, y->table);
+	return r ? r : strcmp(x->path, y->path);
+}
+
+static bool manifest_md5(char *path, char *out)
+{
+	uint8_t *md5 = md5_file(path);
+	if (!md5)
+		return false;
+	ldb_bin_to_hex(md5, MD5_LEN, out);
+	free(md5);
+	return true;
+}
+
+static void manifest_free(manifest_entry_t *entries, int number)
+{
+	for (int i = 0; i < number; i++)
+	{
+		free(entries[i].table);
+		free(entries[i].path);
+	}
+	free(entries);
+}
+
+/**
+ * @brief Load the manifest of a database
+ *
+ * @param dbname database name
+ */
+void ldb_manifest_open(char *dbname)
+{
+	ldb_manifest_close();
+
+	pthread_mutex_lock(&manifest.lock);
+	snprintf(manifest.path, sizeof(manifest.path), "%s/%s/%s", ldb_root, dbname, LDB_MANIFEST_NAME);
+	manifest.open = true;
+
+	FILE *fp = fopen(manifest.path, "r");
+	if (fp)
+	{
+		char line[LDB_MAX_PATH + LDB_MAX_NAME + 96];
+		while (fgets(line, sizeof(line), fp))
+		{
+			line[strcspn(line, "\n")] = 0;
+			char *table = strtok(line, "\t");
+			char *size = strtok(NULL, "\t");
+			char *mtime = strtok(NULL, "\t");
+			char *md5 = strtok(NULL, "\t");
+			char *imported_size = strtok(NULL, "\t");
+			char *imported_mtime = strtok(NULL, "\t");
+			char *path = strtok(NULL, "");
+			if (!table || !size || !mtime || !md5 || !imported_size || !imported_mtime || !path || strlen(md5) != MD5_LEN * 2)
+				continue;
+
+			manifest.entries = realloc(manifest.entries, (manifest.entries_number + 1) * sizeof(manifest_entry_t));
+			manifest_entry_t *entry = &manifest.entries[manifest.entries_number++];
+			entry->table = strdup(table);
+			entry->path = strdup(path);
+			entry->source.size = strtoull(size, NULL, 10);
+			entry->source.mtime = strtoll(mtime, NULL, 10);
+			strcpy(entry->source.md5, md5);
+			entry->size = strtoull(imported_size, NULL, 10);
+			entry->mtime = strtoll(imported_mtime, NULL, 10);
+		}
+		fclose(fp);
+		qsort(manifest.entries, manifest.entries_number, sizeof(manifest_entry_t), manifest_entry_cmp);
+	}
+	log_info("Import manifest %s: %d files\n", manifest.path, manifest.entries_number);
+	pthread_mutex_unlock(&manifest.lock);
+}
+
+/**
+ * @brief Check if an input file is unchanged since it was last imported
+ *
+ * @param table table name
+ * @param path input file
+ * @return true if the file does not need to be imported again
+ */
+bool ldb_manifest_unchanged(char *table, char *path)
+{
+	struct stat st;
+	if (!manifest.open || !manifest.entries_number || stat(path, &st))
+		return false;
+
+	manifest_entry_t key = {.table = table, .path = path};
+	manifest_entry_t *entry = bsearch(&key, manifest.entries, manifest.entries_number, sizeof(manifest_entry_t), manifest_entry_cmp);
+	if (!entry)
+		return false;
+
+	if ((entry->size == (uint64_t) st.st_size && entry->mtime == st.st_mtime)
+		|| (entry->source.size == (uint64_t) st.st_size && entry->source.mtime == st.st_mtime))
+		return true;
+
+	/* Rewritten with the size of the source: compare the content */
+	ldb_manifest_id_t id;
+	if (entry->source.size != (uint64_t) st.st_size || !ldb_manifest_identify(path, &id)
+		|| strcmp(id.md5, entry->source.md5))
+		return false;
+
+	/* Same content, refresh the mtime so the md5 is not computed again */
+	ldb_manifest_record(table, path, &id);
+	return true;
+}
+
+/**
+ * @brief Take the identity (size, mtime and md5) of an input file before it is imported
+ *
+ * @param path input file
+ * @param[out] id identity
+ * @return false if the file cannot be read (e.g. stdin)
+ */
+bool ldb_manifest_identify(char *path, ldb_manifest_id_t *id)
+{
+	struct stat st;
+	if (!manifest.open || stat(path, &st) || !S_ISREG(st.st_mode) || !manifest_md5(path, id->md5))
+		return false;
+
+	id->size = st.st_size;
+	id->mtime = st.st_mtime;
+	return true;
+}
+
+/**
+ * @brief Record a file imported by this run
+ *
+ * @param table table name
+ * @param path input file
+ * @param source identity of the input taken before the import
+ */
+void ldb_manifest_record(char *table, char *path, ldb_manifest_id_t *source)
+{
+	if (!manifest.open)
+		return;
+
+	manifest_entry_t entry = {.source = *source, .size = source->size, .mtime = source->mtime};
+
+	/* The file left by the import, if it is still there */
+	struct stat st;
+	if (!stat(path, &st))
+	{
+		entry.size = st.st_size;
+		entry.mtime = st.st_mtime;
+	}
+
+	entry.table = strdup(table);
+	entry.path = strdup(path);
+
+	pthread_mutex_lock(&manifest.lock);
+	manifest.updates = realloc(manifest.updates, (manifest.updates_number + 1) * sizeof(manifest_entry_t));
+	manifest.updates[manifest.updates_number++] = entry;
+	pthread_mutex_unlock(&manifest.lock);
+}
+
+static void manifest_write_entry(FILE *fp, manifest_entry_t *entry)
+{
+	fprintf(fp, "%s\t%lu\t%ld\t%s\t%lu\t%ld\t%s\n", entry->table, entry->source.size, entry->source.mtime, entry->source.md5,
+		entry->size, entry->mtime, entry->path);
+}
+
+/**
+ * @brief Save the manifest (the files imported by this run replace their previous entries) and close it
+ *
+ * @return false if the manifest could not be written
+ */
+bool ldb_manifest_close(void)
+{
+	bool result = true;
+	pthread_mutex_lock(&manifest.lock);
+
+	if (manifest.open && manifest.updates_number)
+	{
+		qsort(manifest.updates, manifest.updates_number, sizeof(manifest_entry_t), manifest_entry_cmp);
+
+		char tmp_path[LDB_MAX_PATH + 4];
+		snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", manifest.path);
+		FILE *fp = fopen(tmp_path, "w");
+		if (fp)
+		{
+			/* Merge both sorted lists, a file recorded by this run replaces its previous entry */
+			int i = 0, j = 0;
+			while (i < manifest.entries_number || j < manifest.updates_number)
+			{
+				int cmp = i == manifest.entries_number ? 1 : j == manifest.updates_number ? -1 :
+					manifest_entry_cmp(&manifest.entries[i], &manifest.updates[j]);
+
+				if (cmp < 0)
+					manifest_write_entry(fp, &manifest.entries[i++]);
+				else
+				{
+					if (!cmp)
+						i++;
+					while (j + 1 < manifest.updates_number && !manifest_entry_cmp(&manifest.updates[j], &manifest.updates[j + 1]))
+						j++;
+					manifest_write_entry(fp, &manifest.updates[j++]);
+				}
+			}
+
+			result = !fflush(fp) && !fsync(fileno(fp));
+			result = !fclose(fp) && result && !rename(tmp_path, manifest.path);
+		}
+		else
+			result = false;
+
+		if (!result)
+			log_info("Warning: cannot update the import manifest %s\n", manifest.path);
+	}
+
+	manifest_free(manifest.entries, manifest.entries_number);
+	manifest_free(manifest.updates, manifest.updates_number);
+	manifest.entries = manifest.updates = NULL;
+	manifest.entries_number = manifest.updates_number = 0;
+	manifest.open = false;
+	pthread_mutex_unlock(&manifest.lock);
+	return result;
+}
@@ -0,0 +1,22 @@
+#ifndef __MANIFEST_H
+#define __MANIFEST_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "definitions.h"
+
+#define LDB_MANIFEST_NAME "import.manifest"
+
+/* Identity of an input file */
+typedef struct ldb_manifest_id_t
+{
+	uint64_t size;
+	int64_t mtime;
+	char md5[MD5_LEN_HEX + 1];
+} ldb_manifest_id_t;
+
+void ldb_manifest_open(char *dbname);
+bool ldb_manifest_unchanged(char *table, char *path);
+bool ldb_manifest_identify(char *path, ldb_manifest_id_t *id);
+void ldb_manifest_record(char *table, char *path, ldb_manifest_id_t *source);
+bool ldb_manifest_close(void);
+#endif
@@ -0,0 +1,366 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/memory.c
+ *
+ * Memory budget shared by import and collate jobs
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file memory.c
+ * @date 18 October 2026
+ * @brief Memory governor.
+ *
+ * The memory limit is the host RAM (/proc/meminfo) or, when the process runs inside a
+ * cgroup v2 with a memory.max, the tightest limit of the cgroup and its ancestors.
+ * Page cache that the kernel can reclaim (inactive_file) is not counted as used.
+ *
+ * MAX_RAM_PERCENT of that limit may be used. The headroom left to reach that point is
+ * the budget: jobs reserve their expected footprint before allocating it and release it
+ * when done. The budget is measured again each time no reservation is outstanding, so it
+ * never counts our own allocations twice.
+ *
+ * The reservations are shared by all the threads, but MAX_RAM_PERCENT is set per thread:
+ * jobs of tables with different settings may run at the same time, each one checked
+ * against the budget of its own table.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "memory.h"
+#include "ldb.h"
+#include "logger.h"
+
+#define LDB_CGROUP_MOUNT_DEFAULT "/sys/fs/cgroup"
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+	uint64_t limit;       // measured limit, 0 if it cannot be read
+	uint64_t available;   // measured headroom
+	uint64_t reserved;
+	bool cgroup;
+	int logged;           // last percent whose budget was logged
+} governor = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, false, 0};
+
+static __thread int memory_percent = LDB_MEMORY_DEFAULT_PERCENT;
+
+static pthread_once_t cgroup_once = PTHREAD_ONCE_INIT;
+static char cgroup_dir[LDB_MAX_PATH] = "";
+static size_t cgroup_root_ln = 0;
+
+/**
+ * @brief Locate the cgroup v2 directory of this process: the cgroup2 mount point
+ * (from /proc/self/mountinfo) followed by the "0::" path of /proc/self/cgroup
+ */
+static void cgroup_locate(void)
+{
+	char mount[LDB_MAX_PATH] = "";
+	char line[LDB_MAX_PATH * 2];
+
+	FILE *fp = fopen("/proc/self/mountinfo", "r");
+	if (fp)
+	{
+		while (fgets(line, sizeof(line), fp))
+		{
+			char *fs = strstr(line, " - ");
+			char point[LDB_MAX_PATH];
+			if (fs && !strncmp(fs + 3, "cgroup2 ", 8) && sscanf(line, "%*s %*s %*s %*s %1023s", point) == 1)
+			{
+				strcpy(mount, point);
+				break;
+			}
+		}
+		fclose(fp);
+	}
+
+	if (!*mount)
+		strcpy(mount, LDB_CGROUP_MOUNT_DEFAULT);
+
+	fp = fopen("/proc/self/cgroup", "r");
+	if (!fp)
+		return;
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (strncmp(line, "0::", 3))
+			continue;
+
+		line[strcspn(line, "\n")] = 0;
+		char *path = line + 3;
+		if (!strcmp(path, "/"))
+			path = "";
+		snprintf(cgroup_dir, sizeof(cgroup_dir), "%s%s", mount, path);
+		cgroup_root_ln = strlen(mount);
+		break;
+	}
+	fclose(fp);
+}
+
+/**
+ * @brief Read a single number from a cgroup file
+ *
+ * @param dir cgroup directory
+ * @param file file name
+ * @param value [out] value
+ * @return false if the file is missing or holds "max"
+ */
+static bool cgroup_read(char *dir, char *file, uint64_t *value)
+{
+	char path[LDB_MAX_PATH * 2];
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return false;
+
+	unsigned long long v = 0;
+	bool ok = fscanf(fp, "%llu", &v) == 1;
+	fclose(fp);
+	*value = v;
+	return ok;
+}
+
+/**
+ * @brief Reclaimable page cache of a cgroup (inactive_file from memory.stat)
+ */
+static uint64_t cgroup_reclaimable(char *dir)
+{
+	char path[LDB_MAX_PATH * 2];
+	snprintf(path, sizeof(path), "%s/memory.stat", dir);
+
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+
+	char line[256];
+	unsigned long long v = 0;
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (sscanf(line, "inactive_file %llu", &v) == 1)
+			break;
+	}
+	fclose(fp);
+	return v;
+}
+
+/**
+ * @brief Walk from our cgroup up to the root and keep the tightest memory.max
+ * and the smallest headroom among the limited levels
+ *
+ * @param limit [out] tightest limit
+ * @param available [out] smallest headroom
+ * @return true if a limit was found
+ */
+static bool cgroup_stats(uint64_t *limit, uint64_t *available)
+{
+	pthread_once(&cgroup_once, cgroup_locate);
+	if (!*cgroup_dir)
+		return false;
+
+	char dir[LDB_MAX_PATH];
+	strcpy(dir, cgroup_dir);
+	bool found = false;
+
+	while (strlen(dir) >= cgroup_root_ln)
+	{
+		uint64_t max = 0, current = 0;
+		if (cgroup_read(dir, "memory.max", &max) && cgroup_read(dir, "memory.current", &current))
+		{
+			uint64_t reclaimable = cgroup_reclaimable(dir);
+			uint64_t used = current > reclaimable ? current - reclaimable : 0;
+			uint64_t headroom = max > used ? max - used : 0;
+
+			if (!found || max < *limit)
+				*limit = max;
+			if (!found || headroom < *available)
+				*available = headroom;
+			found = true;
+		}
+
+		char *slash = strrchr(dir, '/');
+		if (!slash || (size_t) (slash - dir) < cgroup_root_ln)
+			break;
+		*slash = 0;
+	}
+	return found;
+}
+
+/**
+ * @brief Get the effective memory limit and the memory still available to this process
+ *
+ * @param stats [out] memory stats
+ * @return false if the memory information cannot be read
+ */
+bool ldb_memory_stats(ldb_memory_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	FILE *fp = fopen("/proc/meminfo", "r");
+	if (!fp)
+		return false;
+
+	char line[256];
+	unsigned long total_kb = 0, available_kb = 0;
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (sscanf(line, "MemTotal: %lu", &total_kb) == 1)
+			continue;
+		if (sscanf(line, "MemAvailable: %lu", &available_kb) == 1)
+			break;
+	}
+	fclose(fp);
+
+	if (!total_kb || !available_kb)
+		return false;
+
+	stats->limit = (uint64_t) total_kb * 1024;
+	stats->available = (uint64_t) available_kb * 1024;
+
+	uint64_t cg_limit = 0, cg_available = 0;
+	if (cgroup_stats(&cg_limit, &cg_available) && cg_limit < stats->limit)
+	{
+		stats->limit = cg_limit;
+		stats->cgroup = true;
+		if (cg_available < stats->available)
+			stats->available = cg_available;
+	}
+	return true;
+}
+
+/* Measure the limit and the headroom. Called with the governor lock held and no outstanding reservation */
+static void memory_measure(void)
+{
+	ldb_memory_stats_t stats;
+	if (!ldb_memory_stats(&stats))
+	{
+		/* Cannot read, do not restrict */
+		governor.limit = 0;
+		governor.available = UINT64_MAX;
+		return;
+	}
+	governor.limit = stats.limit;
+	governor.available = stats.available;
+	governor.cgroup = stats.cgroup;
+}
+
+/* Budget of the calling thread. Called with the governor lock held */
+static uint64_t memory_budget(void)
+{
+	uint64_t floor = governor.limit / 100 * (100 - memory_percent);
+	return governor.available > floor ? governor.available - floor : 0;
+}
+
+/**
+ * @brief Set the share of the memory limit (MAX_RAM_PERCENT) the budget of the calling thread is based on
+ *
+ * @param max_ram_percent percentage, out of range values select the default
+ */
+void ldb_memory_init(int max_ram_percent)
+{
+	if (max_ram_percent <= 0 || max_ram_percent > 100)
+		max_ram_percent = LDB_MEMORY_DEFAULT_PERCENT;
+	memory_percent = max_ram_percent;
+
+	pthread_mutex_lock(&governor.lock);
+	if (!governor.reserved)
+		memory_measure();
+	/* Threads running jobs of different tables switch percent often, only the first one is logged */
+	if (governor.logged != max_ram_percent && governor.limit)
+	{
+		if (!governor.logged)
+			log_info("Memory budget: %lu MB (limit %lu MB%s, %d%% usable)\n", memory_budget() >> 20,
+				governor.limit >> 20, governor.cgroup ? " from cgroup" : "", max_ram_percent);
+		else
+			log_debug("Memory budget: %lu MB (%d%% usable)\n", memory_budget() >> 20, max_ram_percent);
+		governor.logged = max_ram_percent;
+	}
+	pthread_mutex_unlock(&governor.lock);
+}
+
+/**
+ * @brief MAX_RAM_PERCENT of the calling thread, to be passed on to the threads it starts
+ */
+int ldb_memory_percent(void)
+{
+	return memory_percent;
+}
+
+/**
+ * @brief Current budget of the calling thread in bytes
+ */
+uint64_t ldb_memory_budget(void)
+{
+	pthread_mutex_lock(&governor.lock);
+	if (!governor.reserved)
+		memory_measure();
+	uint64_t budget = memory_budget();
+	pthread_mutex_unlock(&governor.lock);
+	return budget;
+}
+
+/**
+ * @brief Reserve memory from the budget. A caller must not wait for a reservation while
+ * holding another one. When waiting, a request larger than the budget is granted as soon
+ * as nothing else is reserved, so an oversized job runs alone instead of never.
+ *
+ * @param bytes bytes to reserve
+ * @param wait wait for other jobs to release memory if the budget is exhausted
+ * @return true if the memory was reserved
+ */
+bool ldb_memory_reserve(uint64_t bytes, bool wait)
+{
+	bool granted = false;
+
+	pthread_mutex_lock(&governor.lock);
+	while (true)
+	{
+		if (!governor.reserved)
+			memory_measure();
+
+		if (governor.reserved + bytes <= memory_budget() || (wait && !governor.reserved))
+		{
+			governor.reserved += bytes;
+			granted = true;
+			break;
+		}
+
+		if (!wait)
+			break;
+
+		log_debug("Memory budget exhausted (%lu MB reserved, %lu MB requested), waiting\n",
+			governor.reserved >> 20, bytes >> 20);
+		pthread_cond_wait(&governor.released, &governor.lock);
+	}
+	pthread_mutex_unlock(&governor.lock);
+	return granted;
+}
+
+/**
+ * @brief Return a reservation to the budget
+ *
+ * @param bytes bytes reserved with ldb_memory_reserve
+ */
+void ldb_memory_release(uint64_t bytes)
+{
+	pthread_mutex_lock(&governor.lock);
+	governor.reserved = governor.reserved > bytes ? governor.reserved - bytes : 0;
+	pthread_cond_broadcast(&governor.released);
+	pthread_mutex_unlock(&governor.lock);
+}
@@ -0,0 +1,21 @@
+#ifndef __MEMORY_H
+#define __MEMORY_H
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LDB_MEMORY_DEFAULT_PERCENT 50
+
+typedef struct ldb_memory_stats_t
+{
+	uint64_t limit;      // Effective memory limit in bytes (host RAM or cgroup memory.max)
+	uint64_t available;  // Bytes that can still be used before reaching the limit
+	bool cgroup;         // The limit comes from a cgroup v2 memory.max
+} ldb_memory_stats_t;
+
+bool ldb_memory_stats(ldb_memory_stats_t *stats);
+void ldb_memory_init(int max_ram_percent);
+int ldb_memory_percent(void);
+uint64_t ldb_memory_budget(void);
+bool ldb_memory_reserve(uint64_t bytes, bool wait);
+void ldb_memory_release(uint64_t bytes);
+#endif
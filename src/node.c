@@ -23,6 +23,7 @@
  #include "ldb.h"
 #include "logger.h"
 #include "ldb_error.h"
+#include "writeback.h"
 
 /**
   * NODE STRUCTURE
@@ -216,6 +217,10 @@ int ldb_node_write (struct ldb_table table, FILE *ldb_sector, uint8_t *key, uint
 	/* Update list pointers */
 	ldb_update_list_pointers(ldb_sector, key, list, new_node);
 
+	/* Keep temporary sectors out of the page cache */
+	if (table.tmp)
+		ldb_writeback_pace(ldb_sector, new_node + node_ptr);
+
 	free(node);
 	return LDB_ERROR_NOERROR;
 }
@@ -0,0 +1,486 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/pool.c
+ *
+ * Persistent worker pool used by the importer
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file pool.c
+ * @date 18 October 2026
+ * @brief Work-stealing thread pool.
+ *
+ * Every worker owns a deque of tasks. Tasks submitted from outside the pool are
+ * distributed round-robin, tasks submitted by a worker go to its own deque. A worker
+ * takes tasks from the head of its deque and, when it runs dry, steals from the tail
+ * of the others. Idle workers sleep on a condition variable, and task completion is
+ * signalled the same way, so nobody polls.
+ *
+ * Only the first "active" workers take tasks, the others sleep until the active count
+ * grows again (see ldb_pool_set_active). Tasks left in the deque of a worker that was
+ * deactivated are stolen by the active ones.
+ *
+ * Workers also keep a set of reusable buffers, so consecutive jobs do not have to
+ * allocate (and fault in) the same multi-MB areas again.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include "pool.h"
+
+#define LDB_POOL_DEQUE_SIZE 64
+
+typedef struct pool_task_t
+{
+	ldb_pool_task_fn fn;
+	void *arg;
+} pool_task_t;
+
+typedef struct pool_worker_t
+{
+	int id;
+	ldb_pool_t *pool;
+	pthread_mutex_t lock;
+	pool_task_t *tasks; // ring buffer
+	int head;
+	int count;
+	int size;
+	void *buffers[LDB_POOL_BUFFERS];
+	size_t buffers_size[LDB_POOL_BUFFERS];
+} pool_worker_t;
+
+struct ldb_pool_t
+{
+	int workers_number;
+	atomic_int active;   // workers allowed to take tasks
+	pthread_t *threads;
+	pool_worker_t *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t work; // tasks queued or shutdown
+	pthread_cond_t done; // a task has finished
+	int queued;
+	int running;
+	int outstanding;
+	int next;
+	bool shutdown;
+};
+
+static __thread pool_worker_t *current_worker = NULL;
+
+static void pool_push(pool_worker_t *w, pool_task_t task)
+{
+	pthread_mutex_lock(&w->lock);
+	if (w->count == w->size)
+	{
+		pool_task_t *tasks = malloc(2 * w->size * sizeof(pool_task_t));
+		for (int i = 0; i < w->count; i++)
+			tasks[i] = w->tasks[(w->head + i) % w->size];
+		free(w->tasks);
+		w->tasks = tasks;
+		w->head = 0;
+		w->size *= 2;
+	}
+	w->tasks[(w->head + w->count) % w->size] = task;
+	w->count++;
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* Owner side: take the oldest task */
+static bool pool_pop(pool_worker_t *w, pool_task_t *task)
+{
+	bool found = false;
+	pthread_mutex_lock(&w->lock);
+	if (w->count)
+	{
+		*task = w->tasks[w->head];
+		w->head = (w->head + 1) % w->size;
+		w->count--;
+		found = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return found;
+}
+
+/* Thief side: take the newest task */
+static bool pool_steal(ldb_pool_t *pool, pool_worker_t *thief, pool_task_t *task)
+{
+	for (int i = 1; i < pool->workers_number; i++)
+	{
+		pool_worker_t *w = &pool->workers[(thief->id + i) % pool->workers_number];
+		bool found = false;
+		pthread_mutex_lock(&w->lock);
+		if (w->count)
+		{
+			w->count--;
+			*task = w->tasks[(w->head + w->count) % w->size];
+			found = true;
+		}
+		pthread_mutex_unlock(&w->lock);
+		if (found)
+			return true;
+	}
+	return false;
+}
+
+static void *pool_worker(void *ptr)
+{
+	pool_worker_t *w = ptr;
+	ldb_pool_t *pool = w->pool;
+	current_worker = w;
+
+	while (true)
+	{
+		pool_task_t task;
+		if (w->id < atomic_load(&pool->active) && (pool_pop(w, &task) || pool_steal(pool, w, &task)))
+		{
+			pthread_mutex_lock(&pool->lock);
+			pool->queued--;
+			pool->running++;
+			pthread_mutex_unlock(&pool->lock);
+
+			task.fn(task.arg);
+
+			pthread_mutex_lock(&pool->lock);
+			pool->running--;
+			pool->outstanding--;
+			pthread_cond_broadcast(&pool->done);
+			pthread_mutex_unlock(&pool->lock);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		while ((pool->queued <= 0 || w->id >= atomic_load(&pool->active)) && !pool->shutdown)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		bool stop = pool->shutdown && (pool->queued <= 0 || w->id >= atomic_load(&pool->active));
+		pthread_mutex_unlock(&pool->lock);
+		if (stop)
+			break;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Create a pool and start its workers
+ *
+ * @param workers number of workers, at least one is always started
+ * @return pool, NULL on failure
+ */
+ldb_pool_t *ldb_pool_create(int workers)
+{
+	if (workers < 1)
+		workers = 1;
+
+	ldb_pool_t *pool = calloc(1, sizeof(ldb_pool_t));
+	pool->threads = calloc(workers, sizeof(pthread_t));
+	pool->workers = calloc(workers, sizeof(pool_worker_t));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (int i = 0; i < workers; i++)
+	{
+		pool_worker_t *w = &pool->workers[i];
+		w->id = i;
+		w->pool = pool;
+		w->size = LDB_POOL_DEQUE_SIZE;
+		w->tasks = malloc(w->size * sizeof(pool_task_t));
+		pthread_mutex_init(&w->lock, NULL);
+	}
+
+	atomic_store(&pool->active, workers);
+	for (int i = 0; i < workers; i++)
+	{
+		if (pthread_create(&pool->threads[i], NULL, pool_worker, &pool->workers[i]))
+			break;
+		pool->workers_number++;
+	}
+
+	/* Workers that could not be started never get tasks */
+	for (int i = pool->workers_number; i < workers; i++)
+	{
+		free(pool->workers[i].tasks);
+		pthread_mutex_destroy(&pool->workers[i].lock);
+	}
+
+	if (!pool->workers_number)
+	{
+		ldb_pool_destroy(pool);
+		return NULL;
+	}
+	atomic_store(&pool->active, pool->workers_number);
+	return pool;
+}
+
+/**
+ * @brief Queue a task. Tasks submitted from a worker are queued on its own deque
+ *
+ * @param pool pool
+ * @param fn task function
+ * @param arg task argument
+ * @return true if the task was queued
+ */
+bool ldb_pool_submit(ldb_pool_t *pool, ldb_pool_task_fn fn, void *arg)
+{
+	if (!pool)
+		return false;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->shutdown)
+	{
+		pthread_mutex_unlock(&pool->lock);
+		return false;
+	}
+	pool_worker_t *w = current_worker;
+	if (!w || w->pool != pool)
+		w = &pool->workers[pool->next++ % atomic_load(&pool->active)];
+
+	pool_push(w, (pool_task_t) {.fn = fn, .arg = arg});
+	pool->queued++;
+	pool->outstanding++;
+
+	/* Inactive workers wait on the same condition, they must not swallow the wake up */
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	return true;
+}
+
+/**
+ * @brief Wait until every submitted task has finished. Must not be called from a worker
+ *
+ * @param pool pool
+ */
+void ldb_pool_wait(ldb_pool_t *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->outstanding > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Wait until every submitted task has finished, or the timeout expires.
+ * Must not be called from a worker
+ *
+ * @param pool pool
+ * @param timeout_ms timeout in milliseconds
+ * @return true if every task has finished
+ */
+bool ldb_pool_wait_timeout(ldb_pool_t *pool, int timeout_ms)
+{
+	if (!pool)
+		return true;
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->outstanding > 0)
+		if (pthread_cond_timedwait(&pool->done, &pool->lock, &deadline) == ETIMEDOUT)
+			break;
+	bool finished = pool->outstanding <= 0;
+	pthread_mutex_unlock(&pool->lock);
+	return finished;
+}
+
+/**
+ * @brief Set the number of workers that take tasks. A worker running a task when it
+ * is deactivated finishes it first.
+ *
+ * @param pool pool
+ * @param active active workers, between one and the pool size
+ */
+void ldb_pool_set_active(ldb_pool_t *pool, int active)
+{
+	if (!pool)
+		return;
+
+	if (active < 1)
+		active = 1;
+	if (active > pool->workers_number)
+		active = pool->workers_number;
+
+	pthread_mutex_lock(&pool->lock);
+	atomic_store(&pool->active, active);
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int ldb_pool_active(ldb_pool_t *pool)
+{
+	return pool ? atomic_load(&pool->active) : 0;
+}
+
+/**
+ * @brief Number of tasks waiting for a worker
+ */
+int ldb_pool_queued(ldb_pool_t *pool)
+{
+	if (!pool)
+		return 0;
+
+	pthread_mutex_lock(&pool->lock);
+	int queued = pool->queued;
+	pthread_mutex_unlock(&pool->lock);
+	return queued;
+}
+
+/**
+ * @brief Drop the queued tasks that have not started yet. Their arguments are not released
+ *
+ * @param pool pool
+ * @return number of dropped tasks
+ */
+int ldb_pool_cancel(ldb_pool_t *pool)
+{
+	if (!pool)
+		return 0;
+
+	int dropped = 0;
+	pthread_mutex_lock(&pool->lock);
+	for (int i = 0; i < pool->workers_number; i++)
+	{
+		pool_worker_t *w = &pool->workers[i];
+		pthread_mutex_lock(&w->lock);
+		dropped += w->count;
+		w->head = 0;
+		w->count = 0;
+		pthread_mutex_unlock(&w->lock);
+	}
+	pool->queued -= dropped;
+	pool->outstanding -= dropped;
+	pthread_cond_broadcast(&pool->done);
+	pthread_mutex_unlock(&pool->lock);
+	return dropped;
+}
+
+/**
+ * @brief Release the workers' buffers. The pool must be idle (see ldb_pool_wait)
+ *
+ * @param pool pool
+ */
+void ldb_pool_trim(ldb_pool_t *pool)
+{
+	if (!pool)
+		return;
+
+	for (int i = 0; i < pool->workers_number; i++)
+		for (int j = 0; j < LDB_POOL_BUFFERS; j++)
+		{
+			free(pool->workers[i].buffers[j]);
+			pool->workers[i].buffers[j] = NULL;
+			pool->workers[i].buffers_size[j] = 0;
+		}
+}
+
+/**
+ * @brief Finish the queued tasks, stop the workers and free the pool
+ *
+ * @param pool pool
+ */
+void ldb_pool_destroy(ldb_pool_t *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->workers_number; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	ldb_pool_trim(pool);
+	for (int i = 0; i < pool->workers_number; i++)
+	{
+		free(pool->workers[i].tasks);
+		pthread_mutex_destroy(&pool->workers[i].lock);
+	}
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool->threads);
+	free(pool);
+}
+
+int ldb_pool_workers(ldb_pool_t *pool)
+{
+	return pool ? pool->workers_number : 0;
+}
+
+/**
+ * @brief Worker thread ids (used by the logger to assign a screen line per worker)
+ *
+ * @param pool pool
+ * @return thread list
+ */
+pthread_t *ldb_pool_threads(ldb_pool_t *pool)
+{
+	return pool ? pool->threads : NULL;
+}
+
+/**
+ * @brief Get a buffer of at least "size" bytes. Inside a worker the buffer is owned by the
+ * worker and kept between tasks, its content is undefined. Outside a worker it is a plain allocation.
+ *
+ * @param slot buffer slot
+ * @param size required size
+ * @return buffer, NULL if memory is not available
+ */
+void *ldb_pool_buffer(ldb_pool_buffer_t slot, size_t size)
+{
+	pool_worker_t *w = current_worker;
+	if (!w)
+		return malloc(size);
+
+	if (w->buffers_size[slot] < size)
+	{
+		free(w->buffers[slot]);
+		w->buffers[slot] = malloc(size);
+		w->buffers_size[slot] = w->buffers[slot] ? size : 0;
+	}
+	return w->buffers[slot];
+}
+
+/**
+ * @brief Release a buffer obtained with ldb_pool_buffer
+ *
+ * @param ptr buffer
+ */
+void ldb_pool_buffer_release(void *ptr)
+{
+	pool_worker_t *w = current_worker;
+	if (w)
+		for (int i = 0; i < LDB_POOL_BUFFERS; i++)
+			if (w->buffers[i] == ptr)
+				return;
+	free(ptr);
+}
@@ -0,0 +1,34 @@
+#ifndef __POOL_H
+#define __POOL_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* Per-worker reusable buffers */
+typedef enum {
+	LDB_POOL_BUFFER_ITEM = 0,     // CSV node assembly buffer
+	LDB_POOL_BUFFER_WFP_BATCH,    // WFP node batch
+	LDB_POOL_BUFFER_WFP_BATCH_NEXT, // WFP node batch being written
+	LDB_POOL_BUFFER_COLLATE,      // Collate data
+	LDB_POOL_BUFFER_COLLATE_TMP,  // Collate tmp data
+	LDB_POOL_BUFFERS
+} ldb_pool_buffer_t;
+
+typedef void (*ldb_pool_task_fn)(void *arg);
+typedef struct ldb_pool_t ldb_pool_t;
+
+ldb_pool_t *ldb_pool_create(int workers);
+bool ldb_pool_submit(ldb_pool_t *pool, ldb_pool_task_fn fn, void *arg);
+void ldb_pool_wait(ldb_pool_t *pool);
+bool ldb_pool_wait_timeout(ldb_pool_t *pool, int timeout_ms);
+void ldb_pool_set_active(ldb_pool_t *pool, int active);
+int ldb_pool_active(ldb_pool_t *pool);
+int ldb_pool_queued(ldb_pool_t *pool);
+int ldb_pool_cancel(ldb_pool_t *pool);
+void ldb_pool_trim(ldb_pool_t *pool);
+void ldb_pool_destroy(ldb_pool_t *pool);
+int ldb_pool_workers(ldb_pool_t *pool);
+pthread_t *ldb_pool_threads(ldb_pool_t *pool);
+void *ldb_pool_buffer(ldb_pool_buffer_t slot, size_t size);
+void ldb_pool_buffer_release(void *ptr);
+#endif
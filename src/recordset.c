@@ -78,6 +78,10 @@ uint32_t ldb_fetch_recordset(uint8_t *sector, struct ldb_table table, uint8_t* k
 	uint32_t records = 0;
 	bool done = false;
 	logger_dbname_set(table.db);
+
+	/* Records deleted by tombstones are skipped */
+	ldb_tombstones_t *tombstones = ldb_tombstones_get(table, key);
+	uint8_t *kept = NULL;
 	do
 	{
 		/* Read node */
@@ -92,7 +96,14 @@ uint32_t ldb_fetch_recordset(uint8_t *sector, struct ldb_table table, uint8_t* k
 			break; // reached end of list
 
 		/* Pass entire node (fixed record length) to handler */
-		if (table.rec_ln) 
+		if (table.rec_ln && tombstones)
+		{
+			kept = realloc(kept, node_size);
+			uint32_t kept_size = ldb_tombstones_fixed(tombstones, key, node, node_size, kept);
+			if (kept_size)
+				done = ldb_record_handler(key, NULL, 0 , kept, kept_size, records++, void_ptr);
+		}
+		else if (table.rec_ln) 
 			done = ldb_record_handler(key, NULL, 0 , node, node_size, records++, void_ptr);
 
 		/* Extract and pass variable-size records to handler */
@@ -131,8 +142,8 @@ uint32_t ldb_fetch_recordset(uint8_t *sector, struct ldb_table table, uint8_t* k
 						int record_size = uint16_read(dataset + dataset_ptr);
 						dataset_ptr += 2;
 
-						/* We drop records longer than the desired limit */
-						if (record_size + 32 < LDB_MAX_REC_LN)
+						/* We drop records longer than the desired limit, and the records deleted */
+						if (record_size + 32 < LDB_MAX_REC_LN && !(tombstones && ldb_tombstones_record(tombstones, key, subkey, subkey_ln, dataset + dataset_ptr, record_size)))
 							done = ldb_record_handler(key, subkey, subkey_ln, dataset + dataset_ptr, record_size, records++, void_ptr);
 						if (done)
 							break;
@@ -146,6 +157,8 @@ uint32_t ldb_fetch_recordset(uint8_t *sector, struct ldb_table table, uint8_t* k
 		}
 	} while (next && !done);
 
+	free(kept);
+	ldb_tombstones_release(tombstones);
 	if (!sector)
 	{
 		free(node);
@@ -179,6 +192,13 @@ uint32_t ldb_fetch_recordset_v2(ldb_sector_t * sector, struct ldb_table table, u
 
 	uint32_t records = 0;
 	bool done = false;
+
+	/* Records deleted by tombstones are skipped */
+	ldb_tombstones_t *tombstones = ldb_tombstones_get(table, key);
+	uint8_t *kept = NULL;
+
+	/* A stream given by the caller is left open (it may hold the lock of the sector) */
+	bool opened = !sector->data && !sector->file;
 	do
 	{
 		/* Read node */
@@ -197,7 +217,14 @@ uint32_t ldb_fetch_recordset_v2(ldb_sector_t * sector, struct ldb_table table, u
 			break; // reached end of list
 
 		/* Pass entire node (fixed record length) to handler */
-		if (table.rec_ln)
+		if (table.rec_ln && tombstones)
+		{
+			kept = realloc(kept, node_size);
+			uint32_t kept_size = ldb_tombstones_fixed(tombstones, key, node, node_size, kept);
+			if (kept_size)
+				done = ldb_record_handler(key, NULL, 0 , kept, kept_size, records++, void_ptr);
+		}
+		else if (table.rec_ln)
 			done = ldb_record_handler(key, NULL, 0 , node, node_size, records++, void_ptr);
 
 		/* Extract and pass variable-size records to handler */
@@ -239,8 +266,8 @@ uint32_t ldb_fetch_recordset_v2(ldb_sector_t * sector, struct ldb_table table, u
 						/* Get record length */
 						int record_size = uint16_read(dataset + dataset_ptr);
 						dataset_ptr += 2;
-						/* We drop records longer than the desired limit */
-						if (record_size + 32 < LDB_MAX_REC_LN){
+						/* We drop records longer than the desired limit, and the records deleted */
+						if (record_size + 32 < LDB_MAX_REC_LN && !(tombstones && ldb_tombstones_record(tombstones, key, subkey, subkey_ln, dataset + dataset_ptr, record_size))){
 							done = ldb_record_handler(key, subkey, subkey_ln, dataset + dataset_ptr, record_size, records++, void_ptr);
 							if (done)
 								break;
@@ -263,8 +290,11 @@ uint32_t ldb_fetch_recordset_v2(ldb_sector_t * sector, struct ldb_table table, u
 
 	} while (next && !done);
 
+	free(kept);
+	ldb_tombstones_release(tombstones);
+
 	/* Close sector file if it was opened during processing */
-	if (sector->file)
+	if (opened && sector->file)
 	{
 		fclose(sector->file);
 		sector->file = NULL;
@@ -0,0 +1,299 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/scan.c
+ *
+ * Sequential sector scan
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file scan.c
+ * @date 18 October 2026
+ * @brief Read every record of a sector on disk in file order.
+ *
+ * Nodes do not carry their key: a node belongs to the list that links to it. Nodes are
+ * appended to the sector, so a node is stored after the one linking to it. The scan reads
+ * the sector front to back in LDB_SCAN_BLOCK blocks, visiting the list heads (from the
+ * map, in offset order) and the pending next nodes (a min-heap of offsets) always moving
+ * forwards. Only the map and one pending node per list are held in memory.
+ *
+ * A list with a node pointing backwards (which appending never produces) is set aside
+ * and finished with random reads once the forward pass is over.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "ldb.h"
+#include "logger.h"
+
+/* Node reader over the sector file */
+typedef struct scan_reader_t
+{
+	int fd;
+	uint8_t *buffer;
+	size_t size;
+	uint64_t start;      // sector offset of the buffer
+	size_t length;       // bytes in the buffer
+} scan_reader_t;
+
+/* Get "n" bytes at "offset" of the sector, read in blocks */
+static uint8_t *scan_read(scan_reader_t *reader, uint64_t offset, size_t n)
+{
+	if (reader->length && offset >= reader->start && offset + n <= reader->start + reader->length)
+		return reader->buffer + (offset - reader->start);
+
+	if (n > reader->size)
+	{
+		uint8_t *buffer = realloc(reader->buffer, n);
+		if (!buffer)
+			return NULL;
+		reader->buffer = buffer;
+		reader->size = n;
+	}
+
+	ssize_t r = pread(reader->fd, reader->buffer, reader->size, offset);
+	if (r < (ssize_t) n)
+	{
+		reader->length = 0;
+		return NULL;
+	}
+	reader->start = offset;
+	reader->length = r;
+	return reader->buffer;
+}
+
+static void offset_heap_up(uint64_t *heap, size_t i)
+{
+	while (i && heap[(i - 1) / 2] > heap[i])
+	{
+		uint64_t t = heap[i];
+		heap[i] = heap[(i - 1) / 2];
+		heap[(i - 1) / 2] = t;
+		i = (i - 1) / 2;
+	}
+}
+
+static void offset_heap_down(uint64_t *heap, size_t n, size_t i)
+{
+	while (true)
+	{
+		size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+		if (l < n && heap[l] < heap[min])
+			min = l;
+		if (r < n && heap[r] < heap[min])
+			min = r;
+		if (min == i)
+			return;
+		uint64_t t = heap[i];
+		heap[i] = heap[min];
+		heap[min] = t;
+		i = min;
+	}
+}
+
+/**
+ * @brief Pass the records of a node to the handler, as ldb_fetch_recordset does: a node of
+ * fixed records is passed whole, variable records are passed one by one with their subkey.
+ *
+ * @return true if the handler asked to stop
+ */
+static bool scan_node_records(struct ldb_table table, ldb_tombstones_t *tombstones, uint8_t *key, uint8_t *node, uint32_t node_size, uint32_t *records,
+	bool (*handler) (uint8_t *, uint8_t *, int, uint8_t *, uint32_t, int, void *), void *ptr)
+{
+	/* Records deleted by tombstones are skipped */
+	if (tombstones && !ldb_tombstones_listed(tombstones, key))
+		tombstones = NULL;
+
+	if (table.rec_ln)
+	{
+		if (node_size > 64800)
+			node_size = 64800;
+		if (!tombstones)
+			return handler(key, NULL, 0, node, node_size, (*records)++, ptr);
+
+		uint8_t kept[node_size];
+		uint32_t kept_size = ldb_tombstones_fixed(tombstones, key, node, node_size, kept);
+		return kept_size && handler(key, NULL, 0, kept, kept_size, (*records)++, ptr);
+	}
+
+	int subkey_ln = table.key_ln - LDB_KEY_LN;
+	if (!ldb_validate_node(node, node_size, subkey_ln))
+		return false;
+
+	/* Datasets: subkey, dataset size and records (size and data) */
+	uint32_t node_ptr = 0;
+	while (node_ptr < node_size)
+	{
+		uint8_t *subkey = node + node_ptr;
+		node_ptr += subkey_ln;
+		uint32_t dataset_size = uint16_read(node + node_ptr);
+		node_ptr += 2;
+
+		uint8_t *dataset = node + node_ptr;
+		for (uint32_t dataset_ptr = 0; dataset_ptr < dataset_size;)
+		{
+			uint32_t record_size = uint16_read(dataset + dataset_ptr);
+			dataset_ptr += 2;
+			if (record_size + 32 < LDB_MAX_REC_LN && !(tombstones && ldb_tombstones_record(tombstones, key, subkey, subkey_ln, dataset + dataset_ptr, record_size)) &&
+				handler(key, subkey, subkey_ln, dataset + dataset_ptr, record_size, (*records)++, ptr))
+				return true;
+			dataset_ptr += record_size;
+		}
+		node_ptr += dataset_size;
+	}
+	return false;
+}
+
+/**
+ * @brief Read a node and pass its records to the handler
+ *
+ * @param next [out] next node of the list, 0 at the end
+ * @return false if the node cannot be read or the handler asked to stop
+ */
+static bool scan_node(scan_reader_t *reader, struct ldb_table table, ldb_tombstones_t *tombstones, uint8_t id, uint64_t node, uint64_t *next, uint32_t *records,
+	bool (*handler) (uint8_t *, uint8_t *, int, uint8_t *, uint32_t, int, void *), void *ptr)
+{
+	uint64_t offset = node >> 24;
+	uint32_t position = node & 0xFFFFFF;
+	int header_ln = LDB_PTR_LN + table.ts_ln;
+
+	uint8_t *header = scan_read(reader, offset, header_ln);
+	if (!header)
+	{
+		log_info("Error reading sector %02x: cannot read node at %lu\n", id, offset);
+		return false;
+	}
+
+	*next = uint40_read(header);
+	uint32_t node_size = table.ts_ln == 2 ? uint16_read(header + LDB_PTR_LN) : uint32_read(header + LDB_PTR_LN);
+	if (table.rec_ln)
+		node_size *= table.rec_ln;
+
+	/* A deleted node has no data, its next node is still followed */
+	if (!node_size)
+		return true;
+
+	uint8_t *data = scan_read(reader, offset, header_ln + node_size);
+	if (!data)
+	{
+		log_info("Error reading sector %02x: cannot read node at %lu (%u bytes)\n", id, offset, node_size);
+		return false;
+	}
+
+	uint8_t key[LDB_KEY_LN] = {id, position >> 16, position >> 8, position};
+	return !scan_node_records(table, tombstones, key, data + header_ln, node_size, records, handler, ptr);
+}
+
+/**
+ * @brief Pass every record of a sector on disk to a record handler, reading the sector in file
+ * order. The records of a list are passed in list order, but the lists are interleaved as
+ * their nodes are stored.
+ *
+ * @param table table
+ * @param file open sector
+ * @param it disk mode iterator of the sector (list offsets in offset order)
+ * @param handler record handler (same as ldb_fetch_recordset). Returning true stops the scan
+ * @param ptr passed to the handler
+ * @return false if the sector cannot be read or the handler stopped the scan
+ */
+bool ldb_sector_scan(struct ldb_table table, FILE *file, ldb_sector_iterator_t *it,
+	bool (*handler) (uint8_t *, uint8_t *, int, uint8_t *, uint32_t, int, void *), void *ptr)
+{
+	if (it->map || !file)
+		return false;
+
+	scan_reader_t reader = {.fd = fileno(file), .size = LDB_SCAN_BLOCK};
+	reader.buffer = malloc(reader.size);
+
+	/* Pending next nodes (node offset << 24 | map position), at most one per list */
+	uint64_t *heap = malloc((it->number + 1) * sizeof(uint64_t));
+	uint64_t *deferred = NULL;
+	size_t heap_n = 0, deferred_n = 0;
+	if (!reader.buffer || !heap)
+	{
+		free(reader.buffer);
+		free(heap);
+		return false;
+	}
+	posix_fadvise(reader.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	ldb_tombstones_t *tombstones = ldb_tombstones_get(table, NULL);
+
+	uint32_t head = 0;
+	uint32_t records = 0;
+	bool ok = true;
+	while (ok && (head < it->number || heap_n))
+	{
+		/* The first node of a list follows its header (the last node pointer) */
+		uint64_t node;
+		uint64_t first = head < it->number ? it->list[head] + ((uint64_t) LDB_PTR_LN << 24) : UINT64_MAX;
+		if (heap_n && heap[0] < first)
+		{
+			node = heap[0];
+			heap[0] = heap[--heap_n];
+			offset_heap_down(heap, heap_n, 0);
+		}
+		else
+		{
+			node = first;
+			head++;
+		}
+
+		uint64_t next;
+		ok = scan_node(&reader, table, tombstones, it->id, node, &next, &records, handler, ptr);
+		if (!ok || !next || next == node >> 24)
+			continue;
+
+		uint64_t pending = next << 24 | (node & 0xFFFFFF);
+		if (next > node >> 24)
+		{
+			heap[heap_n] = pending;
+			offset_heap_up(heap, heap_n++);
+		}
+		else
+		{
+			deferred = realloc(deferred, (deferred_n + 1) * sizeof(uint64_t));
+			deferred[deferred_n++] = pending;
+		}
+	}
+
+	/* Lists pointing backwards are followed node by node. A list cannot have more nodes than fit in the file */
+	if (ok && deferred_n)
+		log_info("Sector %02x: %lu lists point backwards, reading them node by node\n", it->id, deferred_n);
+	off_t max_nodes = lseek(reader.fd, 0, SEEK_END) / (LDB_PTR_LN + table.ts_ln);
+	for (size_t i = 0; ok && i < deferred_n; i++)
+	{
+		uint64_t node = deferred[i], next;
+		for (off_t n = 0; (ok = scan_node(&reader, table, tombstones, it->id, node, &next, &records, handler, ptr)) && next && next != node >> 24; n++)
+		{
+			if (n == max_nodes)
+			{
+				log_info("Error reading sector %02x: the list of node %lu has a loop\n", it->id, deferred[i] >> 24);
+				ok = false;
+				break;
+			}
+			node = next << 24 | (node & 0xFFFFFF);
+		}
+	}
+
+	ldb_tombstones_release(tombstones);
+	free(deferred);
+	free(heap);
+	free(reader.buffer);
+	return ok;
+}
@@ -26,7 +26,10 @@
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <sys/stat.h>
 #include "ldb_string.h"
+#include "logger.h"
+#include "writeback.h"
 /**
   * @file sector.c
   * @date 12 Jul 2020
@@ -88,6 +91,8 @@ FILE *lock_file(const char *filename, int wait_s, const char *mode)
 
 int ldb_close_unlock(FILE *fp) 
 {
+    ldb_writeback_finish(fp);
+
     int fd = fileno(fp);
     struct flock fl;
     fl.l_type = F_UNLCK;
@@ -276,7 +281,8 @@ uint8_t *ldb_load_sector(struct ldb_table table, uint8_t *key) {
  */
 ldb_sector_t ldb_load_sector_v2(struct ldb_table table, uint8_t *key) {
 
-	ldb_sector_t sector = {.data = NULL, .id = *key, .size = 0};
+	/* Taken before opening: a sector published meanwhile is seen as not current */
+	ldb_sector_t sector = {.data = NULL, .id = *key, .size = 0, .generation = ldb_sector_generation(table, *key)};
 	FILE *ldb_sector = ldb_open(table, key, "r");
 	
 	if (!ldb_sector) 
@@ -324,29 +330,80 @@ uint8_t *ldb_load_new_sector(struct ldb_table table, uint8_t *key) {
 }
 
 /**
- * @brief Create an empty data sector (empty map)
+ * @brief Create an empty data sector (empty map). The map is created sparse,
+ * its blocks are allocated as the lists are written.
  * 
  * @param sector_path Path to the sector
  */
 void ldb_create_sector(char *sector_path)
 {
-	uint8_t *ldb_empty_map = calloc(LDB_MAP_SIZE, 1);
-
-	FILE *ldb_map = fopen(sector_path, "w");
-	if (!ldb_map)
+	int fd = open(sector_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
 	{
 		ldb_error("E065 Cannot access ldb table. Check permissions.");
 		exit(EXIT_FAILURE);
 	}
-	fwrite(ldb_empty_map, LDB_MAP_SIZE, 1, ldb_map);
-	fclose(ldb_map);
 
-	free(ldb_empty_map);
+	if (ftruncate(fd, LDB_MAP_SIZE))
+	{
+		close(fd);
+		unlink(sector_path);
+		ldb_error("E065 Cannot create ldb sector.");
+	}
+	close(fd);
+}
+
+/**
+ * @brief Preallocate disk space past the end of a sector for the data about to be appended,
+ * so it is laid out in a few extents. The file size does not change. It is only a hint:
+ * it is ignored by file systems without fallocate. Unused space is released by ldb_sector_trim.
+ *
+ * @param sector sector opened for writing
+ * @param bytes expected size of the data
+ */
+void ldb_sector_preallocate(FILE *sector, uint64_t bytes)
+{
+	struct stat st;
+	if (!sector || !bytes || fstat(fileno(sector), &st))
+		return;
+
+	if (fallocate(fileno(sector), FALLOC_FL_KEEP_SIZE, st.st_size, bytes) && errno != EOPNOTSUPP)
+		log_debug("Cannot preallocate %lu bytes: %s\n", bytes, strerror(errno));
+}
+
+/**
+ * @brief Release the space preallocated past the end of a sector and left unused
+ *
+ * @param sector sector opened for writing
+ */
+void ldb_sector_trim(FILE *sector)
+{
+	struct stat st;
+	fflush(sector);
+	if (!fstat(fileno(sector), &st) && ftruncate(fileno(sector), st.st_size))
+		log_debug("Cannot trim sector: %s\n", strerror(errno));
+}
+
+/* Make a directory entry (a rename) durable */
+static void sector_dir_sync(struct ldb_table table)
+{
+	char dir[LDB_MAX_PATH];
+	snprintf(dir, sizeof(dir), "%s/%s/%s", ldb_root, table.db, table.table);
+	int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	if (fsync(fd))
+		log_debug("Cannot sync %s: %s\n", dir, strerror(errno));
+	close(fd);
 }
 
 /**
  * @brief Moves sector.tmp into sector.ldb
  * Copy a temporary sector into a permanent sector.
+ *
+ * The .tmp is made durable and renamed over the .ldb, which replaces it atomically: a reader
+ * opening the sector finds either the old or the new one, and a reader holding the old one
+ * keeps reading it until it reopens. The sector is then published with a new generation.
  * 
  * @param table Instance of the table struct.
  * @param key Key of the sector.
@@ -358,19 +415,23 @@ void ldb_sector_update(struct ldb_table table, uint8_t *key)
 	sprintf(sector_ldb, "%s/%s/%s/%02x.ldb", ldb_root, table.db, table.table, key[0]);
 	sprintf(sector_tmp, "%s/%s/%s/%02x.tmp", ldb_root, table.db, table.table, key[0]);
 
-	if (!ldb_file_exists(sector_tmp))
+	int fd = open(sector_tmp, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
 	{
 		printf("%s\n", sector_tmp);
 		ldb_error("E074 Cannot update sector with .tmp ");
 	}
+	if (fdatasync(fd))
+		log_info("Warning: cannot sync %s: %s\n", sector_tmp, strerror(errno));
+	close(fd);
 
-	if (ldb_file_exists(sector_ldb) && unlink(sector_ldb))
-		ldb_error("E074 Cannot update sector with .tmp, cannot remove old .ldb file.");
-	
-	if (!rename(sector_tmp, sector_ldb)) 
-		return;
+	if (rename(sector_tmp, sector_ldb))
+		ldb_error("E074 Error replacing sector with .tmp");
+	sector_dir_sync(table);
 
-	ldb_error("E074 Error replacing sector with .tmp");
+	/* The new sector has not been collated (yet) */
+	ldb_collate_state_save(table, key[0], NULL);
+	ldb_sector_publish(table, key[0]);
 }
 
 /**
@@ -391,7 +452,12 @@ void ldb_sector_erase(struct ldb_table table, uint8_t *key)
 		ldb_error("E074 Cannot erase sector");
 	}
 
-	if (!unlink(sector_ldb)) return;
+	if (!unlink(sector_ldb))
+	{
+		ldb_collate_state_save(table, key[0], NULL);
+		ldb_sector_publish(table, key[0]);
+		return;
+	}
 
 	ldb_error("E074 Error erasing sector");
 }
@@ -70,8 +70,10 @@ void help()
 	printf("bulk insert DBNAME/TABLENAME from PATH with (CONFIG)\n");
 	printf("Import data from PATH into the specified db/table. If PATH is a directory, its files will be recursively imported.\n");
 	printf("TABLENAME is optional and will be defined from the directory name's file if not specified.\n");
+	printf("PATH may be \"-\" to read CSV lines from stdin (TABLENAME required). Files ending in .gz, .zst, .xz or .bz2 are decompressed on the fly.\n");
+	printf("An interrupted import leaves DBNAME/import.journal behind: running the same import again skips the files already imported.\n");
 	printf("(CONFIG) is a configuration string with the following format:\n");
-	printf("    (FILE_DEL=1/0,KEYS=N,MZ=1/0,BIN=1/0,WFP=1/0,OVERWRITE=1/0,SORT=1/0,FIELDS=N,VALIDATE_FIELDS=1/0,VALIDATE_VERSION=1/0,VERBOSE=1/0,COLLATE=1/0,MAX_RECORD=N,TMP_PATH=/path/to/tmp)\n");
+	printf("    (FILE_DEL=1/0,KEYS=N,MZ=1/0,BIN=1/0,WFP=1/0,OVERWRITE=1/0,SORT=1/0,FIELDS=N,VALIDATE_FIELDS=1/0,VALIDATE_VERSION=1/0,VERBOSE=1/0,COLLATE=1/0,MAX_RECORD=N,INCREMENTAL=0/1/2,PACE_WRITES=1/0,MIN_THREADS=N,MAX_THREADS=N,TMP_PATH=/path/to/tmp)\n");
 	printf("    Where 1/0 represents true/false, and N is an integer.\n");
 	printf("    FILE_DEL: Delete file after importation is complete.\n");
 	printf("    KEYS: Number of binary keys in the CSV file.\n");
@@ -84,9 +86,12 @@ void help()
 	printf("    VALIDATE_VERSION: Validate version.json. Default: 1\n");
 	printf("    VERBOSE: Enable verbose mode. Default: 0\n");
 	printf("    THREADS: Define the number of threads to be used during the importation process. Defaul value: half of system available.\n");
+	printf("    MIN_THREADS, MAX_THREADS: when MAX_THREADS is set, the number of threads starts at THREADS and is adapted to the measured throughput and I/O wait, between MIN_THREADS and MAX_THREADS. Default: 1 and 0 (fixed)\n");
 	printf("    COLLATE: Perform collation after import, removing data larger than MAX_RECORD bytes. Default: 0\n");
 	printf("    MAX_RECORD: define the max record size, if a sector is bigger than \"MAX_RECORD\" bytes will be removed.\n");
 	printf("    MAX_RAM_PERCENT: limit the system RAM usage during collate process. Default value: 50.\n");
+	printf("    INCREMENTAL: 1 to skip the files that did not change since they were last imported (see DBNAME/import.manifest), 2 to only print the sectors each changed file would write. Default: 0\n");
+	printf("    PACE_WRITES: write back the new (.tmp) sectors in small windows and drop them from the page cache, keeping it for queries. Default: 0\n");
 	printf("    TMP_PATH: Define the temporary directory. Default value \"/tmp\".\n");
 	printf("	It is not mandatory to specify all parameters; default values will be assumed for missing parameters.\n\n");
 
@@ -119,9 +124,17 @@ void help()
 
 	printf("	delete from DBNAME/TABLENAME records from PATH\n");
 	printf("    	Similar to the previous command, but the records (may be more than one) will be loaded from a csv file in PATH\n\n");
+
+	printf("	tombstone from DBNAME/TABLENAME keys KEY_LIST\n");
+	printf("	tombstone from DBNAME/TABLENAME record CSV_RECORD\n");
+	printf("	tombstone from DBNAME/TABLENAME records from PATH\n");
+	printf("    	Same as the delete commands, but the records are hidden at once and physically removed by the next collate.\n");
+	printf("    	The keys or records are added to the delete log of the table (\"%s\" in the table directory)\n\n", LDB_TOMBSTONE_NAME);
 	
 	printf("	collate DBNAME/TABLENAME max LENGTH\n");
-	printf("    	Collates all lists in a table, removing duplicates and records greater than LENGTH bytes\n\n");
+	printf("    	Collates all lists in a table, removing duplicates and records greater than LENGTH bytes.\n");
+	printf("    	Sectors unchanged since they were last collated are skipped, and sectors that grew only have the lists added to since collated\n");
+	printf("    	(the whole sector is collated once 25%% of it is dead space)\n\n");
 	
 	printf("	merge DBNAME/TABLENAME1 into DBNAME/TABLENAME2 max LENGTH\n");
 	printf("    	Merges tables erasing tablename1 when done. Tables must have the same configuration\n\n");
@@ -237,6 +250,11 @@ bool execute(char *raw_command)
 		case DELETE_RECORDS:
 			ldb_command_delete_records(command);
 			break;
+		case TOMBSTONE_KEYS:
+		case TOMBSTONE_RECORD:
+		case TOMBSTONE_RECORDS:
+			ldb_command_tombstone(command);
+			break;
 
 		case MERGE:
 			ldb_command_merge(command);
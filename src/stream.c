@@ -0,0 +1,584 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/stream.c
+ *
+ * Streaming import sources: stdin and compressed CSV files
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file stream.c
+ * @date 18 October 2026
+ * @brief Decode stdin or compressed CSV inputs on the fly and feed them to the importer.
+ *
+ * The importer reads lines from a pipe. A pipeline thread fills that pipe with the
+ * decompressed source, optionally sorted and deduplicated (equivalent to "sort -u")
+ * using in-memory runs that are spilled to the tmp path and k-way merged, so no
+ * uncompressed copy of the input is ever written to disk.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "stream.h"
+#include "logger.h"
+
+/* Supported compressed extensions. A NULL tool means in-process zlib decoding */
+static const struct
+{
+	char *ext;
+	char *tool;
+} decompressors[] = {
+	{".gz", NULL},
+	{".zst", "zstd"},
+	{".xz", "xz"},
+	{".bz2", "bzip2"},
+};
+#define DECOMPRESSORS_NUMBER (sizeof(decompressors) / sizeof(decompressors[0]))
+
+/* A sorting run: lines are stored zero-terminated in an arena and sorted by offset */
+typedef struct stream_run_t
+{
+	char *arena;
+	size_t used;
+	size_t size;
+	size_t *lines;
+	size_t count;
+	size_t lines_size;
+} stream_run_t;
+
+/* Spilled run being merged */
+typedef struct stream_merge_t
+{
+	FILE *fp;
+	char *line;
+	size_t len;
+} stream_merge_t;
+
+static int stream_decompressor(char *path)
+{
+	size_t path_ln = strlen(path);
+	for (int i = 0; i < DECOMPRESSORS_NUMBER; i++)
+	{
+		size_t ext_ln = strlen(decompressors[i].ext);
+		if (path_ln > ext_ln && !strcmp(path + path_ln - ext_ln, decompressors[i].ext))
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * @brief Checks if a path must be imported through a stream (stdin or compressed file)
+ *
+ * @param path input path
+ * @return true if the input is a stream
+ */
+bool ldb_stream_is_stream(char *path)
+{
+	return !strcmp(path, LDB_STREAM_STDIN) || stream_decompressor(path) >= 0;
+}
+
+/**
+ * @brief Read a block of decompressed data from the stream source and update the consumed counter
+ *
+ * @param stream stream
+ * @param buf destination buffer
+ * @param size buffer size
+ * @return number of bytes read, 0 at EOF, -1 on error
+ */
+static ssize_t stream_read(ldb_stream_t *stream, uint8_t *buf, size_t size)
+{
+	ssize_t n = 0;
+	if (stream->gz)
+	{
+		n = gzread(stream->gz, buf, size);
+		if (n >= 0)
+			atomic_store(&stream->consumed, gzoffset(stream->gz));
+		/* gzread also returns 0 when the input ends in the middle of a member (Z_BUF_ERROR),
+		   only a clean end of the compressed data counts as EOF */
+		if (!n)
+		{
+			int err = Z_OK;
+			gzerror(stream->gz, &err);
+			if (err != Z_OK || !gzeof(stream->gz))
+			{
+				log_info("Compressed input is truncated or corrupted: %s\n", gzerror(stream->gz, &err));
+				n = -1;
+			}
+		}
+	}
+	else if (stream->decoder)
+	{
+		n = fread(buf, 1, size, stream->decoder);
+		if (!n && ferror(stream->decoder))
+			n = -1;
+		/* The decompressor shares the open file description, its offset is our progress */
+		off_t pos = lseek(stream->source_fd, 0, SEEK_CUR);
+		if (pos >= 0)
+			atomic_store(&stream->consumed, pos);
+	}
+	else
+	{
+		n = fread(buf, 1, size, stdin);
+		if (!n && ferror(stdin))
+			n = -1;
+		atomic_fetch_add(&stream->consumed, n > 0 ? n : 0);
+	}
+	return n;
+}
+
+static int stream_line_cmp(const void *a, const void *b, void *arena)
+{
+	return strcmp((char *) arena + *(size_t *) a, (char *) arena + *(size_t *) b);
+}
+
+/**
+ * @brief Sort a run and write its unique lines to "out"
+ *
+ * @param run run to be sorted. It is emptied afterwards
+ * @param out output file
+ * @return true on success
+ */
+static bool stream_run_flush(stream_run_t *run, FILE *out)
+{
+	qsort_r(run->lines, run->count, sizeof(size_t), stream_line_cmp, run->arena);
+
+	char *last = NULL;
+	for (size_t i = 0; i < run->count; i++)
+	{
+		char *line = run->arena + run->lines[i];
+		if (last && !strcmp(last, line))
+			continue;
+		if (fputs(line, out) == EOF || fputc('\n', out) == EOF)
+			return false;
+		last = line;
+	}
+	run->used = 0;
+	run->count = 0;
+	return true;
+}
+
+/**
+ * @brief Append a chunk of a line to the current run, registering the line when it is complete
+ *
+ * @param run run
+ * @param start offset of the line being assembled
+ * @param data chunk
+ * @param len chunk length
+ * @param complete true if the chunk ends the line
+ */
+static void stream_run_append(stream_run_t *run, size_t start, uint8_t *data, size_t len, bool complete)
+{
+	if (run->used + len + 1 > run->size)
+	{
+		while (run->used + len + 1 > run->size)
+			run->size *= 2;
+		run->arena = realloc(run->arena, run->size);
+	}
+	if (len)
+		memcpy(run->arena + run->used, data, len);
+	run->used += len;
+
+	if (!complete)
+		return;
+
+	run->arena[run->used++] = 0;
+	if (run->count == run->lines_size)
+	{
+		run->lines_size *= 2;
+		run->lines = realloc(run->lines, run->lines_size * sizeof(size_t));
+	}
+	run->lines[run->count++] = start;
+}
+
+/**
+ * @brief Spill the current run to an anonymous file in the tmp directory
+ *
+ * @param stream stream
+ * @param run run to be spilled
+ * @param runs spilled runs list
+ * @param runs_number number of spilled runs
+ * @return true on success
+ */
+static bool stream_run_spill(ldb_stream_t *stream, stream_run_t *run, stream_merge_t **runs, int *runs_number)
+{
+	char tmp[LDB_MAX_PATH + 32];
+	snprintf(tmp, sizeof(tmp), "%s/ldb-stream-XXXXXX", stream->tmp_path);
+	int fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+	{
+		log_info("Cannot create sort run in %s: %s\n", stream->tmp_path, strerror(errno));
+		return false;
+	}
+	unlink(tmp);
+
+	FILE *fp = fdopen(fd, "w+");
+	if (!stream_run_flush(run, fp) || fflush(fp))
+	{
+		log_info("Cannot write sort run in %s: %s\n", stream->tmp_path, strerror(errno));
+		fclose(fp);
+		return false;
+	}
+	rewind(fp);
+
+	*runs = realloc(*runs, (*runs_number + 1) * sizeof(stream_merge_t));
+	(*runs)[*runs_number] = (stream_merge_t) {.fp = fp, .line = NULL, .len = 0};
+	(*runs_number)++;
+	return true;
+}
+
+static bool stream_merge_next(stream_merge_t *run)
+{
+	ssize_t ln = getline(&run->line, &run->len, run->fp);
+	if (ln <= 0)
+		return false;
+	if (run->line[ln - 1] == '\n')
+		run->line[ln - 1] = 0;
+	return true;
+}
+
+static void stream_heap_down(stream_merge_t *runs, int *heap, int n, int i)
+{
+	while (true)
+	{
+		int min = i, l = 2 * i + 1, r = 2 * i + 2;
+		if (l < n && strcmp(runs[heap[l]].line, runs[heap[min]].line) < 0)
+			min = l;
+		if (r < n && strcmp(runs[heap[r]].line, runs[heap[min]].line) < 0)
+			min = r;
+		if (min == i)
+			return;
+		int t = heap[i];
+		heap[i] = heap[min];
+		heap[min] = t;
+		i = min;
+	}
+}
+
+/**
+ * @brief k-way merge of the spilled runs into "out", removing duplicated lines
+ *
+ * @param runs spilled runs
+ * @param runs_number number of runs
+ * @param out output file
+ * @return true on success
+ */
+static bool stream_merge(stream_merge_t *runs, int runs_number, FILE *out)
+{
+	int *heap = malloc(runs_number * sizeof(int));
+	int n = 0;
+	for (int i = 0; i < runs_number; i++)
+		if (stream_merge_next(&runs[i]))
+			heap[n++] = i;
+	for (int i = n / 2 - 1; i >= 0; i--)
+		stream_heap_down(runs, heap, n, i);
+
+	bool out_ok = true;
+	char *last = NULL;
+	size_t last_len = 0;
+	while (n && out_ok)
+	{
+		stream_merge_t *top = &runs[heap[0]];
+		if (!last || strcmp(last, top->line))
+		{
+			out_ok = fputs(top->line, out) != EOF && fputc('\n', out) != EOF;
+			size_t ln = strlen(top->line) + 1;
+			if (ln > last_len)
+			{
+				last_len = ln;
+				last = realloc(last, last_len);
+			}
+			memcpy(last, top->line, ln);
+		}
+		if (!stream_merge_next(top))
+			heap[0] = heap[--n];
+		stream_heap_down(runs, heap, n, 0);
+	}
+	free(last);
+	free(heap);
+	return out_ok;
+}
+
+/**
+ * @brief Pipeline thread. Decodes the source and writes lines into the importer pipe
+ *
+ * @param ptr stream
+ */
+static void *stream_pipeline(void *ptr)
+{
+	ldb_stream_t *stream = ptr;
+
+	/* A closed read end must turn into EPIPE for this thread, not kill the process */
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	FILE *out = fdopen(stream->out_fd, "w");
+	setvbuf(out, NULL, _IOFBF, LDB_STREAM_BLOCK);
+	uint8_t *buf = malloc(LDB_STREAM_BLOCK);
+
+	stream_run_t run = {0};
+	stream_merge_t *runs = NULL;
+	int runs_number = 0;
+	if (stream->sort)
+	{
+		run.size = LDB_STREAM_BLOCK;
+		run.arena = malloc(run.size);
+		run.lines_size = LDB_STREAM_BLOCK / 64;
+		run.lines = malloc(run.lines_size * sizeof(size_t));
+	}
+
+	size_t line_start = 0;
+	bool in_line = false;
+	bool ok = true;
+	ssize_t n;
+	while (ok && (n = stream_read(stream, buf, LDB_STREAM_BLOCK)) > 0)
+	{
+		if (!stream->sort)
+		{
+			ok = fwrite(buf, 1, n, out) == n;
+			in_line = buf[n - 1] != '\n';
+			continue;
+		}
+
+		uint8_t *p = buf;
+		uint8_t *end = buf + n;
+		while (p < end)
+		{
+			if (!in_line)
+			{
+				/* Runs are only spilled between lines */
+				if (run.used >= LDB_STREAM_RUN_SIZE && !(ok = stream_run_spill(stream, &run, &runs, &runs_number)))
+					break;
+				line_start = run.used;
+				in_line = true;
+			}
+			uint8_t *lf = memchr(p, '\n', end - p);
+			size_t len = (lf ? lf : end) - p;
+			stream_run_append(&run, line_start, p, len, lf != NULL);
+			if (lf)
+				in_line = false;
+			p += len + (lf ? 1 : 0);
+		}
+	}
+
+	if (n < 0)
+	{
+		log_info("Error reading input stream\n");
+		ok = false;
+	}
+
+	if (ok && in_line)
+	{
+		if (stream->sort)
+			stream_run_append(&run, line_start, NULL, 0, true);
+		else
+			ok = fputc('\n', out) != EOF;
+	}
+
+	if (ok && stream->sort)
+	{
+		if (!runs_number)
+			ok = stream_run_flush(&run, out);
+		else if ((ok = stream_run_spill(stream, &run, &runs, &runs_number)))
+		{
+			log_info("Merging %d sorted runs\n", runs_number);
+			ok = stream_merge(runs, runs_number, out);
+		}
+	}
+
+	for (int i = 0; i < runs_number; i++)
+	{
+		fclose(runs[i].fp);
+		free(runs[i].line);
+	}
+	free(runs);
+	free(run.arena);
+	free(run.lines);
+	free(buf);
+
+	/* EPIPE means the importer stopped reading, that is not an input error */
+	if (fclose(out) && errno != EPIPE)
+		ok = false;
+	if (!ok && errno != EPIPE)
+		stream->error = -1;
+	return NULL;
+}
+
+/**
+ * @brief Start an external decompressor reading from the source file descriptor
+ *
+ * @param stream stream
+ * @param tool decompressor executable
+ * @return true on success
+ */
+static bool stream_decoder_start(ldb_stream_t *stream, char *tool)
+{
+	int fd[2];
+	if (pipe2(fd, O_CLOEXEC))
+		return false;
+
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		close(fd[0]);
+		close(fd[1]);
+		return false;
+	}
+	if (!pid)
+	{
+		dup2(stream->source_fd, STDIN_FILENO);
+		dup2(fd[1], STDOUT_FILENO);
+		execlp(tool, tool, "-dc", (char *) NULL);
+		_exit(127);
+	}
+	close(fd[1]);
+	stream->decoder_pid = pid;
+	stream->decoder = fdopen(fd[0], "r");
+	return true;
+}
+
+/**
+ * @brief Open a streaming import source
+ *
+ * @param path input path. "-" for stdin, or a .gz/.zst/.xz/.bz2 file
+ * @param sort true to sort and remove duplicated lines before delivering them
+ * @param tmp_path directory used to spill sort runs
+ * @return stream, or NULL on failure
+ */
+ldb_stream_t *ldb_stream_open(char *path, bool sort, char *tmp_path)
+{
+	ldb_stream_t *stream = calloc(1, sizeof(ldb_stream_t));
+	stream->source_fd = -1;
+	stream->out_fd = -1;
+	stream->sort = sort;
+	strncpy(stream->tmp_path, tmp_path, LDB_MAX_PATH - 1);
+	atomic_init(&stream->consumed, 0);
+
+	struct stat st;
+	if (!strcmp(path, LDB_STREAM_STDIN))
+	{
+		if (!fstat(STDIN_FILENO, &st) && S_ISREG(st.st_mode))
+			stream->total = st.st_size;
+	}
+	else
+	{
+		stream->source_fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (stream->source_fd < 0 || fstat(stream->source_fd, &st))
+		{
+			log_info("Cannot open %s: %s\n", path, strerror(errno));
+			ldb_stream_close(stream);
+			return NULL;
+		}
+		stream->total = st.st_size;
+
+		int d = stream_decompressor(path);
+		if (!decompressors[d].tool)
+			stream->gz = gzdopen(dup(stream->source_fd), "r");
+		else if (!stream_decoder_start(stream, decompressors[d].tool))
+		{
+			log_info("Cannot start %s to decode %s\n", decompressors[d].tool, path);
+			ldb_stream_close(stream);
+			return NULL;
+		}
+
+		if (stream->gz)
+			gzbuffer(stream->gz, LDB_STREAM_BLOCK);
+		else if (!stream->decoder)
+		{
+			ldb_stream_close(stream);
+			return NULL;
+		}
+	}
+
+	int fd[2];
+	if (pipe2(fd, O_CLOEXEC))
+	{
+		ldb_stream_close(stream);
+		return NULL;
+	}
+	stream->fp = fdopen(fd[0], "r");
+	stream->out_fd = fd[1];
+
+	if (pthread_create(&stream->thread, NULL, stream_pipeline, stream))
+	{
+		close(stream->out_fd);
+		stream->out_fd = -1;
+		ldb_stream_close(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+/**
+ * @brief Number of source (compressed) bytes consumed so far
+ *
+ * @param stream stream
+ * @return consumed bytes
+ */
+uint64_t ldb_stream_consumed(ldb_stream_t *stream)
+{
+	return atomic_load(&stream->consumed);
+}
+
+/**
+ * @brief Close a stream, stopping the pipeline thread and the decompressor
+ *
+ * @param stream stream
+ * @return 0 if the whole input was decoded without errors, -1 otherwise
+ */
+int ldb_stream_close(ldb_stream_t *stream)
+{
+	if (!stream)
+		return -1;
+
+	bool finished = true;
+	if (stream->fp)
+	{
+		/* Check if the importer consumed the whole stream before closing the read end */
+		finished = fgetc(stream->fp) == EOF;
+		fclose(stream->fp);
+	}
+	if (stream->out_fd >= 0)
+		pthread_join(stream->thread, NULL);
+
+	int result = stream->error;
+	if (stream->decoder)
+		fclose(stream->decoder);
+	if (stream->decoder_pid > 0)
+	{
+		int status = 0;
+		waitpid(stream->decoder_pid, &status, 0);
+		if (finished && (!WIFEXITED(status) || WEXITSTATUS(status)))
+		{
+			log_info("Decompressor exited with status %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+			result = -1;
+		}
+	}
+	if (stream->gz)
+		gzclose(stream->gz);
+	if (stream->source_fd >= 0)
+		close(stream->source_fd);
+	free(stream);
+	return result;
+}
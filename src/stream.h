@@ -0,0 +1,38 @@
+#ifndef __STREAM_H
+#define __STREAM_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "ldb.h"
+
+#define LDB_STREAM_STDIN "-"
+#define LDB_STREAM_BLOCK (1024 * 1024) // Decompressed read block
+#define LDB_STREAM_RUN_SIZE (256 * 1024 * 1024) // In-memory sort run size before spilling to disk
+
+/**
+ * @brief Line-oriented import source. Raw input (stdin or a compressed file) is decoded
+ * (and optionally sorted) by a pipeline thread and delivered to the importer through "fp".
+ */
+typedef struct ldb_stream_t
+{
+	FILE *fp;                          // Read end consumed by the importer
+	int source_fd;                     // Raw source descriptor, -1 when reading from stdin
+	pid_t decoder_pid;                 // External decompressor, 0 if none
+	FILE *decoder;                     // Decompressed output of the external decompressor
+	void *gz;                          // zlib handle for .gz inputs
+	int out_fd;                        // Write end fed by the pipeline thread
+	bool sort;
+	char tmp_path[LDB_MAX_PATH];
+	atomic_uint_fast64_t consumed;     // Source bytes consumed so far
+	uint64_t total;                    // Source size, 0 if unknown
+	pthread_t thread;
+	int error;
+} ldb_stream_t;
+
+bool ldb_stream_is_stream(char *path);
+ldb_stream_t *ldb_stream_open(char *path, bool sort, char *tmp_path);
+uint64_t ldb_stream_consumed(ldb_stream_t *stream);
+int ldb_stream_close(ldb_stream_t *stream);
+#endif
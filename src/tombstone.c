@@ -0,0 +1,484 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/tombstone.c
+ *
+ * Delete log of a table
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tombstone.c
+ * @date 18 October 2026
+ * @brief Tombstones: records deleted at read time, until the next collate purges them.
+ *
+ * The delete log of a table (LDB_TOMBSTONE_NAME, in the table directory) has one tombstone
+ * per line, with the syntax of the delete command: a hex key, optionally followed by the CSV
+ * record to delete, where '*' fields match any value. Tombstones are appended under an
+ * exclusive lock of the log.
+ *
+ * Readers load the log into delete tuples indexed by main key (see ldb_delete_tuples_load),
+ * cached per table and reloaded when the log changes, checked every LDB_TOMBSTONE_CHECK
+ * seconds at most. The fetch functions and the sector scan skip the records matching a
+ * tombstone. Since collate reads the table through them, a collated sector no longer holds
+ * the records: the tombstones of the sectors collated are then removed from the log.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "ldb.h"
+#include "collate.h"
+#include "ldb_string.h"
+#include "logger.h"
+
+/* Delete logs loaded by this process. Readers take the current tombstones of a table
+ * without the lock: the lock only serializes the checks and reloads of the log.
+ *
+ * The current tombstones of a table are published in one word with the number of readers
+ * holding them (in the upper 16 bits). A reader takes a reference by incrementing that
+ * number along with the pointer it loads, so a reload can never free tombstones a reader
+ * is about to use. A reload moves the readers holding the previous tombstones to their
+ * own count, the last release frees them. User space addresses fit in the lower 48 bits. */
+#define TOMBSTONES_READER (1ULL << 48)
+#define TOMBSTONES_PTR(w) ((ldb_tombstones_t *) (uintptr_t) ((w) & (TOMBSTONES_READER - 1)))
+
+static struct
+{
+	pthread_mutex_t lock;
+	struct
+	{
+		char db[LDB_MAX_NAME];
+		char table[LDB_MAX_NAME];
+		_Atomic uint64_t current;   // tombstones | readers << 48, 0 if the table has no tombstones
+		_Atomic time_t checked;
+		atomic_bool loaded;
+	} tables[LDB_TOMBSTONE_TABLES];
+	atomic_int number;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void tombstone_path(struct ldb_table table, char *path)
+{
+	snprintf(path, LDB_MAX_PATH, "%s/%s/%s/%s", ldb_root, table.db, table.table, LDB_TOMBSTONE_NAME);
+}
+
+/* Tombstones do not apply to temporary tables, nor to MZ tables (not read by the fetch functions) */
+static bool tombstone_table(struct ldb_table table)
+{
+	return !table.tmp && (table.definitions < 0 || !(table.definitions & LDB_TABLE_DEFINITION_MZ));
+}
+
+/* Open the delete log locked, the log may have been replaced while waiting for the lock */
+static int tombstone_open_locked(char *path, int flags)
+{
+	while (true)
+	{
+		int fd = open(path, flags, 0644);
+		if (fd < 0)
+			return -1;
+		struct stat st, path_st;
+		if (flock(fd, LOCK_EX) || fstat(fd, &st))
+		{
+			close(fd);
+			return -1;
+		}
+		if (!stat(path, &path_st) && path_st.st_ino == st.st_ino)
+			return fd;
+		close(fd);
+		if (!(flags & O_CREAT))
+			return -1;
+	}
+}
+
+/**
+ * @brief Add tombstones to the delete log of a table
+ *
+ * @param table table
+ * @param buffer tombstones: hex key, optionally followed by a comma and a CSV record
+ * @param d tombstone delimiters
+ * @return number of tombstones added, -1 if one is not valid or the log cannot be written
+ */
+int ldb_tombstone_add(struct ldb_table table, char *buffer, char *d)
+{
+	/* Validate the tombstones and write them one per line */
+	size_t ln = strlen(buffer);
+	char *lines = malloc(ln + 2);
+	size_t lines_ln = 0;
+	int number = 0;
+	char *save = NULL;
+	for (char *line = strtok_r(buffer, d, &save); line; line = strtok_r(NULL, d, &save))
+	{
+		if (!*line)
+			continue;
+		int key_hex = table.key_ln * 2;
+		char key[key_hex + 1];
+		snprintf(key, sizeof(key), "%s", line);
+		if (strlen(line) < key_hex || (line[key_hex] && line[key_hex] != ',') || !ldb_valid_hex(key))
+		{
+			log_info("Invalid tombstone for %s/%s: %s\n", table.db, table.table, line);
+			free(lines);
+			return -1;
+		}
+		lines_ln += sprintf(lines + lines_ln, "%s\n", line);
+		number++;
+	}
+
+	int result = -1;
+	char path[LDB_MAX_PATH];
+	tombstone_path(table, path);
+	int fd = number ? tombstone_open_locked(path, O_WRONLY | O_APPEND | O_CREAT) : -1;
+	if (fd >= 0)
+	{
+		if (write(fd, lines, lines_ln) == (ssize_t) lines_ln && !fdatasync(fd))
+			result = number;
+		close(fd);
+	}
+	else if (!number)
+		result = 0;
+
+	if (result < 0)
+		log_info("Error writing the delete log %s\n", path);
+	else if (result)
+		log_info("%s/%s: %d tombstones added\n", table.db, table.table, number);
+	free(lines);
+	return result;
+}
+
+static void tombstones_free(ldb_tombstones_t *tombstones)
+{
+	if (!tombstones)
+		return;
+	ldb_collate_delete_free(&tombstones->job);
+	free(tombstones);
+}
+
+/* Load the delete log of a table, for a cache entry or for the reader only (cached < 0) */
+static ldb_tombstones_t *tombstones_load(struct ldb_table table, char *path, int cached)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return NULL;
+
+	struct stat st;
+	char *buffer = NULL;
+	ldb_tombstones_t *tombstones = NULL;
+	if (!fstat(fileno(fp), &st) && st.st_size && (buffer = malloc(st.st_size + 1)))
+	{
+		size_t size = fread(buffer, 1, st.st_size, fp);
+		buffer[size] = 0;
+
+		char db_table[LDB_MAX_NAME * 2 + 1];
+		snprintf(db_table, sizeof(db_table), "%s/%s", table.db, table.table);
+		tombstones = calloc(1, sizeof(ldb_tombstones_t));
+		tombstones->table = ldb_read_cfg(db_table);
+		tombstones->inode = st.st_ino;
+		tombstones->size = size;
+		tombstones->cached = cached;
+		atomic_init(&tombstones->refs, cached < 0 ? 1 : 0);
+		ldb_delete_tuples_load(&tombstones->job, buffer, "\n", tombstones->table);
+		for (int i = 0; i < tombstones->job.tuples_number; i++)
+			tombstones->sectors[tombstones->job.tuples[i]->key[0]] = true;
+		log_debug("%s/%s: %d tombstones loaded\n", table.db, table.table, tombstones->job.tuples_number);
+	}
+	free(buffer);
+	fclose(fp);
+	return tombstones;
+}
+
+/* Cache entry of a table, -1 if not cached. Entries are never removed nor renamed, so
+ * they are looked up without the lock. */
+static int tombstones_find(struct ldb_table table)
+{
+	int number = atomic_load(&cache.number);
+	for (int i = 0; i < number; i++)
+		if (!strcmp(cache.tables[i].db, table.db) && !strcmp(cache.tables[i].table, table.table))
+			return i;
+	return -1;
+}
+
+/* Cache entry of a table, added if missing. -1 if the cache is full */
+static int tombstones_entry(struct ldb_table table)
+{
+	int i = tombstones_find(table);
+	if (i >= 0)
+		return i;
+
+	pthread_mutex_lock(&cache.lock);
+	i = tombstones_find(table);
+	if (i < 0 && atomic_load(&cache.number) < LDB_TOMBSTONE_TABLES)
+	{
+		i = atomic_load(&cache.number);
+		strcpy(cache.tables[i].db, table.db);
+		strcpy(cache.tables[i].table, table.table);
+		atomic_store(&cache.tables[i].current, 0);
+		atomic_store(&cache.tables[i].loaded, false);
+		atomic_store(&cache.number, i + 1);
+	}
+	else if (i < 0)
+	{
+		static atomic_bool warned;
+		if (!atomic_exchange(&warned, true))
+			log_info("Warning: more than %d tables with tombstones, the delete logs of the others are read on each fetch\n", LDB_TOMBSTONE_TABLES);
+	}
+	pthread_mutex_unlock(&cache.lock);
+	return i;
+}
+
+/* Reload the delete log of a cache entry if it changed since it was loaded */
+static void tombstones_check(int i, struct ldb_table table, time_t now)
+{
+	pthread_mutex_lock(&cache.lock);
+	if (atomic_load(&cache.tables[i].loaded) && now - atomic_load(&cache.tables[i].checked) < LDB_TOMBSTONE_CHECK)
+	{
+		pthread_mutex_unlock(&cache.lock);
+		return;
+	}
+
+	ldb_tombstones_t *current = TOMBSTONES_PTR(atomic_load(&cache.tables[i].current));
+	char path[LDB_MAX_PATH];
+	tombstone_path(table, path);
+	struct stat st;
+	bool exists = !stat(path, &st) && st.st_size;
+	if (!exists || !current || current->inode != (uint64_t) st.st_ino || current->size != (uint64_t) st.st_size)
+	{
+		ldb_tombstones_t *tombstones = exists ? tombstones_load(table, path, i) : NULL;
+
+		/* The readers of the previous tombstones move to their count, freed when all are released */
+		uint64_t previous = atomic_exchange(&cache.tables[i].current, (uintptr_t) tombstones);
+		current = TOMBSTONES_PTR(previous);
+		if (current && atomic_fetch_add(&current->refs, previous / TOMBSTONES_READER) + (long) (previous / TOMBSTONES_READER) == 0)
+			tombstones_free(current);
+	}
+	atomic_store(&cache.tables[i].checked, now);
+	atomic_store(&cache.tables[i].loaded, true);
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/**
+ * @brief Get the tombstones of a table, reloading the delete log if it changed. The
+ * tombstones are kept until released with ldb_tombstones_release.
+ *
+ * @param table table
+ * @param key key, NULL for any
+ * @return tombstones, NULL if none applies to the table (or to the main key of "key")
+ */
+ldb_tombstones_t *ldb_tombstones_get(struct ldb_table table, uint8_t *key)
+{
+	if (!tombstone_table(table))
+		return NULL;
+
+	int i = tombstones_entry(table);
+	ldb_tombstones_t *tombstones = NULL;
+
+	/* Not cached: the log is read for this reader only */
+	if (i < 0)
+	{
+		char path[LDB_MAX_PATH];
+		tombstone_path(table, path);
+		tombstones = tombstones_load(table, path, -1);
+		if (tombstones && key && !ldb_delete_key_listed(&tombstones->job, key))
+		{
+			ldb_tombstones_release(tombstones);
+			tombstones = NULL;
+		}
+		return tombstones;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	if (!atomic_load(&cache.tables[i].loaded) || now.tv_sec - atomic_load(&cache.tables[i].checked) >= LDB_TOMBSTONE_CHECK)
+		tombstones_check(i, table, now.tv_sec);
+
+	/* Take a reference of the current tombstones */
+	uint64_t current = atomic_load(&cache.tables[i].current);
+	while (TOMBSTONES_PTR(current) && !atomic_compare_exchange_weak(&cache.tables[i].current, &current, current + TOMBSTONES_READER));
+	tombstones = TOMBSTONES_PTR(current);
+
+	if (tombstones && key && !ldb_delete_key_listed(&tombstones->job, key))
+	{
+		ldb_tombstones_release(tombstones);
+		tombstones = NULL;
+	}
+	return tombstones;
+}
+
+/**
+ * @brief Release tombstones got with ldb_tombstones_get
+ *
+ * @param tombstones tombstones, may be NULL
+ */
+void ldb_tombstones_release(ldb_tombstones_t *tombstones)
+{
+	if (!tombstones)
+		return;
+
+	/* Still published: the reference is returned to the count of the cache entry */
+	if (tombstones->cached >= 0)
+	{
+		_Atomic uint64_t *published = &cache.tables[tombstones->cached].current;
+		uint64_t current = atomic_load(published);
+		while (TOMBSTONES_PTR(current) == tombstones)
+			if (atomic_compare_exchange_weak(published, &current, current - TOMBSTONES_READER))
+				return;
+	}
+
+	if (atomic_fetch_sub(&tombstones->refs, 1) == 1)
+		tombstones_free(tombstones);
+}
+
+/**
+ * @brief Check if tombstones delete records of the main key of "key"
+ *
+ * @param tombstones tombstones
+ * @param key key
+ * @return true if records of the key may be deleted
+ */
+bool ldb_tombstones_listed(ldb_tombstones_t *tombstones, uint8_t *key)
+{
+	return ldb_delete_key_listed(&tombstones->job, key);
+}
+
+/**
+ * @brief Check if a variable length record is deleted
+ *
+ * @param tombstones tombstones
+ * @param key block key
+ * @param subkey block subkey
+ * @param subkey_ln block subkey lenght
+ * @param data record
+ * @param size record size
+ * @return true if the record is deleted
+ */
+bool ldb_tombstones_record(ldb_tombstones_t *tombstones, uint8_t *key, uint8_t *subkey, int subkey_ln, uint8_t *data, uint32_t size)
+{
+	long deleted = 0;
+	return ldb_delete_match(&tombstones->job, tombstones->table, key, subkey, subkey_ln, data, size, &deleted);
+}
+
+/**
+ * @brief Copy a node of fixed records without its deleted records
+ *
+ * @param tombstones tombstones
+ * @param key block key
+ * @param node records
+ * @param size node size
+ * @param out [out] records kept, node size at least
+ * @return bytes kept
+ */
+uint32_t ldb_tombstones_fixed(ldb_tombstones_t *tombstones, uint8_t *key, uint8_t *node, uint32_t size, uint8_t *out)
+{
+	memcpy(out, node, size);
+	long deleted = 0;
+	if (ldb_delete_match(&tombstones->job, tombstones->table, key, NULL, 0, out, size, &deleted))
+		return 0;
+	if (!deleted)
+		return size;
+
+	/* The records deleted were zeroed */
+	int rec_ln = tombstones->table.rec_ln;
+	uint32_t kept = 0;
+	for (uint32_t ptr = 0; ptr + rec_ln <= size; ptr += rec_ln)
+	{
+		bool zero = true;
+		for (int i = 0; zero && i < rec_ln; i++)
+			zero = !out[ptr + i];
+		if (!zero)
+		{
+			memmove(out + kept, out + ptr, rec_ln);
+			kept += rec_ln;
+		}
+	}
+	return kept;
+}
+
+/**
+ * @brief Remove from the delete log the tombstones of collated sectors. Only the tombstones
+ * loaded before the collate started are removed.
+ *
+ * @param table table
+ * @param tombstones tombstones got before the collate started
+ * @param sectors sectors collated: only their tombstones are removed
+ */
+void ldb_tombstones_purge(struct ldb_table table, ldb_tombstones_t *tombstones, bool *sectors)
+{
+	char path[LDB_MAX_PATH];
+	char tmp_path[LDB_MAX_PATH + 4];
+	tombstone_path(table, path);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	int fd = tombstone_open_locked(path, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	char *log = NULL;
+	if (fstat(fd, &st) || (uint64_t) st.st_ino != tombstones->inode || (uint64_t) st.st_size < tombstones->size ||
+		!(log = malloc(st.st_size + 1)) || pread(fd, log, st.st_size, 0) != st.st_size)
+	{
+		free(log);
+		close(fd);
+		return;
+	}
+
+	/* Keep the tombstones of the sectors not collated and those added since */
+	size_t kept = 0;
+	int purged = 0;
+	for (size_t ptr = 0; ptr < tombstones->size;)
+	{
+		char *end = memchr(log + ptr, '\n', tombstones->size - ptr);
+		size_t line_ln = end ? (size_t) (end - (log + ptr)) + 1 : tombstones->size - ptr;
+		uint8_t k0 = 0;
+		ldb_hex_to_bin(log + ptr, 2, &k0);
+		if (sectors[k0])
+			purged++;
+		else
+		{
+			memmove(log + kept, log + ptr, line_ln);
+			kept += line_ln;
+		}
+		ptr += line_ln;
+	}
+	memmove(log + kept, log + tombstones->size, st.st_size - tombstones->size);
+	kept += st.st_size - tombstones->size;
+
+	bool result = true;
+	if (!kept)
+		result = !unlink(path);
+	else
+	{
+		FILE *fp = fopen(tmp_path, "w");
+		result = fp && fwrite(log, 1, kept, fp) == kept && !fflush(fp) && !fdatasync(fileno(fp));
+		result = fp && !fclose(fp) && result && !rename(tmp_path, path);
+	}
+	close(fd);
+	free(log);
+
+	/* The log is checked again by the next read */
+	int i = tombstones_find(table);
+	if (i >= 0)
+		atomic_store(&cache.tables[i].loaded, false);
+
+	if (result)
+		log_info("Table %s: %d tombstones purged\n", table.table, purged);
+	else
+		log_info("Warning: cannot update the delete log %s\n", path);
+}
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/wfp_ignore.c
+ *
+ * Ignored WFP filter
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file wfp_ignore.c
+ * @date 18 October 2026
+ * @brief Filter of the wfps skipped by the snippet importer.
+ *
+ * The list comes from LDB_WFP_IGNORE_NAME in the db directory when present (4-byte
+ * binary wfps, the format of IGNORED_WFP), otherwise from the compiled-in IGNORED_WFP.
+ * It is kept sorted, with a bitset of 2^24 bits (2 MB) over the last three bytes of
+ * each wfp in front of it: most wfps are rejected by a single bit test and only the
+ * hits are confirmed by a binary search. The filter is shared by all the import
+ * threads, which read it without locking: it is built once per import, before any
+ * import job is dispatched.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "wfp_ignore.h"
+#include "ignored.h"
+#include "ldb.h"
+#include "logger.h"
+
+#define WFP_IGNORE_BITS (1 << 24)
+
+static struct
+{
+	pthread_mutex_t lock;
+	bool loaded;
+	char source[LDB_MAX_PATH];  // list file, empty for the compiled-in list
+	uint64_t *bits;
+	uint32_t *list;
+	size_t list_ln;
+} ignore = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int wfp_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+	return (x > y) - (x < y);
+}
+
+/* Build the filter from a list of 4-byte wfps */
+static void wfp_ignore_build(uint8_t *wfps, size_t ln)
+{
+	free(ignore.list);
+	ignore.list_ln = ln / 4;
+	ignore.list = malloc(ignore.list_ln * sizeof(uint32_t) + 1);
+
+	if (!ignore.bits)
+		ignore.bits = malloc(WFP_IGNORE_BITS / 8);
+	memset(ignore.bits, 0, WFP_IGNORE_BITS / 8);
+
+	for (size_t i = 0; i < ignore.list_ln; i++)
+	{
+		uint8_t *w = wfps + i * 4;
+		uint32_t low = w[1] << 16 | w[2] << 8 | w[3];
+		ignore.list[i] = (uint32_t) w[0] << 24 | low;
+		ignore.bits[low >> 6] |= 1ULL << (low & 63);
+	}
+	qsort(ignore.list, ignore.list_ln, sizeof(uint32_t), wfp_cmp);
+}
+
+/**
+ * @brief Load the ignored wfps of a database. The list is read again only if its source changed.
+ * Must not be called while import jobs are running, the filter is replaced in place.
+ *
+ * @param dbname database name
+ */
+void ldb_wfp_ignore_load(char *dbname)
+{
+	char path[LDB_MAX_PATH];
+	snprintf(path, sizeof(path), "%s/%s/%s", ldb_root, dbname, LDB_WFP_IGNORE_NAME);
+	if (!ldb_file_exists(path))
+		*path = 0;
+
+	pthread_mutex_lock(&ignore.lock);
+	if (ignore.loaded && !strcmp(ignore.source, path))
+	{
+		pthread_mutex_unlock(&ignore.lock);
+		return;
+	}
+
+	uint8_t *wfps = NULL;
+	uint64_t ln = *path ? ldb_file_size(path) : 0;
+	FILE *fp = ln ? fopen(path, "rb") : NULL;
+	if (fp)
+	{
+		wfps = malloc(ln);
+		if (fread(wfps, 1, ln, fp) != ln || ln % 4)
+		{
+			log_info("Warning: %s does not contain 4-byte wfps, using the built-in list\n", path);
+			free(wfps);
+			wfps = NULL;
+		}
+		fclose(fp);
+	}
+
+	if (wfps)
+	{
+		wfp_ignore_build(wfps, ln);
+		free(wfps);
+		log_info("Loaded %lu ignored wfps from %s\n", ignore.list_ln, path);
+	}
+	else
+		/* The list is a string literal, its terminating zero is not part of it */
+		wfp_ignore_build(IGNORED_WFP, sizeof(IGNORED_WFP) - 1);
+
+	strcpy(ignore.source, path);
+	ignore.loaded = true;
+	pthread_mutex_unlock(&ignore.lock);
+}
+
+/**
+ * @brief Check if a wfp is ignored
+ *
+ * @param key1 first byte of the wfp
+ * @param wfp remaining three bytes of the wfp
+ * @return true if the wfp must not be imported
+ */
+bool ldb_wfp_ignored(uint8_t key1, uint8_t *wfp)
+{
+	uint32_t low = wfp[0] << 16 | wfp[1] << 8 | wfp[2];
+	if (!(ignore.bits[low >> 6] & (1ULL << (low & 63))))
+		return false;
+
+	uint32_t key = (uint32_t) key1 << 24 | low;
+	return bsearch(&key, ignore.list, ignore.list_ln, sizeof(uint32_t), wfp_cmp) != NULL;
+}
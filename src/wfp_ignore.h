@@ -0,0 +1,10 @@
+#ifndef __WFP_IGNORE_H
+#define __WFP_IGNORE_H
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LDB_WFP_IGNORE_NAME "ignored.wfp"
+
+void ldb_wfp_ignore_load(char *dbname);
+bool ldb_wfp_ignored(uint8_t key1, uint8_t *wfp);
+#endif
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * src/writeback.c
+ *
+ * Paced writeback of temporary sectors
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file writeback.c
+ * @date 18 October 2026
+ * @brief Keeps the .tmp sectors written by import and collate out of the page cache.
+ *
+ * Sectors are appended through stdio, and the list pointers of the map and of the
+ * previous node are updated in place at unaligned offsets, so O_DIRECT cannot be used.
+ * Instead the data area is written back in windows of LDB_WRITEBACK_WINDOW bytes: when
+ * a window is full its writeback is started (sync_file_range) while the previous window,
+ * already on its way to disk, is waited for and dropped from the cache (posix_fadvise
+ * DONTNEED). At most two windows per writer are dirty at any time, and the cache used
+ * by the readers serving queries is left alone. The whole file is dropped when it is closed.
+ *
+ * Pacing is enabled per thread, each writer having one sector open at a time.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include "writeback.h"
+#include "ldb.h"
+
+static __thread struct
+{
+	bool enabled;
+	int fd;             // sector being paced, -1 if none
+	uint64_t started;   // start of the window being filled
+	uint64_t dropped;   // data before this offset was dropped from the cache
+} pacer = {false, -1, 0, 0};
+
+/**
+ * @brief Enable or disable the paced writeback of the sectors written by the calling thread
+ *
+ * @param enable true to enable
+ */
+void ldb_writeback_enable(bool enable)
+{
+	pacer.enabled = enable;
+	pacer.fd = -1;
+}
+
+/**
+ * @brief Check if the calling thread paces its writes
+ */
+bool ldb_writeback_enabled(void)
+{
+	return pacer.enabled;
+}
+
+/**
+ * @brief Account for data appended to a temporary sector, starting the writeback of the
+ * current window and dropping the previous one once the window is full
+ *
+ * @param fp sector
+ * @param end end of the data written so far
+ */
+void ldb_writeback_pace(FILE *fp, uint64_t end)
+{
+	if (!pacer.enabled)
+		return;
+
+	int fd = fileno(fp);
+
+	/* A new sector (or a descriptor reused after a close without finish) */
+	if (fd != pacer.fd || end < pacer.started)
+	{
+		pacer.fd = fd;
+		pacer.started = pacer.dropped = LDB_MAP_SIZE;
+	}
+
+	if (end - pacer.started < LDB_WRITEBACK_WINDOW)
+		return;
+
+	fflush(fp);
+
+	/* Start the writeback of the window just filled */
+	uint64_t window = pacer.started & ~((uint64_t) LDB_WRITEBACK_ALIGN - 1);
+	sync_file_range(fd, window, end - window, SYNC_FILE_RANGE_WRITE);
+
+	/* Wait for the previous window and drop it */
+	if (pacer.dropped < window)
+	{
+		sync_file_range(fd, pacer.dropped, window - pacer.dropped,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(fd, pacer.dropped, window - pacer.dropped, POSIX_FADV_DONTNEED);
+		pacer.dropped = window;
+	}
+	pacer.started = end;
+}
+
+/**
+ * @brief Write back and drop the whole sector before it is closed. Files that were
+ * not paced by the calling thread are left untouched.
+ *
+ * @param fp sector
+ */
+void ldb_writeback_finish(FILE *fp)
+{
+	if (!pacer.enabled || fileno(fp) != pacer.fd)
+		return;
+
+	fflush(fp);
+	sync_file_range(pacer.fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	posix_fadvise(pacer.fd, 0, 0, POSIX_FADV_DONTNEED);
+	pacer.fd = -1;
+}
@@ -0,0 +1,14 @@
+#ifndef __WRITEBACK_H
+#define __WRITEBACK_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LDB_WRITEBACK_WINDOW (8 * 1024 * 1024) // Bytes written before the writeback of a window is started
+#define LDB_WRITEBACK_ALIGN 4096
+
+void ldb_writeback_enable(bool enable);
+bool ldb_writeback_enabled(void);
+void ldb_writeback_pace(FILE *fp, uint64_t end);
+void ldb_writeback_finish(FILE *fp);
+#endif
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * test/bulk_writer.c
+ *
+ * Test harness of the bulk writer API
+ *
+ * Copyright (C) 2018-2021 SCANOSS.COM
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file bulk_writer.c
+ * @brief Load "key,data" lines read from stdin into a table with the bulk writer.
+ *
+ * usage: bulk_writer DBNAME/TABLENAME [abort]
+ *
+ * The key is the hex first field (of the table key length), the data is the rest of the
+ * line. With "abort" the records are discarded instead of committed. Used by test_kb.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ldb.h"
+#include "ldb_error.h"
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2 || !ldb_valid_table(argv[1]))
+	{
+		fprintf(stderr, "usage: %s DBNAME/TABLENAME [abort]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct ldb_table table = ldb_read_cfg(argv[1]);
+	ldb_bulk_writer_t *writer = ldb_bulk_writer_open(table);
+	if (!writer)
+		return EXIT_FAILURE;
+
+	int result = LDB_ERROR_NOERROR;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t ln;
+	uint8_t key[LDB_KEY_LN + 255];
+	while (result == LDB_ERROR_NOERROR && (ln = getline(&line, &size, stdin)) > 0)
+	{
+		line[strcspn(line, "\n")] = 0;
+		char *data = strchr(line, ',');
+		if (!data || data - line != table.key_ln * 2)
+			continue;
+		*data++ = 0;
+		ldb_hex_to_bin(line, table.key_ln * 2, key);
+		result = ldb_bulk_put(writer, key, (uint8_t *) data, strlen(data));
+	}
+	free(line);
+
+	if (result != LDB_ERROR_NOERROR || (argc > 2 && !strcmp(argv[2], "abort")))
+		ldb_bulk_abort(writer);
+	else
+		result = ldb_bulk_commit(writer);
+
+	if (result != LDB_ERROR_NOERROR)
+		fprintf(stderr, "Bulk writer failed: %d\n", result);
+	return result == LDB_ERROR_NOERROR ? EXIT_SUCCESS : EXIT_FAILURE;
+}